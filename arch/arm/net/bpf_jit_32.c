@@ -0,0 +1,958 @@
+/*
+ * Just-In-Time compiler for BPF filters on 32bit ARM
+ *
+ * The generated code only relies on ARMv5 instructions (ARMv4 when no
+ * Thumb interworking is needed), so it runs on ARM926 class cores.  On
+ * ARMv7 constants are built with movw/movt, older cores load them from
+ * a literal pool placed after the epilogue.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; version 2 of the License.
+ */
+
+#include <linux/bitops.h>
+#include <linux/compiler.h>
+#include <linux/errno.h>
+#include <linux/filter.h>
+#include <linux/moduleloader.h>
+#include <linux/netdevice.h>
+#include <linux/string.h>
+#include <linux/slab.h>
+#include <asm/cacheflush.h>
+#include <asm/hwcap.h>
+#include <asm/unaligned.h>
+
+#include "bpf_jit_32.h"
+
+/*
+ * ABI:
+ *
+ * r0	scratch register / return value
+ * r1	scratch register: packet offset for the load helpers
+ * r2	scratch register
+ * r3	scratch register: call target
+ * r4	A register
+ * r5	X register
+ * r6	pointer to the skb
+ * r7	skb->data
+ * r8	skb_headlen(skb)
+ */
+
+#define r_scratch	ARM_R0
+/* r1-r3 are (also) used for the unaligned loads on the non-ARMv7 slowpath */
+#define r_off		ARM_R1
+#define r_A		ARM_R4
+#define r_X		ARM_R5
+#define r_skb		ARM_R6
+#define r_skb_data	ARM_R7
+#define r_skb_hl	ARM_R8
+
+#define SCRATCH_SP_OFFSET	0
+#define SCRATCH_OFF(k)		(SCRATCH_SP_OFFSET + 4 * (k))
+
+#define SEEN_MEM		((1 << BPF_MEMWORDS) - 1)
+#define SEEN_MEM_WORD(k)	(1 << (k))
+#define SEEN_X			(1 << BPF_MEMWORDS)
+#define SEEN_CALL		(1 << (BPF_MEMWORDS + 1))
+#define SEEN_SKB		(1 << (BPF_MEMWORDS + 2))
+#define SEEN_DATA		(1 << (BPF_MEMWORDS + 3))
+
+#define FLAG_IMM_OVERFLOW	(1 << 0)
+
+/*
+ * The code is generated in two passes.  The first one only counts the
+ * instructions and records what the program uses (ctx->seen), so that
+ * the prologue can be sized; the second one writes into ctx->target.
+ */
+struct jit_ctx {
+	const struct sk_filter *skf;
+	unsigned idx;
+	unsigned prologue_bytes;
+	int ret0_fp_idx;
+	u32 seen;
+	u32 flags;
+	u32 *offsets;
+	u32 *target;
+#if __LINUX_ARM_ARCH__ < 7
+	u16 epilogue_bytes;
+	u16 imm_count;
+	u32 *imms;
+#endif
+};
+
+int bpf_jit_enable __read_mostly;
+
+/*
+ * Slow path of the packet loads.  The error flag goes in the upper word
+ * of the result, i.e. r1 under the ARM calling conventions.
+ */
+static u64 jit_get_skb_b(struct sk_buff *skb, int offset)
+{
+	u8 buf, *ptr;
+
+	ptr = bpf_internal_load_pointer(skb, offset, 1, &buf);
+	if (ptr == NULL)
+		return (u64)1 << 32;
+	return *ptr;
+}
+
+static u64 jit_get_skb_h(struct sk_buff *skb, int offset)
+{
+	u16 buf;
+	void *ptr;
+
+	ptr = bpf_internal_load_pointer(skb, offset, 2, &buf);
+	if (ptr == NULL)
+		return (u64)1 << 32;
+	return get_unaligned_be16(ptr);
+}
+
+static u64 jit_get_skb_w(struct sk_buff *skb, int offset)
+{
+	u32 buf;
+	void *ptr;
+
+	ptr = bpf_internal_load_pointer(skb, offset, 4, &buf);
+	if (ptr == NULL)
+		return (u64)1 << 32;
+	return get_unaligned_be32(ptr);
+}
+
+/* ARMv5 has no divide instruction: let the compiler runtime do it */
+static u32 jit_udiv(u32 dividend, u32 divisor)
+{
+	return dividend / divisor;
+}
+
+static inline void _emit(int cond, u32 inst, struct jit_ctx *ctx)
+{
+	if (ctx->target != NULL)
+		ctx->target[ctx->idx] = inst | (cond << 28);
+
+	ctx->idx++;
+}
+
+/*
+ * Emit an instruction that will be executed unconditionally.
+ */
+static inline void emit(u32 inst, struct jit_ctx *ctx)
+{
+	_emit(ARM_COND_AL, inst, ctx);
+}
+
+static u16 saved_regs(struct jit_ctx *ctx)
+{
+	u16 ret = 0;
+
+	if ((ctx->skf->len > 1) ||
+	    (ctx->skf->insns[0].code == BPF_S_RET_A))
+		ret |= 1 << r_A;
+
+#ifdef CONFIG_FRAME_POINTER
+	ret |= (1 << ARM_FP) | (1 << ARM_IP) | (1 << ARM_LR) | (1 << ARM_PC);
+#else
+	if (ctx->seen & SEEN_CALL)
+		ret |= 1 << ARM_LR;
+#endif
+	if (ctx->seen & (SEEN_DATA | SEEN_SKB))
+		ret |= 1 << r_skb;
+	if (ctx->seen & SEEN_DATA)
+		ret |= (1 << r_skb_data) | (1 << r_skb_hl);
+	if (ctx->seen & SEEN_X)
+		ret |= 1 << r_X;
+
+	return ret;
+}
+
+/*
+ * Stack space for the scratch memory words.  Holes in the set of used
+ * words are wasted; the total frame is kept 8 byte aligned as the
+ * helpers we call expect an EABI conforming stack.
+ */
+static unsigned stack_size(struct jit_ctx *ctx)
+{
+	unsigned words = fls(ctx->seen & SEEN_MEM);
+
+	if ((hweight16(saved_regs(ctx)) + words) & 1)
+		words++;
+	return words * 4;
+}
+
+static void build_prologue(struct jit_ctx *ctx)
+{
+	u16 reg_set = saved_regs(ctx);
+	u16 first_inst = ctx->skf->insns[0].code;
+	u16 off;
+
+#ifdef CONFIG_FRAME_POINTER
+	emit(ARM_MOV_R(ARM_IP, ARM_SP), ctx);
+	emit(ARM_PUSH(reg_set), ctx);
+	emit(ARM_SUB_I(ARM_FP, ARM_IP, 4), ctx);
+#else
+	if (reg_set)
+		emit(ARM_PUSH(reg_set), ctx);
+#endif
+
+	if (ctx->seen & (SEEN_DATA | SEEN_SKB))
+		emit(ARM_MOV_R(r_skb, ARM_R0), ctx);
+
+	if (ctx->seen & SEEN_DATA) {
+		off = offsetof(struct sk_buff, data);
+		emit(ARM_LDR_I(r_skb_data, r_skb, off), ctx);
+		/* headlen = len - data_len */
+		off = offsetof(struct sk_buff, len);
+		emit(ARM_LDR_I(r_skb_hl, r_skb, off), ctx);
+		off = offsetof(struct sk_buff, data_len);
+		emit(ARM_LDR_I(r_scratch, r_skb, off), ctx);
+		emit(ARM_SUB_R(r_skb_hl, r_skb_hl, r_scratch), ctx);
+	}
+
+	/* the interpreter starts with A = X = 0, do not leak stack data */
+	if (ctx->seen & SEEN_X)
+		emit(ARM_MOV_I(r_X, 0), ctx);
+	if (first_inst != BPF_S_RET_K)
+		emit(ARM_MOV_I(r_A, 0), ctx);
+
+	if (stack_size(ctx))
+		emit(ARM_SUB_I(ARM_SP, ARM_SP, stack_size(ctx)), ctx);
+}
+
+static void build_epilogue(struct jit_ctx *ctx)
+{
+	u16 reg_set = saved_regs(ctx);
+
+	if (stack_size(ctx))
+		emit(ARM_ADD_I(ARM_SP, ARM_SP, stack_size(ctx)), ctx);
+
+	reg_set &= ~(1 << ARM_LR);
+
+#ifdef CONFIG_FRAME_POINTER
+	/* the first instruction of the prologue was: mov ip, sp */
+	reg_set &= ~(1 << ARM_IP);
+	reg_set |= (1 << ARM_SP);
+	emit(ARM_LDM(ARM_SP, reg_set), ctx);
+#else
+	if (reg_set) {
+		if (ctx->seen & SEEN_CALL)
+			reg_set |= 1 << ARM_PC;
+		emit(ARM_POP(reg_set), ctx);
+	}
+
+	if (!(ctx->seen & SEEN_CALL)) {
+#if __LINUX_ARM_ARCH__ < 5
+		emit(ARM_MOV_R(ARM_PC, ARM_LR), ctx);
+#else
+		emit(ARM_BX(ARM_LR), ctx);
+#endif
+	}
+#endif
+}
+
+/*
+ * Encode x as an ARM "modified immediate": an 8 bit value rotated right
+ * by an even amount.  Returns -1 if that is not possible.
+ */
+static int imm8m(u32 x)
+{
+	u32 rot;
+
+	for (rot = 0; rot < 16; rot++)
+		if ((x & ~ror32(0xff, 2 * rot)) == 0)
+			return rol32(x, 2 * rot) | (rot << 8);
+
+	return -1;
+}
+
+#if __LINUX_ARM_ARCH__ < 7
+
+/*
+ * Offset of the literal pool entry holding k, relative to the PC of the
+ * instruction being emitted.
+ */
+static u16 imm_offset(u32 k, struct jit_ctx *ctx)
+{
+	unsigned i = 0, offset;
+	int imm;
+
+	/* on the "fake" run we just count them (duplicates included) */
+	if (ctx->target == NULL) {
+		ctx->imm_count++;
+		return 0;
+	}
+
+	while ((i < ctx->imm_count) && ctx->imms[i]) {
+		if (ctx->imms[i] == k)
+			break;
+		i++;
+	}
+
+	if (ctx->imms[i] == 0)
+		ctx->imms[i] = k;
+
+	/* constants go just after the epilogue */
+	offset =  ctx->offsets[ctx->skf->len];
+	offset += ctx->prologue_bytes;
+	offset += ctx->epilogue_bytes;
+	offset += i * 4;
+
+	ctx->target[offset / 4] = k;
+
+	/* PC in ARM mode == address of the instruction + 8 */
+	imm = offset - (8 + ctx->idx * 4);
+
+	/* ldr can only reach 4KB ahead: give up on huge programs */
+	if (imm > 4095) {
+		ctx->flags |= FLAG_IMM_OVERFLOW;
+		return 0;
+	}
+
+	return imm;
+}
+
+#endif /* __LINUX_ARM_ARCH__ */
+
+/*
+ * Move an immediate that's not an imm8m to a core register.
+ */
+static inline void emit_mov_i_no8m(int cond, int rd, u32 val,
+				   struct jit_ctx *ctx)
+{
+#if __LINUX_ARM_ARCH__ < 7
+	_emit(cond, ARM_LDR_I(rd, ARM_PC, imm_offset(val, ctx)), ctx);
+#else
+	_emit(cond, ARM_MOVW(rd, val & 0xffff), ctx);
+	if (val > 0xffff)
+		_emit(cond, ARM_MOVT(rd, val >> 16), ctx);
+#endif
+}
+
+static inline void _emit_mov_i(int cond, int rd, u32 val, struct jit_ctx *ctx)
+{
+	int imm12 = imm8m(val);
+
+	if (imm12 >= 0)
+		_emit(cond, ARM_MOV_I(rd, imm12), ctx);
+	else
+		emit_mov_i_no8m(cond, rd, val, ctx);
+}
+
+static inline void emit_mov_i(int rd, u32 val, struct jit_ctx *ctx)
+{
+	_emit_mov_i(ARM_COND_AL, rd, val, ctx);
+}
+
+static inline void _emit_blx_r(int cond, u8 tgt_reg, struct jit_ctx *ctx)
+{
+#if __LINUX_ARM_ARCH__ < 5
+	_emit(cond, ARM_MOV_R(ARM_LR, ARM_PC), ctx);
+
+	if (elf_hwcap & HWCAP_THUMB)
+		_emit(cond, ARM_BX(tgt_reg), ctx);
+	else
+		_emit(cond, ARM_MOV_R(ARM_PC, tgt_reg), ctx);
+#else
+	_emit(cond, ARM_BLX_R(tgt_reg), ctx);
+#endif
+}
+
+static inline void emit_blx_r(u8 tgt_reg, struct jit_ctx *ctx)
+{
+	_emit_blx_r(ARM_COND_AL, tgt_reg, ctx);
+}
+
+/* Branch offset from the current instruction to BPF instruction tgt */
+static inline u32 b_imm(unsigned tgt, struct jit_ctx *ctx)
+{
+	int imm;
+
+	if (ctx->target == NULL)
+		return 0;
+	/*
+	 * ctx->offsets[] are relative to the start of the body, which
+	 * follows the prologue.
+	 */
+	imm  = ctx->offsets[tgt] + ctx->prologue_bytes - (ctx->idx * 4 + 8);
+
+	return imm >> 2;
+}
+
+/*
+ * Return 0 from the filter when cond holds: branch to a "ret #0" of the
+ * program if there is one, else to the epilogue with r0 cleared.  Both
+ * forms take two instructions so that the passes agree on the layout.
+ */
+static inline void emit_err_ret(u8 cond, struct jit_ctx *ctx)
+{
+	if (ctx->ret0_fp_idx >= 0) {
+		_emit(cond, ARM_B(b_imm(ctx->ret0_fp_idx, ctx)), ctx);
+		/* NOP to keep the size constant between passes */
+		emit(ARM_MOV_R(ARM_R0, ARM_R0), ctx);
+	} else {
+		_emit(cond, ARM_MOV_I(ARM_R0, 0), ctx);
+		_emit(cond, ARM_B(b_imm(ctx->skf->len, ctx)), ctx);
+	}
+}
+
+static inline void emit_udiv(u8 rd, u8 rm, u8 rn, struct jit_ctx *ctx)
+{
+	if (rm != ARM_R0)
+		emit(ARM_MOV_R(ARM_R0, rm), ctx);
+	if (rn != ARM_R1)
+		emit(ARM_MOV_R(ARM_R1, rn), ctx);
+
+	ctx->seen |= SEEN_CALL;
+	emit_mov_i(ARM_R3, (u32)jit_udiv, ctx);
+	emit_blx_r(ARM_R3, ctx);
+
+	if (rd != ARM_R0)
+		emit(ARM_MOV_R(rd, ARM_R0), ctx);
+}
+
+/* Halfword load from the skb or the net_device, any offset */
+static inline void emit_ldrh(u8 rd, u8 rn, u32 off, struct jit_ctx *ctx)
+{
+	if (off < 256) {
+		emit(ARM_LDRH_I(rd, rn, off), ctx);
+	} else {
+		emit_mov_i(ARM_R3, off, ctx);
+		emit(ARM_LDRH_R(rd, rn, ARM_R3), ctx);
+	}
+}
+
+static inline void update_on_xread(struct jit_ctx *ctx)
+{
+	ctx->seen |= SEEN_X;
+}
+
+/*
+ * Load 1 << load_order bytes of the packet at the offset held in r_off
+ * into r0, in host order.  The linear part of the skb is read inline;
+ * anything else (fragments, negative SKF_*_OFF offsets, out of bounds)
+ * goes through the C helpers, which follow the interpreter.  Both paths
+ * are predicated on the bounds check, so no branch is needed in between.
+ */
+static void emit_load_packet(int load_order, struct jit_ctx *ctx)
+{
+	static void *const load_func[] = {
+		jit_get_skb_b, jit_get_skb_h, jit_get_skb_w
+	};
+	int i, condt;
+
+	ctx->seen |= SEEN_DATA | SEEN_CALL;
+
+	if (load_order > 0) {
+		/* fast path iff off <= headlen - size, without wrapping */
+		emit(ARM_SUBS_I(r_scratch, r_skb_hl, 1 << load_order), ctx);
+		_emit(ARM_COND_CS, ARM_CMP_R(r_scratch, r_off), ctx);
+		condt = ARM_COND_HS;
+	} else {
+		emit(ARM_CMP_R(r_skb_hl, r_off), ctx);
+		condt = ARM_COND_HI;
+	}
+
+	/* fast path: assemble the big endian value a byte at a time */
+	if (load_order == 0) {
+		_emit(condt, ARM_LDRB_R(ARM_R0, r_skb_data, r_off), ctx);
+	} else {
+		_emit(condt, ARM_ADD_R(ARM_R0, r_skb_data, r_off), ctx);
+		_emit(condt, ARM_LDRB_I(ARM_R2, ARM_R0, 0), ctx);
+		for (i = 1; i < (1 << load_order); i++) {
+			_emit(condt, ARM_LDRB_I(ARM_R3, ARM_R0, i), ctx);
+			_emit(condt, ARM_ORR_S(ARM_R2, ARM_R3, ARM_R2,
+					       SRTYPE_LSL, 8), ctx);
+		}
+		_emit(condt, ARM_MOV_R(ARM_R0, ARM_R2), ctx);
+	}
+	_emit(condt, ARM_MOV_I(ARM_R1, 0), ctx);
+
+	/* the slowpath, the offset is already in r1 */
+	condt ^= 1;
+	_emit(condt, ARM_MOV_R(ARM_R0, r_skb), ctx);
+	_emit_mov_i(condt, ARM_R3, (u32)load_func[load_order], ctx);
+	_emit_blx_r(condt, ARM_R3, ctx);
+
+	/* r1 is the error flag of both paths */
+	emit(ARM_CMP_I(ARM_R1, 0), ctx);
+	emit_err_ret(ARM_COND_NE, ctx);
+}
+
+static int build_body(struct jit_ctx *ctx)
+{
+	const struct sk_filter *prog = ctx->skf;
+	const struct sock_filter *inst;
+	unsigned i, load_order, off, condt;
+	int imm12;
+	u32 k;
+
+	for (i = 0; i < prog->len; i++) {
+		inst = &(prog->insns[i]);
+		/* K as an immediate value operand */
+		k = inst->k;
+
+		/* compute offsets only in the fake pass */
+		if (ctx->target == NULL)
+			ctx->offsets[i] = ctx->idx * 4;
+
+		switch (inst->code) {
+		case BPF_S_LD_IMM:
+			emit_mov_i(r_A, k, ctx);
+			break;
+		case BPF_S_LD_W_LEN:
+			ctx->seen |= SEEN_SKB;
+			BUILD_BUG_ON(FIELD_SIZEOF(struct sk_buff, len) != 4);
+			emit(ARM_LDR_I(r_A, r_skb,
+				       offsetof(struct sk_buff, len)), ctx);
+			break;
+		case BPF_S_LD_MEM:
+			/* A = scratch[k] */
+			ctx->seen |= SEEN_MEM_WORD(k);
+			emit(ARM_LDR_I(r_A, ARM_SP, SCRATCH_OFF(k)), ctx);
+			break;
+		case BPF_S_LD_W_ABS:
+			load_order = 2;
+			goto load;
+		case BPF_S_LD_H_ABS:
+			load_order = 1;
+			goto load;
+		case BPF_S_LD_B_ABS:
+			load_order = 0;
+load:
+			emit_mov_i(r_off, k, ctx);
+load_common:
+			emit_load_packet(load_order, ctx);
+			emit(ARM_MOV_R(r_A, ARM_R0), ctx);
+			break;
+		case BPF_S_LD_W_IND:
+			load_order = 2;
+			goto load_ind;
+		case BPF_S_LD_H_IND:
+			load_order = 1;
+			goto load_ind;
+		case BPF_S_LD_B_IND:
+			load_order = 0;
+load_ind:
+			update_on_xread(ctx);
+			imm12 = imm8m(k);
+			if (imm12 < 0) {
+				emit_mov_i_no8m(ARM_COND_AL, r_off, k, ctx);
+				emit(ARM_ADD_R(r_off, r_X, r_off), ctx);
+			} else {
+				emit(ARM_ADD_I(r_off, r_X, imm12), ctx);
+			}
+			goto load_common;
+		case BPF_S_LDX_IMM:
+			ctx->seen |= SEEN_X;
+			emit_mov_i(r_X, k, ctx);
+			break;
+		case BPF_S_LDX_W_LEN:
+			ctx->seen |= SEEN_X | SEEN_SKB;
+			emit(ARM_LDR_I(r_X, r_skb,
+				       offsetof(struct sk_buff, len)), ctx);
+			break;
+		case BPF_S_LDX_MEM:
+			ctx->seen |= SEEN_X | SEEN_MEM_WORD(k);
+			emit(ARM_LDR_I(r_X, ARM_SP, SCRATCH_OFF(k)), ctx);
+			break;
+		case BPF_S_LDX_B_MSH:
+			/* x = ((*(frame + k)) & 0xf) << 2; */
+			ctx->seen |= SEEN_X;
+			emit_mov_i(r_off, k, ctx);
+			emit_load_packet(0, ctx);
+			emit(ARM_AND_I(ARM_R0, ARM_R0, 0x00f), ctx);
+			emit(ARM_LSL_I(r_X, ARM_R0, 2), ctx);
+			break;
+		case BPF_S_ST:
+			ctx->seen |= SEEN_MEM_WORD(k);
+			emit(ARM_STR_I(r_A, ARM_SP, SCRATCH_OFF(k)), ctx);
+			break;
+		case BPF_S_STX:
+			update_on_xread(ctx);
+			ctx->seen |= SEEN_MEM_WORD(k);
+			emit(ARM_STR_I(r_X, ARM_SP, SCRATCH_OFF(k)), ctx);
+			break;
+		case BPF_S_ALU_ADD_K:
+			/* A += K */
+			imm12 = imm8m(k);
+			if (imm12 < 0) {
+				emit_mov_i_no8m(ARM_COND_AL, r_scratch, k, ctx);
+				emit(ARM_ADD_R(r_A, r_A, r_scratch), ctx);
+			} else {
+				emit(ARM_ADD_I(r_A, r_A, imm12), ctx);
+			}
+			break;
+		case BPF_S_ALU_ADD_X:
+			update_on_xread(ctx);
+			emit(ARM_ADD_R(r_A, r_A, r_X), ctx);
+			break;
+		case BPF_S_ALU_SUB_K:
+			/* A -= K */
+			imm12 = imm8m(k);
+			if (imm12 < 0) {
+				emit_mov_i_no8m(ARM_COND_AL, r_scratch, k, ctx);
+				emit(ARM_SUB_R(r_A, r_A, r_scratch), ctx);
+			} else {
+				emit(ARM_SUB_I(r_A, r_A, imm12), ctx);
+			}
+			break;
+		case BPF_S_ALU_SUB_X:
+			update_on_xread(ctx);
+			emit(ARM_SUB_R(r_A, r_A, r_X), ctx);
+			break;
+		case BPF_S_ALU_MUL_K:
+			/* A *= K */
+			emit_mov_i(r_scratch, k, ctx);
+			emit(ARM_MUL(r_A, r_scratch, r_A), ctx);
+			break;
+		case BPF_S_ALU_MUL_X:
+			update_on_xread(ctx);
+			emit(ARM_MUL(r_A, r_X, r_A), ctx);
+			break;
+		case BPF_S_ALU_DIV_K:
+			/*
+			 * sk_chk_filter() has turned K into its reciprocal:
+			 * A = ((u64)A * K) >> 32, see reciprocal_divide().
+			 */
+			emit_mov_i(ARM_R1, k, ctx);
+			emit(ARM_UMULL(r_scratch, r_A, ARM_R1, r_A), ctx);
+			break;
+		case BPF_S_ALU_DIV_X:
+			update_on_xread(ctx);
+			emit(ARM_CMP_I(r_X, 0), ctx);
+			emit_err_ret(ARM_COND_EQ, ctx);
+			emit_udiv(r_A, r_A, r_X, ctx);
+			break;
+		case BPF_S_ALU_OR_K:
+			/* A |= K */
+			imm12 = imm8m(k);
+			if (imm12 < 0) {
+				emit_mov_i_no8m(ARM_COND_AL, r_scratch, k, ctx);
+				emit(ARM_ORR_R(r_A, r_A, r_scratch), ctx);
+			} else {
+				emit(ARM_ORR_I(r_A, r_A, imm12), ctx);
+			}
+			break;
+		case BPF_S_ALU_OR_X:
+			update_on_xread(ctx);
+			emit(ARM_ORR_R(r_A, r_A, r_X), ctx);
+			break;
+		case BPF_S_ALU_AND_K:
+			/* A &= K */
+			imm12 = imm8m(k);
+			if (imm12 < 0) {
+				emit_mov_i_no8m(ARM_COND_AL, r_scratch, k, ctx);
+				emit(ARM_AND_R(r_A, r_A, r_scratch), ctx);
+			} else {
+				emit(ARM_AND_I(r_A, r_A, imm12), ctx);
+			}
+			break;
+		case BPF_S_ALU_AND_X:
+			update_on_xread(ctx);
+			emit(ARM_AND_R(r_A, r_A, r_X), ctx);
+			break;
+		case BPF_S_ALU_LSH_K:
+			/*
+			 * Large shift counts keep the register shift semantics
+			 * the interpreter gets from the compiler.
+			 */
+			if (k >= 32) {
+				emit_mov_i(r_scratch, k, ctx);
+				emit(ARM_LSL_R(r_A, r_A, r_scratch), ctx);
+			} else if (k) {
+				emit(ARM_LSL_I(r_A, r_A, k), ctx);
+			}
+			break;
+		case BPF_S_ALU_LSH_X:
+			update_on_xread(ctx);
+			emit(ARM_LSL_R(r_A, r_A, r_X), ctx);
+			break;
+		case BPF_S_ALU_RSH_K:
+			if (k >= 32) {
+				emit_mov_i(r_scratch, k, ctx);
+				emit(ARM_LSR_R(r_A, r_A, r_scratch), ctx);
+			} else if (k) {
+				emit(ARM_LSR_I(r_A, r_A, k), ctx);
+			}
+			break;
+		case BPF_S_ALU_RSH_X:
+			update_on_xread(ctx);
+			emit(ARM_LSR_R(r_A, r_A, r_X), ctx);
+			break;
+		case BPF_S_ALU_NEG:
+			/* A = -A */
+			emit(ARM_RSB_I(r_A, r_A, 0), ctx);
+			break;
+		case BPF_S_JMP_JA:
+			/* pc += K */
+			emit(ARM_B(b_imm(i + k + 1, ctx)), ctx);
+			break;
+		case BPF_S_JMP_JEQ_K:
+			/* pc += (A == K) ? pc->jt : pc->jf */
+			condt  = ARM_COND_EQ;
+			goto cmp_imm;
+		case BPF_S_JMP_JGT_K:
+			/* pc += (A > K) ? pc->jt : pc->jf */
+			condt  = ARM_COND_HI;
+			goto cmp_imm;
+		case BPF_S_JMP_JGE_K:
+			/* pc += (A >= K) ? pc->jt : pc->jf */
+			condt  = ARM_COND_HS;
+cmp_imm:
+			imm12 = imm8m(k);
+			if (imm12 < 0) {
+				emit_mov_i_no8m(ARM_COND_AL, r_scratch, k, ctx);
+				emit(ARM_CMP_R(r_A, r_scratch), ctx);
+			} else {
+				emit(ARM_CMP_I(r_A, imm12), ctx);
+			}
+cond_jump:
+			if (inst->jt)
+				_emit(condt, ARM_B(b_imm(i + inst->jt + 1,
+						   ctx)), ctx);
+			if (inst->jf)
+				_emit(condt ^ 1, ARM_B(b_imm(i + inst->jf + 1,
+							     ctx)), ctx);
+			break;
+		case BPF_S_JMP_JEQ_X:
+			/* pc += (A == X) ? pc->jt : pc->jf */
+			condt   = ARM_COND_EQ;
+			goto cmp_x;
+		case BPF_S_JMP_JGT_X:
+			/* pc += (A > X) ? pc->jt : pc->jf */
+			condt   = ARM_COND_HI;
+			goto cmp_x;
+		case BPF_S_JMP_JGE_X:
+			/* pc += (A >= X) ? pc->jt : pc->jf */
+			condt   = ARM_COND_CS;
+cmp_x:
+			update_on_xread(ctx);
+			emit(ARM_CMP_R(r_A, r_X), ctx);
+			goto cond_jump;
+		case BPF_S_JMP_JSET_K:
+			/* pc += (A & K) ? pc->jt : pc->jf */
+			condt  = ARM_COND_NE;
+			/* not set iff all zeroes iff Z==1 iff EQ */
+
+			imm12 = imm8m(k);
+			if (imm12 < 0) {
+				emit_mov_i_no8m(ARM_COND_AL, r_scratch, k, ctx);
+				emit(ARM_TST_R(r_A, r_scratch), ctx);
+			} else {
+				emit(ARM_TST_I(r_A, imm12), ctx);
+			}
+			goto cond_jump;
+		case BPF_S_JMP_JSET_X:
+			/* pc += (A & X) ? pc->jt : pc->jf */
+			update_on_xread(ctx);
+			condt  = ARM_COND_NE;
+			emit(ARM_TST_R(r_A, r_X), ctx);
+			goto cond_jump;
+		case BPF_S_RET_A:
+			emit(ARM_MOV_R(ARM_R0, r_A), ctx);
+			goto b_epilogue;
+		case BPF_S_RET_K:
+			emit_mov_i(ARM_R0, k, ctx);
+b_epilogue:
+			if (i != ctx->skf->len - 1)
+				emit(ARM_B(b_imm(prog->len, ctx)), ctx);
+			break;
+		case BPF_S_MISC_TAX:
+			/* X = A */
+			ctx->seen |= SEEN_X;
+			emit(ARM_MOV_R(r_X, r_A), ctx);
+			break;
+		case BPF_S_MISC_TXA:
+			/* A = X */
+			update_on_xread(ctx);
+			emit(ARM_MOV_R(r_A, r_X), ctx);
+			break;
+		case BPF_S_ANC_PROTOCOL:
+			/* A = ntohs(skb->protocol) */
+			ctx->seen |= SEEN_SKB;
+			BUILD_BUG_ON(FIELD_SIZEOF(struct sk_buff,
+						  protocol) != 2);
+			off = offsetof(struct sk_buff, protocol);
+#ifdef CONFIG_CPU_BIG_ENDIAN
+			emit_ldrh(r_A, r_skb, off, ctx);
+#else
+			emit_ldrh(r_scratch, r_skb, off, ctx);
+			emit(ARM_LSR_I(r_A, r_scratch, 8), ctx);
+			emit(ARM_AND_I(r_scratch, r_scratch, 0x0ff), ctx);
+			emit(ARM_ORR_S(r_A, r_A, r_scratch, SRTYPE_LSL, 8),
+			     ctx);
+#endif
+			break;
+		case BPF_S_ANC_CPU:
+#ifdef CONFIG_SMP
+			/* r_scratch = current_thread_info() */
+			emit(ARM_LSR_I(r_scratch, ARM_SP, ilog2(THREAD_SIZE)),
+			     ctx);
+			emit(ARM_LSL_I(r_scratch, r_scratch,
+				       ilog2(THREAD_SIZE)), ctx);
+
+			BUILD_BUG_ON(FIELD_SIZEOF(struct thread_info, cpu) != 4);
+			off = offsetof(struct thread_info, cpu);
+			emit(ARM_LDR_I(r_A, r_scratch, off), ctx);
+#else
+			emit(ARM_MOV_I(r_A, 0), ctx);
+#endif
+			break;
+		case BPF_S_ANC_IFINDEX:
+		case BPF_S_ANC_HATYPE:
+			/* A = skb->dev->ifindex or skb->dev->type */
+			ctx->seen |= SEEN_SKB;
+			off = offsetof(struct sk_buff, dev);
+			emit(ARM_LDR_I(r_scratch, r_skb, off), ctx);
+
+			emit(ARM_CMP_I(r_scratch, 0), ctx);
+			emit_err_ret(ARM_COND_EQ, ctx);
+
+			if (inst->code == BPF_S_ANC_IFINDEX) {
+				BUILD_BUG_ON(FIELD_SIZEOF(struct net_device,
+							  ifindex) != 4);
+				off = offsetof(struct net_device, ifindex);
+				emit(ARM_LDR_I(r_A, r_scratch, off), ctx);
+			} else {
+				BUILD_BUG_ON(FIELD_SIZEOF(struct net_device,
+							  type) != 2);
+				off = offsetof(struct net_device, type);
+				emit_ldrh(r_A, r_scratch, off, ctx);
+			}
+			break;
+		case BPF_S_ANC_MARK:
+			ctx->seen |= SEEN_SKB;
+			BUILD_BUG_ON(FIELD_SIZEOF(struct sk_buff, mark) != 4);
+			off = offsetof(struct sk_buff, mark);
+			emit(ARM_LDR_I(r_A, r_skb, off), ctx);
+			break;
+		case BPF_S_ANC_RXHASH:
+			ctx->seen |= SEEN_SKB;
+			BUILD_BUG_ON(FIELD_SIZEOF(struct sk_buff, rxhash) != 4);
+			off = offsetof(struct sk_buff, rxhash);
+			emit(ARM_LDR_I(r_A, r_skb, off), ctx);
+			break;
+		case BPF_S_ANC_QUEUE:
+			ctx->seen |= SEEN_SKB;
+			BUILD_BUG_ON(FIELD_SIZEOF(struct sk_buff,
+						  queue_mapping) != 2);
+			off = offsetof(struct sk_buff, queue_mapping);
+			emit_ldrh(r_A, r_skb, off, ctx);
+			break;
+		default:
+			/*
+			 * pkttype is a bitfield and the netlink attribute
+			 * lookups need a C helper: leave such filters to
+			 * the interpreter.
+			 */
+			return -1;
+		}
+	}
+
+	/* compute offsets only during the first pass */
+	if (ctx->target == NULL)
+		ctx->offsets[i] = ctx->idx * 4;
+
+	return 0;
+}
+
+void bpf_jit_compile(struct sk_filter *fp)
+{
+	struct jit_ctx ctx;
+	unsigned tmp_idx;
+	unsigned alloc_size;
+	unsigned i;
+
+	if (!bpf_jit_enable)
+		return;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.skf		= fp;
+	ctx.ret0_fp_idx = -1;
+
+	/* errors return through the first "ret #0" of the program */
+	for (i = 0; i < fp->len; i++) {
+		if (fp->insns[i].code == BPF_S_RET_K && fp->insns[i].k == 0) {
+			ctx.ret0_fp_idx = i;
+			break;
+		}
+	}
+
+	ctx.offsets = kzalloc(4 * (ctx.skf->len + 1), GFP_KERNEL);
+	if (ctx.offsets == NULL)
+		return;
+
+	/* fake pass to fill in the ctx->seen */
+	if (unlikely(build_body(&ctx)))
+		goto out;
+
+	tmp_idx = ctx.idx;
+	build_prologue(&ctx);
+	ctx.prologue_bytes = (ctx.idx - tmp_idx) * 4;
+
+#if __LINUX_ARM_ARCH__ < 7
+	tmp_idx = ctx.idx;
+	build_epilogue(&ctx);
+	ctx.epilogue_bytes = (ctx.idx - tmp_idx) * 4;
+
+	ctx.idx += ctx.imm_count;
+	if (ctx.imm_count) {
+		ctx.imms = kzalloc(4 * ctx.imm_count, GFP_KERNEL);
+		if (ctx.imms == NULL)
+			goto out;
+	}
+#else
+	/* there's nothing after the epilogue on ARMv7 */
+	build_epilogue(&ctx);
+#endif
+
+	alloc_size = 4 * ctx.idx;
+	/* the image is reused as a work_struct when it is freed */
+	ctx.target = module_alloc(max(sizeof(struct work_struct),
+				      (size_t)alloc_size));
+	if (unlikely(ctx.target == NULL))
+		goto out;
+
+	ctx.idx = 0;
+	build_prologue(&ctx);
+	build_body(&ctx);
+	build_epilogue(&ctx);
+
+	if (ctx.flags & FLAG_IMM_OVERFLOW) {
+		module_free(NULL, ctx.target);
+		goto out;
+	}
+
+	flush_icache_range((u32)ctx.target,
+			   (u32)ctx.target + alloc_size);
+
+	if (bpf_jit_enable > 1)
+		print_hex_dump(KERN_INFO, "BPF JIT code: ",
+			       DUMP_PREFIX_ADDRESS, 16, 4, ctx.target,
+			       alloc_size, false);
+
+	fp->bpf_func = (void *)ctx.target;
+out:
+#if __LINUX_ARM_ARCH__ < 7
+	kfree(ctx.imms);
+#endif
+	kfree(ctx.offsets);
+	return;
+}
+
+static void bpf_jit_free_worker(struct work_struct *work)
+{
+	module_free(NULL, work);
+}
+
+void bpf_jit_free(struct sk_filter *fp)
+{
+	struct work_struct *work;
+
+	/* called from an RCU callback, while module_free() may sleep */
+	if (fp->bpf_func != sk_run_filter) {
+		work = (struct work_struct *)fp->bpf_func;
+
+		INIT_WORK(work, bpf_jit_free_worker);
+		schedule_work(work);
+	}
+}
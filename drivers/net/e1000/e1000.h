@@ -145,6 +145,7 @@ struct e1000_adapter;
  * so a DMA handle can be stored along with the buffer */
 struct e1000_buffer {
 	struct sk_buff *skb;
+	u8 *rxbuf;		/* legacy rx: page fragment, see build_skb() */
 	dma_addr_t dma;
 	struct page *page;
 	unsigned long time_stamp;
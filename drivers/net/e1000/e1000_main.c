@@ -2027,6 +2027,34 @@ void e1000_free_all_rx_resources(struct e1000_adapter *adapter)
  * @rx_ring: ring to free buffers from
  **/
 
+/*
+ * Legacy receive buffers are page fragments the stack wraps with
+ * build_skb(), so that no sk_buff has to be allocated until a frame
+ * has actually arrived.  The hardware writes at E1000_HEADROOM into
+ * the fragment and the shared info lives at its end.
+ */
+#define E1000_HEADROOM	(NET_SKB_PAD + NET_IP_ALIGN)
+
+static unsigned int e1000_frag_len(const struct e1000_adapter *a)
+{
+	return SKB_DATA_ALIGN(a->rx_buffer_len + E1000_HEADROOM) +
+		SKB_DATA_ALIGN(sizeof(struct skb_shared_info));
+}
+
+static void *e1000_alloc_frag(const struct e1000_adapter *a)
+{
+	u8 *data = netdev_alloc_frag(e1000_frag_len(a));
+
+	if (data)
+		data += E1000_HEADROOM;
+	return data;
+}
+
+static void e1000_free_frag(u8 *data)
+{
+	put_page(virt_to_head_page(data));
+}
+
 static void e1000_clean_rx_ring(struct e1000_adapter *adapter,
 				struct e1000_rx_ring *rx_ring)
 {
@@ -2056,6 +2084,10 @@ static void e1000_clean_rx_ring(struct e1000_adapter *adapter,
 			put_page(buffer_info->page);
 			buffer_info->page = NULL;
 		}
+		if (buffer_info->rxbuf) {
+			e1000_free_frag(buffer_info->rxbuf);
+			buffer_info->rxbuf = NULL;
+		}
 		if (buffer_info->skb) {
 			dev_kfree_skb(buffer_info->skb);
 			buffer_info->skb = NULL;
@@ -3908,25 +3940,23 @@ next_desc:
  * this should improve performance for small packets with large amounts
  * of reassembly being done in the stack
  */
-static void e1000_check_copybreak(struct net_device *netdev,
-				 struct e1000_buffer *buffer_info,
-				 u32 length, struct sk_buff **skb)
+static struct sk_buff *e1000_copybreak(struct e1000_adapter *adapter,
+					u8 *data, u32 length)
 {
-	struct sk_buff *new_skb;
+	struct sk_buff *skb;
 
 	if (length > copybreak)
-		return;
+		return NULL;
 
-	new_skb = netdev_alloc_skb_ip_align(netdev, length);
-	if (!new_skb)
-		return;
+	skb = netdev_alloc_skb_ip_align(adapter->netdev, length);
+	if (!skb)
+		return NULL;
 
-	skb_copy_to_linear_data_offset(new_skb, -NET_IP_ALIGN,
-				       (*skb)->data - NET_IP_ALIGN,
+	skb_copy_to_linear_data_offset(skb, -NET_IP_ALIGN,
+				       data - NET_IP_ALIGN,
 				       length + NET_IP_ALIGN);
-	/* save the skb in buffer_info as good */
-	buffer_info->skb = *skb;
-	*skb = new_skb;
+	skb_put(skb, length);
+	return skb;
 }
 
 /**
@@ -3958,6 +3988,7 @@ static bool e1000_clean_rx_irq(struct e1000_adapter *adapter,
 
 	while (rx_desc->status & E1000_RXD_STAT_DD) {
 		struct sk_buff *skb;
+		u8 *data;
 		u8 status;
 
 		if (*work_done >= work_to_do)
@@ -3966,10 +3997,10 @@ static bool e1000_clean_rx_irq(struct e1000_adapter *adapter,
 		rmb(); /* read descriptor and rx_buffer_info after status DD */
 
 		status = rx_desc->status;
-		skb = buffer_info->skb;
-		buffer_info->skb = NULL;
+		data = buffer_info->rxbuf;
+		buffer_info->rxbuf = NULL;
 
-		prefetch(skb->data - NET_IP_ALIGN);
+		prefetch(data - NET_IP_ALIGN);
 
 		if (++i == rx_ring->count) i = 0;
 		next_rxd = E1000_RX_DESC(*rx_ring, i);
@@ -3997,25 +4028,25 @@ static bool e1000_clean_rx_irq(struct e1000_adapter *adapter,
 			/* All receives must fit into a single buffer */
 			e_dbg("Receive packet consumed multiple buffers\n");
 			/* recycle */
-			buffer_info->skb = skb;
+			buffer_info->rxbuf = data;
 			if (status & E1000_RXD_STAT_EOP)
 				adapter->discarding = false;
 			goto next_desc;
 		}
 
 		if (unlikely(rx_desc->errors & E1000_RXD_ERR_FRAME_ERR_MASK)) {
-			u8 last_byte = *(skb->data + length - 1);
+			u8 last_byte = *(data + length - 1);
 			if (TBI_ACCEPT(hw, status, rx_desc->errors, length,
 				       last_byte)) {
 				spin_lock_irqsave(&adapter->stats_lock, flags);
 				e1000_tbi_adjust_stats(hw, &adapter->stats,
-				                       length, skb->data);
+				                       length, data);
 				spin_unlock_irqrestore(&adapter->stats_lock,
 				                       flags);
 				length--;
 			} else {
 				/* recycle */
-				buffer_info->skb = skb;
+				buffer_info->rxbuf = data;
 				goto next_desc;
 			}
 		}
@@ -4024,14 +4055,27 @@ static bool e1000_clean_rx_irq(struct e1000_adapter *adapter,
 		 * done after the TBI_ACCEPT workaround above */
 		length -= 4;
 
+		skb = e1000_copybreak(adapter, data, length);
+		if (skb) {
+			/* keep the fragment for the hardware */
+			buffer_info->rxbuf = data;
+		} else {
+			skb = build_skb(data - E1000_HEADROOM,
+					e1000_frag_len(adapter));
+			if (unlikely(!skb)) {
+				adapter->alloc_rx_buff_failed++;
+				/* recycle */
+				buffer_info->rxbuf = data;
+				goto next_desc;
+			}
+			skb_reserve(skb, E1000_HEADROOM);
+			skb_put(skb, length);
+		}
+
 		/* probably a little skewed due to removing CRC */
 		total_rx_bytes += length;
 		total_rx_packets++;
 
-		e1000_check_copybreak(netdev, buffer_info, length, &skb);
-
-		skb_put(skb, length);
-
 		/* Receive Checksum Offload */
 		e1000_rx_checksum(adapter,
 				  (u32)(status) |
@@ -4186,69 +4230,66 @@ static void e1000_alloc_rx_buffers(struct e1000_adapter *adapter,
 				   int cleaned_count)
 {
 	struct e1000_hw *hw = &adapter->hw;
-	struct net_device *netdev = adapter->netdev;
 	struct pci_dev *pdev = adapter->pdev;
 	struct e1000_rx_desc *rx_desc;
 	struct e1000_buffer *buffer_info;
-	struct sk_buff *skb;
 	unsigned int i;
 	unsigned int bufsz = adapter->rx_buffer_len;
+	u8 *data;
 
 	i = rx_ring->next_to_use;
 	buffer_info = &rx_ring->buffer_info[i];
 
 	while (cleaned_count--) {
-		skb = buffer_info->skb;
-		if (skb) {
-			skb_trim(skb, 0);
-			goto map_skb;
-		}
+		data = buffer_info->rxbuf;
+		if (data)
+			goto map_buf;
 
-		skb = netdev_alloc_skb_ip_align(netdev, bufsz);
-		if (unlikely(!skb)) {
+		data = e1000_alloc_frag(adapter);
+		if (unlikely(!data)) {
 			/* Better luck next round */
 			adapter->alloc_rx_buff_failed++;
 			break;
 		}
 
 		/* Fix for errata 23, can't cross 64kB boundary */
-		if (!e1000_check_64k_bound(adapter, skb->data, bufsz)) {
-			struct sk_buff *oldskb = skb;
-			e_err(rx_err, "skb align check failed: %u bytes at "
-			      "%p\n", bufsz, skb->data);
+		if (!e1000_check_64k_bound(adapter, data, bufsz)) {
+			u8 *olddata = data;
+			e_err(rx_err, "frag align check failed: %u bytes at "
+			      "%p\n", bufsz, data);
 			/* Try again, without freeing the previous */
-			skb = netdev_alloc_skb_ip_align(netdev, bufsz);
+			data = e1000_alloc_frag(adapter);
 			/* Failed allocation, critical failure */
-			if (!skb) {
-				dev_kfree_skb(oldskb);
+			if (!data) {
+				e1000_free_frag(olddata);
 				adapter->alloc_rx_buff_failed++;
 				break;
 			}
 
-			if (!e1000_check_64k_bound(adapter, skb->data, bufsz)) {
+			if (!e1000_check_64k_bound(adapter, data, bufsz)) {
 				/* give up */
-				dev_kfree_skb(skb);
-				dev_kfree_skb(oldskb);
+				e1000_free_frag(data);
+				e1000_free_frag(olddata);
 				adapter->alloc_rx_buff_failed++;
-				break; /* while !buffer_info->skb */
+				break; /* while !buffer_info->rxbuf */
 			}
 
 			/* Use new allocation */
-			dev_kfree_skb(oldskb);
+			e1000_free_frag(olddata);
 		}
-		buffer_info->skb = skb;
+		buffer_info->rxbuf = data;
 		buffer_info->length = adapter->rx_buffer_len;
-map_skb:
+map_buf:
 		buffer_info->dma = dma_map_single(&pdev->dev,
-						  skb->data,
+						  data,
 						  buffer_info->length,
 						  DMA_FROM_DEVICE);
 		if (dma_mapping_error(&pdev->dev, buffer_info->dma)) {
-			dev_kfree_skb(skb);
-			buffer_info->skb = NULL;
+			e1000_free_frag(data);
+			buffer_info->rxbuf = NULL;
 			buffer_info->dma = 0;
 			adapter->alloc_rx_buff_failed++;
-			break; /* while !buffer_info->skb */
+			break; /* while !buffer_info->rxbuf */
 		}
 
 		/*
@@ -4263,8 +4304,8 @@ map_skb:
 			e_err(rx_err, "dma align check failed: %u bytes at "
 			      "%p\n", adapter->rx_buffer_len,
 			      (void *)(unsigned long)buffer_info->dma);
-			dev_kfree_skb(skb);
-			buffer_info->skb = NULL;
+			e1000_free_frag(data);
+			buffer_info->rxbuf = NULL;
 
 			dma_unmap_single(&pdev->dev, buffer_info->dma,
 					 adapter->rx_buffer_len,
@@ -4272,7 +4313,7 @@ map_skb:
 			buffer_info->dma = 0;
 
 			adapter->alloc_rx_buff_failed++;
-			break; /* while !buffer_info->skb */
+			break; /* while !buffer_info->rxbuf */
 		}
 		rx_desc = E1000_RX_DESC(*rx_ring, i);
 		rx_desc->buffer_addr = cpu_to_le64(buffer_info->dma);
@@ -20,6 +20,9 @@
 #include <linux/dma-mapping.h>
 #include <linux/platform_device.h>
 #include <linux/phy.h>
+#include <linux/hrtimer.h>
+#include <linux/netmap.h>
+#include <linux/vmalloc.h>
 
 #include <mach/board.h>
 #include <mach/cpu.h>
@@ -47,11 +50,25 @@
 
 #define NEXT_RX(n)		(((n) + 1) & (RX_RING_SIZE - 1))
 
+/*
+ * RX buffers are carved out of pages.  Keep enough pages around to
+ * back the ring twice over, so that pages still held by the stack do
+ * not have to be replaced straight away.
+ */
+#define RX_BUFFERS_PER_PAGE	(PAGE_SIZE / RX_BUFFER_SIZE)
+#define RX_PAGE_POOL_SIZE	(2 * RX_RING_SIZE / RX_BUFFERS_PER_PAGE)
+
 /* minimum number of free TX descriptors before waking up TX process */
 #define MACB_TX_WAKEUP_THRESH	(TX_RING_SIZE / 4)
 
 #define MACB_RX_INT_FLAGS	(MACB_BIT(RCOMP) | MACB_BIT(RXUBR)	\
 				 | MACB_BIT(ISR_ROVR))
+#define MACB_TX_INT_FLAGS	(MACB_BIT(TCOMP) | MACB_BIT(ISR_TUND)	\
+				 | MACB_BIT(ISR_RLE))
+#define MACB_NAPI_INT_FLAGS	(MACB_RX_INT_FLAGS | MACB_TX_INT_FLAGS)
+
+/* Upper bound for the interrupt moderation delay */
+#define MACB_MAX_COALESCE_USECS	10000
 
 static void __macb_set_hwaddr(struct macb *bp)
 {
@@ -293,10 +310,16 @@ static void macb_update_stats(struct macb *bp)
 		*p += __raw_readl(reg);
 }
 
-static void macb_tx(struct macb *bp)
+/*
+ * Reclaim completed TX buffers.  Called from macb_poll() with
+ * bp->lock held; returns the number of frames completed.
+ */
+static int macb_tx(struct macb *bp)
 {
 	unsigned int tail;
 	unsigned int head;
+	unsigned int bytes = 0;
+	int completed = 0;
 	u32 status;
 
 	status = macb_readl(bp, TSR);
@@ -337,20 +360,18 @@ static void macb_tx(struct macb *bp)
 		}
 
 		bp->tx_head = bp->tx_tail = 0;
+		netdev_reset_queue(bp->dev);
 
 		/* Enable the transmitter again */
 		if (status & MACB_BIT(TGO))
 			macb_writel(bp, NCR, macb_readl(bp, NCR) | MACB_BIT(TE));
 	}
 
-	if (!(status & MACB_BIT(COMP)))
-		/*
-		 * This may happen when a buffer becomes complete
-		 * between reading the ISR and scanning the
-		 * descriptors.  Nothing to worry about.
-		 */
-		return;
-
+	/*
+	 * TX_USED tells what is done, not COMP: with interrupts held off
+	 * by the moderation timer, completions seen by an earlier poll
+	 * may already have cleared COMP for frames sent since.
+	 */
 	head = bp->tx_head;
 	for (tail = bp->tx_tail; tail != head; tail = NEXT_TX(tail)) {
 		struct ring_info *rp = &bp->tx_skb[tail];
@@ -371,31 +392,104 @@ static void macb_tx(struct macb *bp)
 				 DMA_TO_DEVICE);
 		bp->stats.tx_packets++;
 		bp->stats.tx_bytes += skb->len;
+		bytes += skb->len;
 		rp->skb = NULL;
 		dev_kfree_skb_irq(skb);
+		completed++;
 	}
 
 	bp->tx_tail = tail;
+	netdev_completed_queue(bp->dev, completed, bytes);
 	if (netif_queue_stopped(bp->dev) &&
 	    TX_BUFFS_AVAIL(bp) > MACB_TX_WAKEUP_THRESH)
 		netif_wake_queue(bp->dev);
+
+	return completed;
+}
+
+/*
+ * Make the next page of the pool current.  A page is only reused once
+ * every fragment carved out of it has been released by the stack;
+ * otherwise our reference is dropped and a fresh page takes its slot.
+ */
+static int macb_rx_page_next(struct macb *bp, gfp_t gfp)
+{
+	unsigned int idx = (bp->rx_page_idx + 1) % RX_PAGE_POOL_SIZE;
+	struct page *page = bp->rx_page_pool[idx];
+
+	if (page && page_count(page) != 1) {
+		put_page(page);
+		page = NULL;
+	}
+
+	if (!page) {
+		page = alloc_page(gfp);
+		bp->rx_page_pool[idx] = page;
+		if (!page)
+			return -ENOMEM;
+	}
+
+	bp->rx_page_idx = idx;
+	bp->rx_page_offset = 0;
+
+	return 0;
+}
+
+/* Make sure at least count buffers can be handed out without failing */
+static int macb_rx_reserve(struct macb *bp, unsigned int count, gfp_t gfp)
+{
+	if (bp->rx_page_offset + count * RX_BUFFER_SIZE <= PAGE_SIZE)
+		return 0;
+
+	return macb_rx_page_next(bp, gfp);
+}
+
+/* Attach a fresh buffer to RX descriptor entry and give it to the MACB */
+static void macb_rx_refill(struct macb *bp, unsigned int entry)
+{
+	struct rx_ring_info *rb = &bp->rx_buf[entry];
+	struct page *page = bp->rx_page_pool[bp->rx_page_idx];
+	u32 addr;
+
+	get_page(page);
+	rb->page = page;
+	rb->offset = bp->rx_page_offset;
+	rb->mapping = dma_map_page(&bp->pdev->dev, page, rb->offset,
+				   RX_BUFFER_SIZE, DMA_FROM_DEVICE);
+	bp->rx_page_offset += RX_BUFFER_SIZE;
+
+	addr = rb->mapping;
+	if (entry == (RX_RING_SIZE - 1))
+		addr |= MACB_BIT(RX_WRAP);
+
+	bp->rx_ring[entry].ctrl = 0;
+	wmb();
+	bp->rx_ring[entry].addr = addr;
 }
 
 static int macb_rx_frame(struct macb *bp, unsigned int first_frag,
 			 unsigned int last_frag)
 {
-	unsigned int len;
-	unsigned int frag;
-	unsigned int offset = 0;
+	unsigned int len, remaining;
+	unsigned int frag, nr_frags;
+	unsigned int offset = RX_OFFSET;
 	struct sk_buff *skb;
+	int i = 0;
 
 	len = MACB_BFEXT(RX_FRMLEN, bp->rx_ring[last_frag].ctrl);
+	nr_frags = ((last_frag - first_frag) & (RX_RING_SIZE - 1)) + 1;
 
 	dev_dbg(&bp->pdev->dev, "macb_rx_frame frags %u - %u (len %u)\n",
 		first_frag, last_frag, len);
 
-	skb = dev_alloc_skb(len + RX_OFFSET);
-	if (!skb) {
+	/*
+	 * The buffers of this frame go up the stack as page fragments,
+	 * so replacements for all of them must be available up front.
+	 * If not, leave the buffers in the ring and drop the frame.
+	 */
+	skb = napi_get_frags(&bp->napi);
+	if (!skb || nr_frags > MAX_SKB_FRAGS ||
+	    macb_rx_reserve(bp, nr_frags, GFP_ATOMIC)) {
 		bp->stats.rx_dropped++;
 		for (frag = first_frag; ; frag = NEXT_RX(frag)) {
 			bp->rx_ring[frag].addr &= ~MACB_BIT(RX_USED);
@@ -406,36 +500,53 @@ static int macb_rx_frame(struct macb *bp, unsigned int first_frag,
 		return 1;
 	}
 
-	skb_reserve(skb, RX_OFFSET);
-	skb_checksum_none_assert(skb);
-	skb_put(skb, len);
-
+	/*
+	 * The MACB writes the frame RX_OFFSET bytes into the first
+	 * buffer, so the IP header ends up word-aligned in the page.
+	 */
+	remaining = len;
 	for (frag = first_frag; ; frag = NEXT_RX(frag)) {
-		unsigned int frag_len = RX_BUFFER_SIZE;
+		struct rx_ring_info *rb = &bp->rx_buf[frag];
+		unsigned int frag_len = RX_BUFFER_SIZE - offset;
 
-		if (offset + frag_len > len) {
+		if (frag_len > remaining) {
 			BUG_ON(frag != last_frag);
-			frag_len = len - offset;
+			frag_len = remaining;
 		}
-		skb_copy_to_linear_data_offset(skb, offset,
-					       (bp->rx_buffers +
-					        (RX_BUFFER_SIZE * frag)),
-					       frag_len);
-		offset += RX_BUFFER_SIZE;
-		bp->rx_ring[frag].addr &= ~MACB_BIT(RX_USED);
-		wmb();
+
+		dma_unmap_page(&bp->pdev->dev, rb->mapping, RX_BUFFER_SIZE,
+			       DMA_FROM_DEVICE);
+		if (frag_len)
+			skb_fill_page_desc(skb, i++, rb->page,
+					   rb->offset + offset, frag_len);
+		else
+			put_page(rb->page);
+		rb->page = NULL;
+
+		remaining -= frag_len;
+		offset = 0;
+
+		macb_rx_refill(bp, frag);
 
 		if (frag == last_frag)
 			break;
 	}
 
-	skb->protocol = eth_type_trans(skb, bp->dev);
+	skb->len += len;
+	skb->data_len += len;
+	skb->truesize += nr_frags * RX_BUFFER_SIZE;
 
 	bp->stats.rx_packets++;
 	bp->stats.rx_bytes += len;
-	dev_dbg(&bp->pdev->dev, "received skb of length %u, csum: %08x\n",
-		skb->len, skb->csum);
-	netif_receive_skb(skb);
+	dev_dbg(&bp->pdev->dev, "received frame of length %u in %d frags\n",
+		len, i);
+
+	/*
+	 * The MACB has no receive checksum offload, so the frame is
+	 * CHECKSUM_NONE; tcp4_gro_receive() verifies it in software
+	 * before merging it into a TCP stream.
+	 */
+	napi_gro_frags(&bp->napi);
 
 	return 0;
 }
@@ -500,12 +611,347 @@ static int macb_rx(struct macb *bp, int budget)
 	return received;
 }
 
+#ifdef CONFIG_MACB_NETMAP
+/*
+ * netmap native mode.  TX slot i goes out through TX descriptor i,
+ * straight from the buffer shared with the application.  The 128 byte
+ * RX buffers are far too small to be netmap buffers, so received frames
+ * are copied out of them into the RX slots, without ever becoming skbs.
+ * The descriptors themselves are set up and torn down by the normal
+ * open/close paths; the NAPI poll only wakes up the application.
+ */
+static inline bool macb_netmap_mode(struct macb *bp)
+{
+	return bp->nm_mode;
+}
+
+/* Unmap the buffers of TX descriptors still owned by the MACB */
+static void macb_netmap_tx_flush(struct macb *bp)
+{
+	unsigned int tail;
+
+	for (tail = bp->tx_tail; tail != bp->tx_head; tail = NEXT_TX(tail)) {
+		u32 ctrl = bp->tx_ring[tail].ctrl;
+
+		dma_unmap_page(&bp->pdev->dev, bp->tx_skb[tail].mapping,
+			       MACB_BFEXT(TX_FRMLEN, ctrl), DMA_TO_DEVICE);
+		bp->tx_ring[tail].ctrl = ctrl | MACB_BIT(TX_USED);
+		bp->stats.tx_dropped++;
+	}
+	bp->tx_tail = bp->tx_head;
+}
+
+/* NAPI poll in netmap mode: the application reaps both rings in its syncs */
+static void macb_netmap_poll(struct macb *bp)
+{
+	macb_writel(bp, RSR, macb_readl(bp, RSR));
+	napi_complete(&bp->napi);
+	netmap_wake(&bp->nm);
+	macb_writel(bp, IER, MACB_NAPI_INT_FLAGS);
+}
+
+/* Called from macb_open() once the rings are set up */
+static void macb_netmap_start(struct macb *bp)
+{
+	if (!bp->nm_mode)
+		return;
+
+	netmap_reset(&bp->nm);
+	bp->nm_up = true;
+}
+
+/* Called from macb_close(); keeps the syncs off the rings from now on */
+static void macb_netmap_stop(struct macb *bp)
+{
+	if (!bp->nm_mode)
+		return;
+
+	spin_lock_bh(&bp->nm.tx_ring.lock);
+	spin_lock(&bp->nm.rx_ring.lock);
+	bp->nm_up = false;
+	spin_unlock(&bp->nm.rx_ring.lock);
+	spin_unlock_bh(&bp->nm.tx_ring.lock);
+}
+
+static int macb_netmap_txsync(struct netmap_adapter *na)
+{
+	struct macb *bp = netdev_priv(na->ifp);
+	struct netmap_kring *kring = &na->tx_ring;
+	struct netmap_ring *ring = kring->ring;
+	unsigned long flags;
+	unsigned int entry;
+	int err = 0;
+	u32 status;
+
+	if (!bp->nm_up)
+		return -ENETDOWN;
+
+	spin_lock_irqsave(&bp->lock, flags);
+
+	status = macb_readl(bp, TSR);
+	macb_writel(bp, TSR, status);
+	if (status & (MACB_BIT(UND) | MACB_BIT(TSR_RLE))) {
+		/*
+		 * Like macb_tx(): drop everything in flight and start the
+		 * ring over, here together with the netmap ring.
+		 */
+		if (status & MACB_BIT(TGO))
+			macb_writel(bp, NCR, macb_readl(bp, NCR) & ~MACB_BIT(TE));
+		macb_netmap_tx_flush(bp);
+		bp->tx_head = bp->tx_tail = 0;
+		kring->nr_hwcur = kring->rhead = ring->head = 0;
+		if (status & MACB_BIT(TGO))
+			macb_writel(bp, NCR, macb_readl(bp, NCR) | MACB_BIT(TE));
+	}
+
+	for (entry = bp->tx_head; entry != kring->rhead; entry = NEXT_TX(entry)) {
+		struct netmap_slot *slot = &ring->slot[entry];
+		unsigned int len = ACCESS_ONCE(slot->len);
+		void *buf = netmap_buf(na, slot);
+		dma_addr_t mapping;
+		u32 ctrl;
+
+		if (unlikely(!buf || !len || len > NETMAP_BUF_SIZE)) {
+			err = -EINVAL;
+			break;
+		}
+
+		mapping = dma_map_page(&bp->pdev->dev, vmalloc_to_page(buf),
+				       offset_in_page(buf), len, DMA_TO_DEVICE);
+		bp->tx_skb[entry].skb = NULL;
+		bp->tx_skb[entry].mapping = mapping;
+
+		ctrl = MACB_BF(TX_FRMLEN, len);
+		ctrl |= MACB_BIT(TX_LAST);
+		if (entry == (TX_RING_SIZE - 1))
+			ctrl |= MACB_BIT(TX_WRAP);
+
+		bp->tx_ring[entry].addr = mapping;
+		bp->tx_ring[entry].ctrl = ctrl;
+	}
+	wmb();
+
+	if (entry != bp->tx_head) {
+		bp->tx_head = entry;
+		macb_writel(bp, NCR, macb_readl(bp, NCR) | MACB_BIT(TSTART));
+	}
+	kring->nr_hwcur = entry;
+
+	/* Reclaim what has been sent */
+	for (entry = bp->tx_tail; entry != bp->tx_head; entry = NEXT_TX(entry)) {
+		u32 ctrl;
+
+		rmb();
+		ctrl = bp->tx_ring[entry].ctrl;
+		if (!(ctrl & MACB_BIT(TX_USED)))
+			break;
+
+		dma_unmap_page(&bp->pdev->dev, bp->tx_skb[entry].mapping,
+			       MACB_BFEXT(TX_FRMLEN, ctrl), DMA_TO_DEVICE);
+		bp->stats.tx_packets++;
+		bp->stats.tx_bytes += MACB_BFEXT(TX_FRMLEN, ctrl);
+	}
+	bp->tx_tail = entry;
+	kring->nr_hwtail = (entry + TX_RING_SIZE - 1) & (TX_RING_SIZE - 1);
+
+	spin_unlock_irqrestore(&bp->lock, flags);
+
+	return err;
+}
+
+/* Copy a frame into a netmap buffer and give its descriptors back */
+static bool macb_netmap_rx_frame(struct macb *bp, unsigned int first_frag,
+				 unsigned int last_frag,
+				 struct netmap_slot *slot)
+{
+	unsigned int len, remaining, frag;
+	unsigned int offset = RX_OFFSET;
+	void *buf = netmap_buf(&bp->nm, slot);
+	void *p = buf;
+
+	len = MACB_BFEXT(RX_FRMLEN, bp->rx_ring[last_frag].ctrl);
+	if (unlikely(!buf || len > NETMAP_BUF_SIZE)) {
+		bp->stats.rx_dropped++;
+		discard_partial_frame(bp, first_frag, NEXT_RX(last_frag));
+		return false;
+	}
+
+	remaining = len;
+	for (frag = first_frag; ; frag = NEXT_RX(frag)) {
+		struct rx_ring_info *rb = &bp->rx_buf[frag];
+		unsigned int frag_len = min(RX_BUFFER_SIZE - offset, remaining);
+
+		dma_sync_single_for_cpu(&bp->pdev->dev, rb->mapping,
+					RX_BUFFER_SIZE, DMA_FROM_DEVICE);
+		memcpy(p, page_address(rb->page) + rb->offset + offset,
+		       frag_len);
+		dma_sync_single_for_device(&bp->pdev->dev, rb->mapping,
+					   RX_BUFFER_SIZE, DMA_FROM_DEVICE);
+		bp->rx_ring[frag].addr &= ~MACB_BIT(RX_USED);
+
+		p += frag_len;
+		remaining -= frag_len;
+		offset = 0;
+
+		if (frag == last_frag)
+			break;
+	}
+	wmb();
+
+	netmap_buf_for_user(buf, len);
+	slot->len = len;
+	slot->flags = 0;
+
+	bp->stats.rx_packets++;
+	bp->stats.rx_bytes += len;
+
+	return true;
+}
+
+static int macb_netmap_rxsync(struct netmap_adapter *na)
+{
+	struct macb *bp = netdev_priv(na->ifp);
+	struct netmap_kring *kring = &na->rx_ring;
+	struct netmap_ring *ring = kring->ring;
+	unsigned int tail = bp->rx_tail;
+	u32 slot = kring->nr_hwtail;
+	int first_frag = -1;
+
+	if (!bp->nm_up)
+		return -ENETDOWN;
+
+	for (; ; tail = NEXT_RX(tail)) {
+		u32 addr, ctrl;
+
+		rmb();
+		addr = bp->rx_ring[tail].addr;
+		ctrl = bp->rx_ring[tail].ctrl;
+
+		if (!(addr & MACB_BIT(RX_USED)))
+			break;
+
+		if (ctrl & MACB_BIT(RX_SOF)) {
+			if (first_frag != -1)
+				discard_partial_frame(bp, first_frag, tail);
+			first_frag = tail;
+		}
+
+		if (ctrl & MACB_BIT(RX_EOF)) {
+			BUG_ON(first_frag == -1);
+
+			/* Ring full: leave the frame to the MACB for now */
+			if (netmap_next(kring, slot) == kring->nr_hwcur)
+				break;
+
+			if (macb_netmap_rx_frame(bp, first_frag, tail,
+						 &ring->slot[slot]))
+				slot = netmap_next(kring, slot);
+			first_frag = -1;
+		}
+	}
+
+	if (first_frag != -1)
+		bp->rx_tail = first_frag;
+	else
+		bp->rx_tail = tail;
+	kring->nr_hwtail = slot;
+
+	return 0;
+}
+#else
+static inline bool macb_netmap_mode(struct macb *bp)
+{
+	return false;
+}
+
+static inline void macb_netmap_tx_flush(struct macb *bp)
+{
+}
+
+static inline void macb_netmap_poll(struct macb *bp)
+{
+}
+
+static inline void macb_netmap_start(struct macb *bp)
+{
+}
+
+static inline void macb_netmap_stop(struct macb *bp)
+{
+}
+#endif
+
+/*
+ * Software interrupt moderation.  Once a poll has cleaned everything,
+ * RX and TX interrupts are normally unmasked again.  If the poll found
+ * work for a direction that has coalesce_usecs set, interrupts stay
+ * masked instead and the poll is rescheduled from a timer, at most
+ * coalesce_usecs later.  max_coalesced_frames bounds the frames one
+ * such poll picks up: at the rate seen since the previous poll, the
+ * delay is cut short before more than that many would pile up.  A
+ * direction with work but without coalesce_usecs, or a delay that
+ * rounds down to nothing, falls back to one interrupt per completion.
+ */
+static u32 macb_coalesce_delay(u32 usecs, u32 max_frames, int done,
+			       s64 elapsed)
+{
+	if (!done)
+		return ~0U;
+	if (max_frames && (u64)done * usecs > (u64)max_frames * elapsed)
+		usecs = div_u64((u64)max_frames * elapsed, done);
+	return usecs;
+}
+
+static void macb_coalesce(struct macb *bp, int rx_done, int tx_done)
+{
+	struct ethtool_coalesce *ec = &bp->coalesce;
+	ktime_t now = ktime_get();
+	s64 elapsed = ktime_us_delta(now, bp->coalesce_stamp);
+	u32 usecs;
+
+	bp->coalesce_stamp = now;
+
+	usecs = min(macb_coalesce_delay(ec->rx_coalesce_usecs,
+					ec->rx_max_coalesced_frames,
+					rx_done, elapsed),
+		    macb_coalesce_delay(ec->tx_coalesce_usecs,
+					ec->tx_max_coalesced_frames,
+					tx_done, elapsed));
+
+	if (usecs && usecs != ~0U)
+		hrtimer_start(&bp->coalesce_timer,
+			      ns_to_ktime((u64)usecs * NSEC_PER_USEC),
+			      HRTIMER_MODE_REL);
+	else
+		macb_writel(bp, IER, MACB_NAPI_INT_FLAGS);
+}
+
+static enum hrtimer_restart macb_coalesce_timer(struct hrtimer *timer)
+{
+	struct macb *bp = container_of(timer, struct macb, coalesce_timer);
+
+	napi_schedule(&bp->napi);
+
+	return HRTIMER_NORESTART;
+}
+
 static int macb_poll(struct napi_struct *napi, int budget)
 {
 	struct macb *bp = container_of(napi, struct macb, napi);
+	unsigned long flags;
 	int work_done;
+	int tx_done;
 	u32 status;
 
+	if (macb_netmap_mode(bp)) {
+		macb_netmap_poll(bp);
+		return 0;
+	}
+
+	spin_lock_irqsave(&bp->lock, flags);
+	tx_done = macb_tx(bp);
+	spin_unlock_irqrestore(&bp->lock, flags);
+
 	status = macb_readl(bp, RSR);
 	macb_writel(bp, RSR, status);
 
@@ -520,9 +966,9 @@ static int macb_poll(struct napi_struct *napi, int budget)
 
 		/*
 		 * We've done what we can to clean the buffers. Make sure we
-		 * get notified when new packets arrive.
+		 * get notified (or polled again) when there is more work.
 		 */
-		macb_writel(bp, IER, MACB_RX_INT_FLAGS);
+		macb_coalesce(bp, work_done, tx_done);
 	}
 
 	/* TODO: Handle errors */
@@ -550,27 +996,24 @@ static irqreturn_t macb_interrupt(int irq, void *dev_id)
 			break;
 		}
 
-		if (status & MACB_RX_INT_FLAGS) {
+		if (status & MACB_NAPI_INT_FLAGS) {
 			/*
 			 * There's no point taking any more interrupts
 			 * until we have processed the buffers. The
 			 * scheduling call may fail if the poll routine
 			 * is already scheduled, so disable interrupts
-			 * now.
+			 * now.  TX completions are reaped by the poll
+			 * routine as well.
 			 */
-			macb_writel(bp, IDR, MACB_RX_INT_FLAGS);
+			macb_writel(bp, IDR, MACB_NAPI_INT_FLAGS);
 
 			if (napi_schedule_prep(&bp->napi)) {
 				dev_dbg(&bp->pdev->dev,
-					"scheduling RX softirq\n");
+					"scheduling NAPI softirq\n");
 				__napi_schedule(&bp->napi);
 			}
 		}
 
-		if (status & (MACB_BIT(TCOMP) | MACB_BIT(ISR_TUND) |
-			    MACB_BIT(ISR_RLE)))
-			macb_tx(bp);
-
 		/*
 		 * Link change detection isn't possible with RMII, so we'll
 		 * add that if/when we get our hands on a full-blown MII PHY.
@@ -664,6 +1107,8 @@ static int macb_start_xmit(struct sk_buff *skb, struct net_device *dev)
 	entry = NEXT_TX(entry);
 	bp->tx_head = entry;
 
+	netdev_sent_queue(dev, len);
+
 	macb_writel(bp, NCR, macb_readl(bp, NCR) | MACB_BIT(TSTART));
 
 	if (TX_BUFFS_AVAIL(bp) < 1)
@@ -674,8 +1119,36 @@ static int macb_start_xmit(struct sk_buff *skb, struct net_device *dev)
 	return NETDEV_TX_OK;
 }
 
+static void macb_free_rx_buffers(struct macb *bp)
+{
+	struct rx_ring_info *rb;
+	int i;
+
+	if (bp->rx_buf) {
+		for (i = 0; i < RX_RING_SIZE; i++) {
+			rb = &bp->rx_buf[i];
+			if (!rb->page)
+				continue;
+			dma_unmap_page(&bp->pdev->dev, rb->mapping,
+				       RX_BUFFER_SIZE, DMA_FROM_DEVICE);
+			put_page(rb->page);
+			rb->page = NULL;
+		}
+		kfree(bp->rx_buf);
+		bp->rx_buf = NULL;
+	}
+	if (bp->rx_page_pool) {
+		for (i = 0; i < RX_PAGE_POOL_SIZE; i++)
+			if (bp->rx_page_pool[i])
+				put_page(bp->rx_page_pool[i]);
+		kfree(bp->rx_page_pool);
+		bp->rx_page_pool = NULL;
+	}
+}
+
 static void macb_free_consistent(struct macb *bp)
 {
+	macb_free_rx_buffers(bp);
 	if (bp->tx_skb) {
 		kfree(bp->tx_skb);
 		bp->tx_skb = NULL;
@@ -690,12 +1163,6 @@ static void macb_free_consistent(struct macb *bp)
 				  bp->tx_ring, bp->tx_ring_dma);
 		bp->tx_ring = NULL;
 	}
-	if (bp->rx_buffers) {
-		dma_free_coherent(&bp->pdev->dev,
-				  RX_RING_SIZE * RX_BUFFER_SIZE,
-				  bp->rx_buffers, bp->rx_buffers_dma);
-		bp->rx_buffers = NULL;
-	}
 }
 
 static int macb_alloc_consistent(struct macb *bp)
@@ -725,14 +1192,15 @@ static int macb_alloc_consistent(struct macb *bp)
 		"Allocated TX ring of %d bytes at %08lx (mapped %p)\n",
 		size, (unsigned long)bp->tx_ring_dma, bp->tx_ring);
 
-	size = RX_RING_SIZE * RX_BUFFER_SIZE;
-	bp->rx_buffers = dma_alloc_coherent(&bp->pdev->dev, size,
-					    &bp->rx_buffers_dma, GFP_KERNEL);
-	if (!bp->rx_buffers)
+	size = RX_RING_SIZE * sizeof(struct rx_ring_info);
+	bp->rx_buf = kzalloc(size, GFP_KERNEL);
+	if (!bp->rx_buf)
+		goto out_err;
+
+	size = RX_PAGE_POOL_SIZE * sizeof(struct page *);
+	bp->rx_page_pool = kzalloc(size, GFP_KERNEL);
+	if (!bp->rx_page_pool)
 		goto out_err;
-	dev_dbg(&bp->pdev->dev,
-		"Allocated RX buffers of %d bytes at %08lx (mapped %p)\n",
-		size, (unsigned long)bp->rx_buffers_dma, bp->rx_buffers);
 
 	return 0;
 
@@ -741,18 +1209,17 @@ out_err:
 	return -ENOMEM;
 }
 
-static void macb_init_rings(struct macb *bp)
+static int macb_init_rings(struct macb *bp)
 {
 	int i;
-	dma_addr_t addr;
 
-	addr = bp->rx_buffers_dma;
+	bp->rx_page_idx = 0;
+	bp->rx_page_offset = PAGE_SIZE;
 	for (i = 0; i < RX_RING_SIZE; i++) {
-		bp->rx_ring[i].addr = addr;
-		bp->rx_ring[i].ctrl = 0;
-		addr += RX_BUFFER_SIZE;
+		if (macb_rx_reserve(bp, 1, GFP_KERNEL))
+			return -ENOMEM;
+		macb_rx_refill(bp, i);
 	}
-	bp->rx_ring[RX_RING_SIZE - 1].addr |= MACB_BIT(RX_WRAP);
 
 	for (i = 0; i < TX_RING_SIZE; i++) {
 		bp->tx_ring[i].addr = 0;
@@ -761,6 +1228,8 @@ static void macb_init_rings(struct macb *bp)
 	bp->tx_ring[TX_RING_SIZE - 1].ctrl |= MACB_BIT(TX_WRAP);
 
 	bp->rx_tail = bp->tx_head = bp->tx_tail = 0;
+
+	return 0;
 }
 
 static void macb_reset_hw(struct macb *bp)
@@ -797,6 +1266,7 @@ static void macb_init_hw(struct macb *bp)
 	config |= MACB_BIT(PAE);		/* PAuse Enable */
 	config |= MACB_BIT(DRFCS);		/* Discard Rx FCS */
 	config |= MACB_BIT(BIG);		/* Receive oversized frames */
+	config |= MACB_BF(RBOF, RX_OFFSET);	/* Align the IP header */
 	if (bp->dev->flags & IFF_PROMISC)
 		config |= MACB_BIT(CAF);	/* Copy All Frames */
 	if (!(bp->dev->flags & IFF_BROADCAST))
@@ -960,15 +1430,28 @@ static int macb_open(struct net_device *dev)
 		return err;
 	}
 
+	err = macb_init_rings(bp);
+	if (err) {
+		printk(KERN_ERR
+		       "%s: Unable to allocate RX buffers (error %d)\n",
+		       dev->name, err);
+		macb_free_consistent(bp);
+		return err;
+	}
+
+	netdev_reset_queue(dev);
 	napi_enable(&bp->napi);
 
-	macb_init_rings(bp);
 	macb_init_hw(bp);
 
 	/* schedule a link state check */
 	phy_start(bp->phy_dev);
 
-	netif_start_queue(dev);
+	/* In netmap mode the host stack doesn't get to transmit */
+	if (macb_netmap_mode(bp))
+		macb_netmap_start(bp);
+	else
+		netif_start_queue(dev);
 
 	return 0;
 }
@@ -979,7 +1462,9 @@ static int macb_close(struct net_device *dev)
 	unsigned long flags;
 
 	netif_stop_queue(dev);
+	macb_netmap_stop(bp);
 	napi_disable(&bp->napi);
+	hrtimer_cancel(&bp->coalesce_timer);
 
 	if (bp->phy_dev)
 		phy_stop(bp->phy_dev);
@@ -987,6 +1472,8 @@ static int macb_close(struct net_device *dev)
 	spin_lock_irqsave(&bp->lock, flags);
 	macb_reset_hw(bp);
 	netif_carrier_off(dev);
+	if (macb_netmap_mode(bp))
+		macb_netmap_tx_flush(bp);
 	spin_unlock_irqrestore(&bp->lock, flags);
 
 	macb_free_consistent(bp);
@@ -994,6 +1481,54 @@ static int macb_close(struct net_device *dev)
 	return 0;
 }
 
+#ifdef CONFIG_MACB_NETMAP
+static int macb_netmap_reg(struct netmap_adapter *na, int onoff)
+{
+	struct net_device *dev = na->ifp;
+	struct macb *bp = netdev_priv(dev);
+	int err;
+
+	if (!netif_running(dev)) {
+		bp->nm_mode = onoff;
+		return 0;
+	}
+
+	/*
+	 * Restart the MACB in the new mode.  Going through dev_close() and
+	 * dev_open() rather than the ndo hooks keeps IFF_UP in step with
+	 * the hardware: if it can't be reopened, the interface is down.
+	 * The caller holds the RTNL.
+	 */
+	dev_close(dev);
+	bp->nm_mode = onoff;
+	err = dev_open(dev);
+	if (err && onoff) {
+		/* Back to the host stack, netmap_regif() fails with err */
+		bp->nm_mode = false;
+		if (!dev_open(dev))
+			return err;
+	}
+	if (err)
+		printk(KERN_ERR "%s: Unable to reopen (error %d), "
+		       "interface is down\n", dev->name, err);
+
+	return err;
+}
+
+static void macb_netmap_attach(struct macb *bp)
+{
+	bp->nm.num_tx_desc = TX_RING_SIZE;
+	bp->nm.nm_register = macb_netmap_reg;
+	bp->nm.nm_txsync = macb_netmap_txsync;
+	bp->nm.nm_rxsync = macb_netmap_rxsync;
+	netmap_attach(bp->dev, &bp->nm);
+}
+#else
+static inline void macb_netmap_attach(struct macb *bp)
+{
+}
+#endif
+
 static struct net_device_stats *macb_get_stats(struct net_device *dev)
 {
 	struct macb *bp = netdev_priv(dev);
@@ -1069,11 +1604,47 @@ static void macb_get_drvinfo(struct net_device *dev,
 	strcpy(info->bus_info, dev_name(&bp->pdev->dev));
 }
 
+static int macb_get_coalesce(struct net_device *dev,
+			     struct ethtool_coalesce *ec)
+{
+	struct macb *bp = netdev_priv(dev);
+
+	ec->rx_coalesce_usecs = bp->coalesce.rx_coalesce_usecs;
+	ec->rx_max_coalesced_frames = bp->coalesce.rx_max_coalesced_frames;
+	ec->tx_coalesce_usecs = bp->coalesce.tx_coalesce_usecs;
+	ec->tx_max_coalesced_frames = bp->coalesce.tx_max_coalesced_frames;
+
+	return 0;
+}
+
+static int macb_set_coalesce(struct net_device *dev,
+			     struct ethtool_coalesce *ec)
+{
+	struct macb *bp = netdev_priv(dev);
+
+	if (ec->rx_coalesce_usecs > MACB_MAX_COALESCE_USECS ||
+	    ec->tx_coalesce_usecs > MACB_MAX_COALESCE_USECS)
+		return -EINVAL;
+
+	if (ec->rx_max_coalesced_frames > RX_RING_SIZE ||
+	    ec->tx_max_coalesced_frames > TX_RING_SIZE)
+		return -EINVAL;
+
+	bp->coalesce.rx_coalesce_usecs = ec->rx_coalesce_usecs;
+	bp->coalesce.rx_max_coalesced_frames = ec->rx_max_coalesced_frames;
+	bp->coalesce.tx_coalesce_usecs = ec->tx_coalesce_usecs;
+	bp->coalesce.tx_max_coalesced_frames = ec->tx_max_coalesced_frames;
+
+	return 0;
+}
+
 static const struct ethtool_ops macb_ethtool_ops = {
 	.get_settings		= macb_get_settings,
 	.set_settings		= macb_set_settings,
 	.get_drvinfo		= macb_get_drvinfo,
 	.get_link		= ethtool_op_get_link,
+	.get_coalesce		= macb_get_coalesce,
+	.set_coalesce		= macb_set_coalesce,
 };
 
 static int macb_ioctl(struct net_device *dev, struct ifreq *rq, int cmd)
@@ -1182,6 +1753,8 @@ static int __init macb_probe(struct platform_device *pdev)
 
 	dev->netdev_ops = &macb_netdev_ops;
 	netif_napi_add(dev, &bp->napi, macb_poll, 64);
+	hrtimer_init(&bp->coalesce_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	bp->coalesce_timer.function = macb_coalesce_timer;
 	dev->ethtool_ops = &macb_ethtool_ops;
 
 	dev->base_addr = regs->start;
@@ -1216,6 +1789,8 @@ static int __init macb_probe(struct platform_device *pdev)
 
 	bp->tx_pending = DEF_TX_RING_PENDING;
 
+	macb_netmap_attach(bp);
+
 	err = register_netdev(dev);
 	if (err) {
 		dev_err(&pdev->dev, "Cannot register net device, aborting.\n");
@@ -1276,6 +1851,7 @@ static int __exit macb_remove(struct platform_device *pdev)
 		kfree(bp->mii_bus->irq);
 		mdiobus_free(bp->mii_bus);
 		unregister_netdev(dev);
+		netmap_detach(dev);
 		free_irq(dev->irq, dev);
 		iounmap(bp->regs);
 #ifndef CONFIG_ARCH_AT91
@@ -330,6 +330,17 @@ struct ring_info {
 	dma_addr_t		mapping;
 };
 
+/*
+ * Each RX descriptor points at an RX_BUFFER_SIZE slice of a page.
+ * The slice holds its own page reference, which is handed over to
+ * the skb when the buffer is attached as a fragment.
+ */
+struct rx_ring_info {
+	struct page		*page;
+	unsigned int		offset;
+	dma_addr_t		mapping;
+};
+
 /*
  * Hardware-collected statistics. Used when updating the network
  * device stats by a periodic timer.
@@ -363,7 +374,12 @@ struct macb {
 
 	unsigned int		rx_tail;
 	struct dma_desc		*rx_ring;
-	void			*rx_buffers;
+	struct rx_ring_info	*rx_buf;
+
+	/* Pages carved up into RX buffers, recycled once the stack is done */
+	struct page		**rx_page_pool;
+	unsigned int		rx_page_idx;
+	unsigned int		rx_page_offset;
 
 	unsigned int		tx_head, tx_tail;
 	struct dma_desc		*tx_ring;
@@ -378,9 +394,13 @@ struct macb {
 	struct net_device_stats	stats;
 	struct macb_stats	hw_stats;
 
+	/* Interrupt moderation, see macb_coalesce() */
+	struct ethtool_coalesce	coalesce;
+	struct hrtimer		coalesce_timer;
+	ktime_t			coalesce_stamp;	/* last poll completion */
+
 	dma_addr_t		rx_ring_dma;
 	dma_addr_t		tx_ring_dma;
-	dma_addr_t		rx_buffers_dma;
 
 	unsigned int		rx_pending, tx_pending;
 
@@ -389,6 +409,13 @@ struct macb {
 	unsigned int 		link;
 	unsigned int 		speed;
 	unsigned int 		duplex;
+
+#ifdef CONFIG_MACB_NETMAP
+	/* netmap native mode, see macb_netmap_txsync() and friends */
+	struct netmap_adapter	nm;
+	bool			nm_mode;	/* switched to netmap */
+	bool			nm_up;		/* rings set up for it */
+#endif
 };
 
 #endif /* _MACB_H */
@@ -520,8 +520,11 @@ static void ppp_async_process(unsigned long arg)
  * Returns 1 if we finished the current frame, 0 otherwise.
  */
 
+#define NEED_ESCAPE(ap, c, islcp)			\
+	((islcp && c < 0x20) || (ap->xaccm[c >> 5] & (1 << (c & 0x1f))))
+
 #define PUT_BYTE(ap, buf, c, islcp)	do {		\
-	if ((islcp && c < 0x20) || (ap->xaccm[c >> 5] & (1 << (c & 0x1f)))) {\
+	if (NEED_ESCAPE(ap, c, islcp)) {		\
 		*buf++ = PPP_ESCAPE;			\
 		*buf++ = c ^ 0x20;			\
 	} else						\
@@ -531,7 +534,7 @@ static void ppp_async_process(unsigned long arg)
 static int
 ppp_async_encode(struct asyncppp *ap)
 {
-	int fcs, i, count, c, proto;
+	int fcs, i, n, count, c, proto;
 	unsigned char *buf, *buflim;
 	unsigned char *data;
 	int islcp;
@@ -584,9 +587,29 @@ ppp_async_encode(struct asyncppp *ap)
 	 */
 	buflim = ap->obuf + OBUFSIZE - 6;
 	while (i < count && buf < buflim) {
+		if (i == 0 && data[0] == 0 && (ap->flags & SC_COMP_PROT)) {
+			i++;	/* compress protocol field */
+			continue;
+		}
+
+		/*
+		 * Copy the run of bytes that need no escaping in one go,
+		 * it is usually most of the packet.
+		 */
+		n = min_t(int, count - i, buflim - buf);
+		for (n += i, c = i; c < n; c++)
+			if (NEED_ESCAPE(ap, data[c], islcp))
+				break;
+		n = c - i;
+		if (n) {
+			memcpy(buf, data + i, n);
+			fcs = crc_ccitt(fcs, data + i, n);
+			buf += n;
+			i += n;
+			continue;
+		}
+
 		c = data[i++];
-		if (i == 1 && c == 0 && (ap->flags & SC_COMP_PROT))
-			continue;	/* compress protocol field */
 		fcs = PPP_FCS(fcs, c);
 		PUT_BYTE(ap, buf, c, islcp);
 	}
@@ -783,9 +806,7 @@ process_input_packet(struct asyncppp *ap)
 	len = skb->len;
 	if (len < 3)
 		goto err;	/* too short */
-	fcs = PPP_INITFCS;
-	for (; len > 0; --len)
-		fcs = PPP_FCS(fcs, *p++);
+	fcs = crc_ccitt(PPP_INITFCS, p, len);
 	if (fcs != PPP_GOODFCS)
 		goto err;	/* bad FCS */
 	skb_trim(skb, skb->len - 2);
@@ -954,7 +975,7 @@ ppp_async_input(struct asyncppp *ap, const unsigned char *buf,
 static void async_lcp_peek(struct asyncppp *ap, unsigned char *data,
 			   int len, int inbound)
 {
-	int dlen, fcs, i, code;
+	int dlen, fcs, code;
 	u32 val;
 
 	data += 2;		/* skip protocol bytes */
@@ -974,8 +995,8 @@ static void async_lcp_peek(struct asyncppp *ap, unsigned char *data,
 		 * calculate the crc of the data from the ID field on.
 		 */
 		fcs = PPP_INITFCS;
-		for (i = 1; i < dlen; ++i)
-			fcs = PPP_FCS(fcs, data[i]);
+		if (dlen > 1)
+			fcs = crc_ccitt(fcs, data + 1, dlen - 1);
 
 		if (!inbound) {
 			/* outbound confreq - remember the crc for later */
@@ -411,7 +411,10 @@ static netdev_tx_t tun_net_xmit(struct sk_buff *skb, struct net_device *dev)
 	}
 
 	/* Orphan the skb - required as we might hang on to it
-	 * for indefinite time. */
+	 * for indefinite time.  That goes for zerocopy user pages too:
+	 * copy them so the sender gets its completion now. */
+	if (unlikely(skb_orphan_frags(skb, GFP_ATOMIC)))
+		goto drop;
 	skb_orphan(skb);
 
 	/* Enqueue packet */
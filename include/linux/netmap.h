@@ -0,0 +1,257 @@
+#ifndef _LINUX_NETMAP_H
+#define _LINUX_NETMAP_H
+
+/*
+ * netmap: packet I/O through rings shared with userspace.
+ *
+ * An application opens /dev/netmap, binds the descriptor to an
+ * interface with NIOCREGIF and mmap()s nr_memsize bytes of it.  The
+ * mapping holds a struct netmap_if at nr_offset, one TX and one RX
+ * struct netmap_ring, and the packet buffers the ring slots point to.
+ * While bound, received frames bypass the host stack; with native
+ * driver support the host stack cannot transmit either.
+ *
+ * Slots [head, tail) of a ring belong to the application: frames to
+ * read on RX, free buffers to fill on TX.  The application advances
+ * head past the slots it is done with and calls NIOCTXSYNC/NIOCRXSYNC,
+ * or poll(), which hand those slots to the kernel and move tail on.
+ * See Documentation/networking/netmap.txt.
+ */
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+#include <linux/if.h>
+
+#define NETMAP_API		1
+
+/* Size of every packet buffer */
+#define NETMAP_BUF_SIZE		2048
+
+struct netmap_slot {
+	__u32	buf_idx;	/* buffer index */
+	__u16	len;		/* frame length */
+	__u16	flags;
+};
+
+/* buf_idx was changed by the application, e.g. swapped with another ring */
+#define NS_BUF_CHANGED		0x0001
+
+struct netmap_ring {
+	/* set by the kernel, read only for the application */
+	__u32	num_slots;
+	__u32	buf_size;
+	__s64	buf_ofs;	/* buffer area, relative to this ring */
+
+	__u32	head;		/* written by the application */
+	__u32	tail;		/* written by the kernel */
+	__u32	flags;
+	__u32	__pad;
+
+	struct netmap_slot slot[0];
+};
+
+struct netmap_if {
+	char	ni_name[IFNAMSIZ];
+	__u32	ni_version;
+	__u32	ni_flags;
+	__u32	ni_tx_rings;
+	__u32	ni_rx_rings;
+	__s64	ring_ofs[0];	/* TX rings, then RX rings; relative to netmap_if */
+};
+
+/* ni_flags */
+#define NI_GENERIC		0x0001	/* emulated on top of the driver */
+
+struct nmreq {
+	char	nr_name[IFNAMSIZ];
+	__u32	nr_version;	/* NETMAP_API */
+	__u32	nr_offset;	/* netmap_if in the mapping */
+	__u32	nr_memsize;	/* size of the mapping */
+	__u32	nr_tx_slots;
+	__u32	nr_rx_slots;
+	__u16	nr_tx_rings;
+	__u16	nr_rx_rings;
+	__u32	nr_flags;
+};
+
+/* nr_flags */
+#define NR_GENERIC		0x0001	/* don't use native driver support */
+
+#define NIOCGINFO	_IOWR('i', 145, struct nmreq)
+#define NIOCREGIF	_IOWR('i', 146, struct nmreq)
+#define NIOCTXSYNC	_IO('i', 148)
+#define NIOCRXSYNC	_IO('i', 149)
+
+#define NETMAP_IF(mem, ofs)	((struct netmap_if *)((char *)(mem) + (ofs)))
+#define NETMAP_TXRING(nifp, i)	((struct netmap_ring *)			\
+	((char *)(nifp) + (nifp)->ring_ofs[i]))
+#define NETMAP_RXRING(nifp, i)	((struct netmap_ring *)			\
+	((char *)(nifp) + (nifp)->ring_ofs[(i) + (nifp)->ni_tx_rings]))
+#define NETMAP_BUF(ring, idx)	((char *)(ring) + (ring)->buf_ofs +	\
+	(idx) * (ring)->buf_size)
+
+static inline __u32 netmap_ring_next(const struct netmap_ring *ring, __u32 i)
+{
+	return i + 1 == ring->num_slots ? 0 : i + 1;
+}
+
+static inline __u32 netmap_ring_space(const struct netmap_ring *ring)
+{
+	int n = ring->tail - ring->head;
+
+	return n < 0 ? n + ring->num_slots : n;
+}
+
+#ifdef __KERNEL__
+
+#include <linux/spinlock.h>
+#include <linux/wait.h>
+#include <linux/highmem.h>
+#include <linux/netdevice.h>
+
+struct netmap_kring {
+	struct netmap_ring	*ring;
+	u32			num_slots;
+	/*
+	 * TX: next slot to hand to the hardware, and the end of what the
+	 * application owns (ring->tail).  RX: the first slot still held
+	 * by the application (ring->head last time we looked), and the
+	 * next slot to fill (ring->tail).
+	 */
+	u32			nr_hwcur;
+	u32			nr_hwtail;
+	u32			rhead;		/* ring->head, validated */
+	spinlock_t		lock;
+};
+
+/*
+ * A driver with native support embeds one of these in its private
+ * data, fills in the callbacks and calls netmap_attach() before
+ * register_netdev(), and netmap_detach() after unregister_netdev().
+ *
+ * nm_register switches the hardware in (onoff != 0) or out of netmap
+ * mode; it is called with RTNL held and the interface up, and once it
+ * has returned after onoff == 0 the driver must not touch the rings or
+ * call netmap_wake() any more.  nm_txsync hands slots [nr_hwcur, rhead)
+ * to the hardware and reclaims sent ones, nm_rxsync fills slots from
+ * nr_hwtail up to nr_hwcur.  Both advance the kring indices, the core
+ * publishes them; they run with the kring lock held and BHs disabled.
+ */
+struct netmap_adapter {
+	struct net_device	*ifp;
+	u32			num_tx_desc;	/* 0: module default */
+	u32			num_rx_desc;
+
+	int			(*nm_register)(struct netmap_adapter *na,
+					       int onoff);
+	int			(*nm_txsync)(struct netmap_adapter *na);
+	int			(*nm_rxsync)(struct netmap_adapter *na);
+
+	/* Owned by the netmap core */
+	unsigned int		active:1;
+	unsigned int		generic:1;
+	struct netmap_kring	tx_ring;
+	struct netmap_kring	rx_ring;
+	wait_queue_head_t	*wait;
+	void			*buf_base;
+	u32			num_bufs;
+};
+
+static inline bool netmap_active(const struct netmap_adapter *na)
+{
+	return na->active;
+}
+
+static inline u32 netmap_next(const struct netmap_kring *kring, u32 i)
+{
+	return i + 1 == kring->num_slots ? 0 : i + 1;
+}
+
+/* Kernel address of the buffer behind a slot, NULL if the index is bogus */
+static inline void *netmap_buf(const struct netmap_adapter *na,
+			       const struct netmap_slot *slot)
+{
+	u32 idx = ACCESS_ONCE(slot->buf_idx);
+
+	if (unlikely(idx >= na->num_bufs))
+		return NULL;
+	return na->buf_base + idx * NETMAP_BUF_SIZE;
+}
+
+/*
+ * The shared area is vmalloc()ed, so on aliasing caches the kernel view
+ * of a buffer has to be written back after filling it, and discarded
+ * before reading what the application put there.
+ */
+static inline void netmap_buf_for_user(void *buf, unsigned int len)
+{
+	flush_kernel_vmap_range(buf, len);
+}
+
+static inline void netmap_buf_for_kernel(void *buf, unsigned int len)
+{
+	invalidate_kernel_vmap_range(buf, len);
+}
+
+/* Called by drivers from interrupt context when there is work to sync */
+static inline void netmap_wake(struct netmap_adapter *na)
+{
+	wake_up_interruptible(na->wait);
+}
+
+#if defined(CONFIG_NETMAP) || defined(CONFIG_NETMAP_MODULE)
+
+static inline void netmap_attach(struct net_device *dev,
+				 struct netmap_adapter *na)
+{
+	na->ifp = dev;
+	dev->nm_adapter = na;
+}
+
+static inline void netmap_detach(struct net_device *dev)
+{
+	dev->nm_adapter = NULL;
+}
+
+#else
+
+static inline void netmap_attach(struct net_device *dev,
+				 struct netmap_adapter *na)
+{
+}
+
+static inline void netmap_detach(struct net_device *dev)
+{
+}
+
+#endif
+
+/*
+ * The hardware rings were reinitialised while in netmap mode (e.g. the
+ * interface went down and up): start the rings over, dropping whatever
+ * was in flight.
+ */
+static inline void netmap_reset(struct netmap_adapter *na)
+{
+	struct netmap_kring *kring;
+
+	kring = &na->tx_ring;
+	spin_lock_bh(&kring->lock);
+	kring->nr_hwcur = 0;
+	kring->nr_hwtail = kring->num_slots - 1;
+	kring->ring->head = 0;
+	kring->ring->tail = kring->nr_hwtail;
+	spin_unlock_bh(&kring->lock);
+
+	kring = &na->rx_ring;
+	spin_lock_bh(&kring->lock);
+	kring->nr_hwcur = kring->nr_hwtail = 0;
+	kring->ring->head = kring->ring->tail = 0;
+	spin_unlock_bh(&kring->lock);
+
+	netmap_wake(na);
+}
+
+#endif /* __KERNEL__ */
+
+#endif /* _LINUX_NETMAP_H */
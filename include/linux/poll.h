@@ -25,6 +25,12 @@ extern struct ctl_table epoll_table[]; /* for sysctl */
 
 #define DEFAULT_POLLMASK (POLLIN | POLLOUT | POLLRDNORM | POLLWRNORM)
 
+/*
+ * In the poll_table key: busy poll for data (see net/busy_poll.h).
+ * Returned by ->poll() of files that can.
+ */
+#define POLL_BUSY_LOOP	0x8000
+
 struct poll_table_struct;
 
 /* 
@@ -29,6 +29,7 @@
 #include <linux/rcupdate.h>
 #include <linux/dmaengine.h>
 #include <linux/hrtimer.h>
+#include <linux/rbtree.h>
 
 /* Don't change this without changing skb_csum_unnecessary! */
 #define CHECKSUM_NONE 0
@@ -92,6 +93,7 @@
  */
 
 struct net_device;
+struct sock;
 struct scatterlist;
 struct pipe_inode_info;
 
@@ -187,8 +189,32 @@ enum {
 
 	/* ensure the originating sk reference is available on driver level */
 	SKBTX_DRV_NEEDS_SK_REF = 1 << 3,
+
+	/* frags point into user memory pinned by MSG_ZEROCOPY, and
+	 * destructor_arg to the struct ubuf_info tracking it
+	 */
+	SKBTX_ZEROCOPY_FRAG = 1 << 4,
+};
+
+/*
+ * User memory sent with MSG_ZEROCOPY.  Every skb_shared_info whose frags
+ * point into it holds a reference; when the last one is dropped, the
+ * sending socket is told on its error queue that sends @id to
+ * @id + @len - 1 have completed and the buffers may be reused.  Lives in
+ * the cb of the skb that will carry that notification.
+ */
+struct ubuf_info {
+	struct sock	*sk;
+	u32		id;
+	u16		len;
+	u16		zerocopy;	/* clear if the data got copied after all */
+	u32		bytelen;
+	atomic_t	refcnt;
 };
 
+/* Sends shorter than this are copied: pinning would cost more */
+#define SKB_ZEROCOPY_MIN_SIZE	4096
+
 /* This data is invariant across clones and lives at
  * the end of the header data, ie. at skb->end.
  */
@@ -249,6 +275,12 @@ enum {
 	SKB_GSO_TCPV6 = 1 << 4,
 
 	SKB_GSO_FCOE = 1 << 5,
+
+	/* UDP datagrams of gso_size bytes, see UDP_SEGMENT. */
+	SKB_GSO_UDP_L4 = 1 << 6,
+
+	/* The segments are carried inside an IPv4 GRE header. */
+	SKB_GSO_GRE = 1 << 7,
 };
 
 #if BITS_PER_LONG > 32
@@ -272,6 +304,7 @@ typedef unsigned char *sk_buff_data_t;
  *	@prev: Previous buffer in list
  *	@sk: Socket we are owned by
  *	@tstamp: Time we arrived
+ *	@rbnode: RB tree node, alternative to next/prev/tstamp for IPv4 defrag
  *	@dev: Device we arrived on/are leaving by
  *	@transport_header: Transport layer header
  *	@network_header: Network layer header
@@ -313,21 +346,28 @@ typedef unsigned char *sk_buff_data_t;
  *	@skb_iif: ifindex of device we arrived on
  *	@rxhash: the packet hash computed on receive
  *	@queue_mapping: Queue mapping for multiqueue devices
+ *	@head_frag: skb->head is a page fragment rather than kmalloc() memory
  *	@tc_index: Traffic control index
  *	@tc_verd: traffic control verdict
  *	@ndisc_nodetype: router type (from link layer)
  *	@dma_cookie: a cookie to one of several possible DMA operations
  *		done by skb DMA functions
+ *	@napi_id: id of the NAPI context this skb was received from
  *	@secmark: security marking
  *	@vlan_tci: vlan tag control information
  */
 
 struct sk_buff {
-	/* These two members must be first. */
-	struct sk_buff		*next;
-	struct sk_buff		*prev;
+	union {
+		struct {
+			/* These two members must be first. */
+			struct sk_buff		*next;
+			struct sk_buff		*prev;
 
-	ktime_t			tstamp;
+			ktime_t			tstamp;
+		};
+		struct rb_node		rbnode; /* used in IPv4 defrag */
+	};
 
 	struct sock		*sk;
 	struct net_device	*dev;
@@ -397,6 +437,7 @@ struct sk_buff {
 	__u8			ndisc_nodetype:2;
 #endif
 	__u8			ooo_okay:1;
+	__u8			head_frag:1;
 	kmemcheck_bitfield_end(flags2);
 
 	/* 0/13 bit hole */
@@ -404,6 +445,9 @@ struct sk_buff {
 #ifdef CONFIG_NET_DMA
 	dma_cookie_t		dma_cookie;
 #endif
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	unsigned int		napi_id;
+#endif
 #ifdef CONFIG_NETWORK_SECMARK
 	__u32			secmark;
 #endif
@@ -504,6 +548,13 @@ static inline struct sk_buff *alloc_skb_fclone(unsigned int size,
 	return __alloc_skb(size, priority, 1, NUMA_NO_NODE);
 }
 
+extern struct sk_buff *build_skb(void *data, unsigned int frag_size);
+extern struct sk_buff *__alloc_skb_head(gfp_t priority, int node);
+static inline struct sk_buff *alloc_skb_head(gfp_t priority)
+{
+	return __alloc_skb_head(priority, NUMA_NO_NODE);
+}
+
 extern bool skb_recycle_check(struct sk_buff *skb, int skb_size);
 
 extern struct sk_buff *skb_morph(struct sk_buff *dst, struct sk_buff *src);
@@ -584,6 +635,63 @@ static inline struct skb_shared_hwtstamps *skb_hwtstamps(struct sk_buff *skb)
 	return &skb_shinfo(skb)->hwtstamps;
 }
 
+extern struct ubuf_info *sock_zerocopy_realloc(struct sock *sk, size_t size,
+					       struct ubuf_info *uarg);
+extern void sock_zerocopy_put(struct ubuf_info *uarg);
+extern void sock_zerocopy_put_abort(struct ubuf_info *uarg);
+extern int skb_zerocopy_iter_stream(struct sock *sk, struct sk_buff *skb,
+				    const void __user *from, int len,
+				    struct ubuf_info *uarg);
+extern int skb_zerocopy_iter_dgram(struct sk_buff *skb,
+				   const struct iovec *iov, int offset,
+				   int len, struct ubuf_info *uarg);
+extern int skb_copy_ubufs(struct sk_buff *skb, gfp_t gfp_mask);
+
+static inline void sock_zerocopy_get(struct ubuf_info *uarg)
+{
+	atomic_inc(&uarg->refcnt);
+}
+
+static inline struct ubuf_info *skb_zcopy(struct sk_buff *skb)
+{
+	if (skb && (skb_shinfo(skb)->tx_flags & SKBTX_ZEROCOPY_FRAG))
+		return skb_shinfo(skb)->destructor_arg;
+	return NULL;
+}
+
+/* Make the frags of @skb part of the zerocopy send @uarg, if not already */
+static inline void skb_zcopy_set(struct sk_buff *skb, struct ubuf_info *uarg)
+{
+	if (uarg && !skb_zcopy(skb)) {
+		sock_zerocopy_get(uarg);
+		skb_shinfo(skb)->destructor_arg = uarg;
+		skb_shinfo(skb)->tx_flags |= SKBTX_ZEROCOPY_FRAG;
+	}
+}
+
+static inline void skb_zcopy_clear(struct sk_buff *skb, bool zerocopy)
+{
+	struct ubuf_info *uarg = skb_zcopy(skb);
+
+	if (uarg) {
+		if (!zerocopy)
+			uarg->zerocopy = 0;
+		skb_shinfo(skb)->tx_flags &= ~SKBTX_ZEROCOPY_FRAG;
+		sock_zerocopy_put(uarg);
+	}
+}
+
+/*
+ * Paths that may hold on to an skb for an unbounded time, such as local
+ * delivery, must not keep user pages pinned: give them a private copy.
+ */
+static inline int skb_orphan_frags(struct sk_buff *skb, gfp_t gfp_mask)
+{
+	if (likely(!skb_zcopy(skb)))
+		return 0;
+	return skb_copy_ubufs(skb, gfp_mask);
+}
+
 /**
  *	skb_queue_empty - check if a queue is empty
  *	@list: queue head
@@ -1535,6 +1643,8 @@ static inline struct sk_buff *__dev_alloc_skb(unsigned int length,
 
 extern struct sk_buff *dev_alloc_skb(unsigned int length);
 
+extern void *netdev_alloc_frag(unsigned int fragsz);
+
 extern struct sk_buff *__netdev_alloc_skb(struct net_device *dev,
 		unsigned int length, gfp_t gfp_mask);
 
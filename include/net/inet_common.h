@@ -12,10 +12,13 @@ struct msghdr;
 struct sock;
 struct sockaddr;
 struct socket;
+struct sk_buff;
 
 extern int inet_release(struct socket *sock);
 extern int inet_stream_connect(struct socket *sock, struct sockaddr * uaddr,
 			       int addr_len, int flags);
+extern int __inet_stream_connect(struct socket *sock, struct sockaddr *uaddr,
+				 int addr_len, int flags);
 extern int inet_dgram_connect(struct socket *sock, struct sockaddr * uaddr,
 			      int addr_len, int flags);
 extern int inet_accept(struct socket *sock, struct socket *newsock, int flags);
@@ -36,6 +39,11 @@ extern int inet_ctl_sock_create(struct sock **sk, unsigned short family,
 				unsigned short type, unsigned char protocol,
 				struct net *net);
 
+extern struct sk_buff *inet_gso_segment(struct sk_buff *skb, u32 features);
+extern struct sk_buff **inet_gro_receive(struct sk_buff **head,
+					 struct sk_buff *skb);
+extern int inet_gro_complete(struct sk_buff *skb);
+
 static inline void inet_ctl_sock_destroy(struct sock *sk)
 {
 	sk_release_kernel(sk);
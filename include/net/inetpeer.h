@@ -12,6 +12,7 @@
 #include <linux/jiffies.h>
 #include <linux/spinlock.h>
 #include <linux/rtnetlink.h>
+#include <linux/tcp.h>
 #include <net/ipv6.h>
 #include <asm/atomic.h>
 
@@ -54,6 +55,11 @@ struct inet_peer {
 			u32				pmtu_orig;
 			u32				pmtu_learned;
 			struct inetpeer_addr_base	redirect_learned;
+			/* TCP Fast Open client cache, see tcp_fastopen.c */
+			struct tcp_fastopen_cookie	tcp_fastopen_cookie;
+			u16				tcp_fastopen_mss;
+			u16				tcp_fastopen_syn_loss;
+			unsigned long			tcp_fastopen_syn_loss_ts;
 		};
 		struct rcu_head         rcu;
 	};
@@ -54,6 +54,7 @@ struct ipcm_cookie {
 	int			oif;
 	struct ip_options	*opt;
 	__u8			tx_flags;
+	__u16			gso_size;
 };
 
 #define IPCB(skb) ((struct inet_skb_parm*)((skb)->cb))
@@ -128,6 +129,7 @@ extern struct sk_buff  *ip_make_skb(struct sock *sk,
 				    void *from, int length, int transhdrlen,
 				    struct ipcm_cookie *ipc,
 				    struct rtable **rtp,
+				    struct inet_cork *cork,
 				    unsigned int flags);
 
 static inline struct sk_buff *ip_finish_skb(struct sock *sk)
@@ -3,6 +3,7 @@
 
 #include <linux/list.h>
 #include <linux/list_nulls.h>
+#include <linux/workqueue.h>
 #include <asm/atomic.h>
 
 struct ctl_table_header;
@@ -17,6 +18,8 @@ struct netns_ct {
 	struct hlist_head	*expect_hash;
 	struct hlist_nulls_head	unconfirmed;
 	struct hlist_nulls_head	dying;
+	struct delayed_work	gc_work;
+	unsigned int		gc_bucket;
 	struct ip_conntrack_stat __percpu *stat;
 	int			sysctl_events;
 	unsigned int		sysctl_events_retry_timeout;
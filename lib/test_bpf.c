@@ -0,0 +1,813 @@
+/*
+ * Testsuite for the BPF interpreter and JIT
+ *
+ * Runs a corpus of filters over crafted packets and checks the result
+ * of the interpreter against the expected one, and that of the JIT
+ * compiled filter against the interpreter.  A second pass does the
+ * same for pseudo-random programs and packets, where only the two
+ * implementations are compared.  Set net.core.bpf_jit_enable before
+ * loading the module for the JIT to be exercised; failures are
+ * reported in the kernel log and make the load fail.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/filter.h>
+#include <linux/skbuff.h>
+#include <linux/netdevice.h>
+#include <linux/if_arp.h>
+#include <linux/if_ether.h>
+#include <linux/random.h>
+
+static unsigned int random_runs = 1000;
+module_param(random_runs, uint, 0);
+MODULE_PARM_DESC(random_runs, "Number of random programs to try");
+
+static unsigned int seed = 1;
+module_param(seed, uint, 0);
+MODULE_PARM_DESC(seed, "Seed of the random programs and packets");
+
+#define MAX_INSNS	32
+#define MAX_SUBTESTS	4
+#define MAX_DATA	128
+#define FRAG_HEADLEN	20	/* linear part of FLAG_SKB_FRAG packets */
+
+#define FLAG_SKB_FRAG	0x01	/* rest of the packet in a page fragment */
+#define FLAG_NO_DEV	0x02	/* skb->dev is NULL */
+#define FLAG_NO_EXPECT	0x04	/* only compare interpreter and JIT */
+
+#define SKB_MARK	0x2a5a5a2a
+#define SKB_QUEUE	5
+#define SKB_RXHASH	0xc0ffee42
+#define SKB_PKT_TYPE	PACKET_OTHERHOST
+#define SKB_DEV_IFINDEX	3
+#define SKB_DEV_TYPE	ARPHRD_ETHER
+
+/* Ethernet, IPv4 and TCP SYN to port 80 with options: 74 bytes */
+static const u8 test_packet[] __initconst = {
+	0x0a, 0x1b, 0x2c, 0x3d, 0x4e, 0x5f, 0x00, 0x25,
+	0x86, 0x01, 0x02, 0x03, 0x08, 0x00, 0x45, 0x00,
+	0x00, 0x3c, 0x1c, 0x46, 0x40, 0x00, 0x40, 0x06,
+	0xb1, 0xe6, 0xc0, 0xa8, 0x00, 0x01, 0xc0, 0xa8,
+	0x00, 0xc7, 0xa0, 0xe6, 0x00, 0x50, 0x3b, 0x9a,
+	0xca, 0x00, 0x00, 0x00, 0x00, 0x00, 0xa0, 0x02,
+	0x72, 0x10, 0x5c, 0x8e, 0x00, 0x00, 0x02, 0x04,
+	0x05, 0xb4, 0x04, 0x02, 0x08, 0x0a, 0x00, 0x9c,
+	0x27, 0x24, 0x00, 0x00, 0x00, 0x00, 0x01, 0x03,
+	0x03, 0x07,
+};
+
+struct bpf_test {
+	const char *descr;
+	struct sock_filter insns[MAX_INSNS];
+	unsigned int flags;
+	/* packet length, result; a zero length ends the list */
+	struct {
+		unsigned int data_size;
+		u32 result;
+	} test[MAX_SUBTESTS];
+};
+
+/*
+ * The expected results follow the interpreter: a load outside the
+ * packet returns 0 from the filter, negative offsets only reach the
+ * linear part, and division by K uses the reciprocal computed by
+ * sk_chk_filter().
+ */
+static struct bpf_test tests[] __initdata = {
+	{
+		.descr = "tcp port 80",
+		.insns = {
+			BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 12),
+			BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x800, 0, 10),
+			BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 23),
+			BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 6, 0, 8),
+			BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 20),
+			BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x1fff, 6, 0),
+			BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, 14),
+			BPF_STMT(BPF_LD | BPF_H | BPF_IND, 14),
+			BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 80, 2, 0),
+			BPF_STMT(BPF_LD | BPF_H | BPF_IND, 16),
+			BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 80, 0, 1),
+			BPF_STMT(BPF_RET | BPF_K, 0xffff),
+			BPF_STMT(BPF_RET | BPF_K, 0),
+		},
+		.test = { { 74, 0xffff }, { 42, 0xffff }, { 36, 0 }, { 14, 0 } },
+	},
+	{
+		.descr = "tcp port 80, nonlinear skb",
+		.insns = {
+			BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 12),
+			BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x800, 0, 10),
+			BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 23),
+			BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 6, 0, 8),
+			BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 20),
+			BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x1fff, 6, 0),
+			BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, 14),
+			BPF_STMT(BPF_LD | BPF_H | BPF_IND, 14),
+			BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 80, 2, 0),
+			BPF_STMT(BPF_LD | BPF_H | BPF_IND, 16),
+			BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 80, 0, 1),
+			BPF_STMT(BPF_RET | BPF_K, 0xffff),
+			BPF_STMT(BPF_RET | BPF_K, 0),
+		},
+		.flags = FLAG_SKB_FRAG,
+		.test = { { 74, 0xffff }, { 42, 0xffff }, { 36, 0 }, { 14, 0 } },
+	},
+	{
+		.descr = "LD_IMM and ALU with K",
+		.insns = {
+			BPF_STMT(BPF_LD | BPF_IMM, 0x12345678),
+			BPF_STMT(BPF_ALU | BPF_ADD | BPF_K, 17),
+			BPF_STMT(BPF_ALU | BPF_SUB | BPF_K, 2),
+			BPF_STMT(BPF_ALU | BPF_MUL | BPF_K, 3),
+			BPF_STMT(BPF_ALU | BPF_DIV | BPF_K, 7),
+			BPF_STMT(BPF_ALU | BPF_AND | BPF_K, 0xffff0ff0),
+			BPF_STMT(BPF_ALU | BPF_OR | BPF_K, 5),
+			BPF_STMT(BPF_ALU | BPF_LSH | BPF_K, 3),
+			BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 1),
+			BPF_STMT(BPF_ALU | BPF_NEG, 0),
+			BPF_STMT(BPF_RET | BPF_A, 0),
+		},
+		.test = { { 74, 0xe0cbd96c }, { 1, 0xe0cbd96c } },
+	},
+	{
+		.descr = "ALU with X",
+		.insns = {
+			BPF_STMT(BPF_LDX | BPF_IMM, 9),
+			BPF_STMT(BPF_LD | BPF_IMM, 0x87654321),
+			BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+			BPF_STMT(BPF_ALU | BPF_MUL | BPF_X, 0),
+			BPF_STMT(BPF_LDX | BPF_IMM, 0x1234),
+			BPF_STMT(BPF_ALU | BPF_SUB | BPF_X, 0),
+			BPF_STMT(BPF_ALU | BPF_OR | BPF_X, 0),
+			BPF_STMT(BPF_LDX | BPF_IMM, 0xf0f0f0f0),
+			BPF_STMT(BPF_ALU | BPF_AND | BPF_X, 0),
+			BPF_STMT(BPF_LDX | BPF_IMM, 0x3e8),
+			BPF_STMT(BPF_ALU | BPF_DIV | BPF_X, 0),
+			BPF_STMT(BPF_MISC | BPF_TAX, 0),
+			BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+			BPF_STMT(BPF_MISC | BPF_TXA, 0),
+			BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+			BPF_STMT(BPF_RET | BPF_A, 0),
+		},
+		.test = { { 74, 0x628f84 } },
+	},
+	{
+		.descr = "DIV by X == 0",
+		.insns = {
+			BPF_STMT(BPF_LDX | BPF_IMM, 0),
+			BPF_STMT(BPF_LD | BPF_IMM, 100),
+			BPF_STMT(BPF_ALU | BPF_DIV | BPF_X, 0),
+			BPF_STMT(BPF_RET | BPF_K, 1),
+		},
+		.test = { { 74, 0 } },
+	},
+	{
+		.descr = "DIV by large K",
+		.insns = {
+			BPF_STMT(BPF_LD | BPF_IMM, 0xffffffff),
+			BPF_STMT(BPF_ALU | BPF_DIV | BPF_K, 0x80000001),
+			BPF_STMT(BPF_ST, 0),
+			BPF_STMT(BPF_LD | BPF_IMM, 0xfffffffe),
+			BPF_STMT(BPF_ALU | BPF_DIV | BPF_K, 3),
+			BPF_STMT(BPF_LDX | BPF_MEM, 0),
+			BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+			BPF_STMT(BPF_ALU | BPF_DIV | BPF_K, 0xffffffff),
+			BPF_STMT(BPF_ALU | BPF_ADD | BPF_K, 16),
+			BPF_STMT(BPF_RET | BPF_A, 0),
+		},
+		.test = { { 74, 0x10 } },
+	},
+	{
+		.descr = "scratch memory",
+		.insns = {
+			BPF_STMT(BPF_LD | BPF_IMM, 17),
+			BPF_STMT(BPF_ST, 0),
+			BPF_STMT(BPF_ALU | BPF_ADD | BPF_K, 34),
+			BPF_STMT(BPF_ST, 15),
+			BPF_STMT(BPF_MISC | BPF_TAX, 0),
+			BPF_STMT(BPF_STX, 7),
+			BPF_STMT(BPF_LD | BPF_IMM, 0),
+			BPF_STMT(BPF_ALU | BPF_ADD | BPF_K, 1),
+			BPF_STMT(BPF_ST, 8),
+			BPF_STMT(BPF_LD | BPF_MEM, 15),
+			BPF_STMT(BPF_LDX | BPF_MEM, 0),
+			BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+			BPF_STMT(BPF_LDX | BPF_MEM, 7),
+			BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+			BPF_STMT(BPF_LDX | BPF_MEM, 8),
+			BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+			BPF_STMT(BPF_RET | BPF_A, 0),
+		},
+		.test = { { 74, 0x78 } },
+	},
+	{
+		.descr = "conditional jumps with K",
+		.insns = {
+			BPF_STMT(BPF_LD | BPF_IMM, 5),
+			BPF_JUMP(BPF_JMP | BPF_JGT | BPF_K, 4, 1, 0),
+			BPF_STMT(BPF_RET | BPF_K, 1),
+			BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, 5, 1, 0),
+			BPF_STMT(BPF_RET | BPF_K, 2),
+			BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 5, 1, 0),
+			BPF_STMT(BPF_RET | BPF_K, 3),
+			BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 4, 1, 0),
+			BPF_STMT(BPF_RET | BPF_K, 4),
+			BPF_JUMP(BPF_JMP | BPF_JGT | BPF_K, 5, 0, 1),
+			BPF_STMT(BPF_RET | BPF_K, 5),
+			BPF_STMT(BPF_JMP | BPF_JA, 1),
+			BPF_STMT(BPF_RET | BPF_K, 6),
+			BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 2, 0, 1),
+			BPF_STMT(BPF_RET | BPF_K, 8),
+			BPF_STMT(BPF_RET | BPF_K, 7),
+		},
+		.test = { { 74, 7 } },
+	},
+	{
+		.descr = "conditional jumps with X",
+		.insns = {
+			BPF_STMT(BPF_LDX | BPF_IMM, 5),
+			BPF_STMT(BPF_LD | BPF_IMM, 6),
+			BPF_JUMP(BPF_JMP | BPF_JGT | BPF_X, 0, 1, 0),
+			BPF_STMT(BPF_RET | BPF_K, 1),
+			BPF_JUMP(BPF_JMP | BPF_JGE | BPF_X, 0, 1, 0),
+			BPF_STMT(BPF_RET | BPF_K, 2),
+			BPF_STMT(BPF_MISC | BPF_TXA, 0),
+			BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_X, 0, 1, 0),
+			BPF_STMT(BPF_RET | BPF_K, 3),
+			BPF_JUMP(BPF_JMP | BPF_JSET | BPF_X, 0, 1, 0),
+			BPF_STMT(BPF_RET | BPF_K, 4),
+			BPF_STMT(BPF_LDX | BPF_IMM, 2),
+			BPF_JUMP(BPF_JMP | BPF_JSET | BPF_X, 0, 0, 1),
+			BPF_STMT(BPF_RET | BPF_K, 5),
+			BPF_JUMP(BPF_JMP | BPF_JGT | BPF_X, 0, 0, 1),
+			BPF_STMT(BPF_RET | BPF_K, 6),
+			BPF_STMT(BPF_RET | BPF_K, 7),
+		},
+		.test = { { 74, 6 } },
+	},
+	{
+		.descr = "LD_IND and LDX_MSH",
+		.insns = {
+			BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, 14),
+			BPF_STMT(BPF_LD | BPF_H | BPF_IND, 16),
+			BPF_STMT(BPF_ST, 1),
+			BPF_STMT(BPF_LDX | BPF_IMM, 14),
+			BPF_STMT(BPF_LD | BPF_B | BPF_IND, 9),
+			BPF_STMT(BPF_LDX | BPF_MEM, 1),
+			BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+			BPF_STMT(BPF_RET | BPF_A, 0),
+		},
+		.test = { { 74, 0x56 }, { 40, 0x56 }, { 30, 0 } },
+	},
+	{
+		.descr = "LDX_MSH beyond the end",
+		.insns = {
+			BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, 80),
+			BPF_STMT(BPF_RET | BPF_K, 1),
+		},
+		.test = { { 74, 0 } },
+	},
+	{
+		.descr = "LD_W_ABS at the end of the packet",
+		.insns = {
+			BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 70),
+			BPF_STMT(BPF_RET | BPF_A, 0),
+		},
+		.test = { { 74, 0x1030307 }, { 73, 0 }, { 72, 0 } },
+	},
+	{
+		.descr = "LD_ABS crossing the linear part",
+		.insns = {
+			BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 18),
+			BPF_STMT(BPF_MISC | BPF_TAX, 0),
+			BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 19),
+			BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+			BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 20),
+			BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+			BPF_STMT(BPF_RET | BPF_A, 0),
+		},
+		.flags = FLAG_SKB_FRAG,
+		.test = { { 74, 0x1c464040 }, { 22, 0x1c464040 }, { 21, 0 } },
+	},
+	{
+		.descr = "negative offsets",
+		.insns = {
+			BPF_STMT(BPF_LD | BPF_B | BPF_ABS, SKF_NET_OFF + 9),
+			BPF_STMT(BPF_MISC | BPF_TAX, 0),
+			BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_LL_OFF + 6),
+			BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+			BPF_STMT(BPF_RET | BPF_A, 0),
+		},
+		.test = { { 74, 0x258607 }, { 14, 0 } },
+	},
+	{
+		.descr = "negative offsets, nonlinear skb",
+		.insns = {
+			BPF_STMT(BPF_LD | BPF_B | BPF_ABS, SKF_NET_OFF + 2),
+			BPF_STMT(BPF_MISC | BPF_TAX, 0),
+			BPF_STMT(BPF_LD | BPF_B | BPF_ABS, SKF_NET_OFF + 9),
+			BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+			BPF_STMT(BPF_RET | BPF_A, 0),
+		},
+		.flags = FLAG_SKB_FRAG,
+		.test = { { 74, 0 } },
+	},
+	{
+		.descr = "LD_IND offset wrapping to 0",
+		.insns = {
+			BPF_STMT(BPF_LDX | BPF_IMM, 0xffffffff),
+			BPF_STMT(BPF_LD | BPF_B | BPF_IND, 1),
+			BPF_STMT(BPF_RET | BPF_A, 0),
+		},
+		.test = { { 74, 0xa } },
+	},
+	{
+		.descr = "LD_IND offset wrapping negative",
+		.insns = {
+			BPF_STMT(BPF_LDX | BPF_IMM, 0x7fffffff),
+			BPF_STMT(BPF_LD | BPF_H | BPF_IND, 0x7fffffff),
+			BPF_STMT(BPF_RET | BPF_K, 1),
+		},
+		.test = { { 74, 0 } },
+	},
+	{
+		.descr = "ancillary loads",
+		.insns = {
+			BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_PROTOCOL),
+			BPF_STMT(BPF_MISC | BPF_TAX, 0),
+			BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_MARK),
+			BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+			BPF_STMT(BPF_MISC | BPF_TAX, 0),
+			BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_QUEUE),
+			BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+			BPF_STMT(BPF_MISC | BPF_TAX, 0),
+			BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_RXHASH),
+			BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+			BPF_STMT(BPF_MISC | BPF_TAX, 0),
+			BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_IFINDEX),
+			BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+			BPF_STMT(BPF_MISC | BPF_TAX, 0),
+			BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_HATYPE),
+			BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+			BPF_STMT(BPF_RET | BPF_A, 0),
+		},
+		.test = { { 74, 0xeb5a5075 } },
+	},
+	{
+		.descr = "ifindex without a device",
+		.insns = {
+			BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_IFINDEX),
+			BPF_STMT(BPF_ALU | BPF_ADD | BPF_K, 1),
+			BPF_STMT(BPF_RET | BPF_A, 0),
+		},
+		.flags = FLAG_NO_DEV,
+		.test = { { 74, 0 } },
+	},
+	{
+		.descr = "hatype without a device",
+		.insns = {
+			BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_HATYPE),
+			BPF_STMT(BPF_ALU | BPF_ADD | BPF_K, 1),
+			BPF_STMT(BPF_RET | BPF_A, 0),
+		},
+		.flags = FLAG_NO_DEV,
+		.test = { { 74, 0 } },
+	},
+	{
+		.descr = "pkttype (interpreter only)",
+		.insns = {
+			BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_PKTTYPE),
+			BPF_STMT(BPF_RET | BPF_A, 0),
+		},
+		.test = { { 74, 3 } },
+	},
+	{
+		.descr = "LD_LEN and LDX_LEN",
+		.insns = {
+			BPF_STMT(BPF_LD | BPF_W | BPF_LEN, 0),
+			BPF_STMT(BPF_LDX | BPF_W | BPF_LEN, 0),
+			BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+			BPF_STMT(BPF_RET | BPF_A, 0),
+		},
+		.test = { { 74, 0x94 }, { 1, 2 } },
+	},
+	{
+		.descr = "RET_K 0 and ~0",
+		.insns = {
+			BPF_STMT(BPF_LD | BPF_IMM, 0),
+			BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0, 0, 1),
+			BPF_STMT(BPF_RET | BPF_K, 0xffffffff),
+			BPF_STMT(BPF_RET | BPF_K, 0),
+		},
+		.test = { { 74, 0xffffffff } },
+	},
+	{
+		.descr = "shifts by X",
+		.insns = {
+			BPF_STMT(BPF_LDX | BPF_IMM, 31),
+			BPF_STMT(BPF_LD | BPF_IMM, 1),
+			BPF_STMT(BPF_ALU | BPF_LSH | BPF_X, 0),
+			BPF_STMT(BPF_LDX | BPF_IMM, 17),
+			BPF_STMT(BPF_ALU | BPF_RSH | BPF_X, 0),
+			BPF_STMT(BPF_RET | BPF_A, 0),
+		},
+		.test = { { 74, 0x4000 } },
+	},
+	{
+		.descr = "current CPU",
+		.insns = {
+			BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_CPU),
+			BPF_STMT(BPF_RET | BPF_A, 0),
+		},
+		.flags = FLAG_NO_EXPECT,
+		.test = { { 74, 0 } },
+	},
+};
+
+static struct net_device test_dev;
+
+static struct sk_buff *populate_skb(const u8 *buf, unsigned int size,
+				   unsigned int flags)
+{
+	unsigned int headlen = size;
+	struct sk_buff *skb;
+
+	if (flags & FLAG_SKB_FRAG)
+		headlen = min_t(unsigned int, size, FRAG_HEADLEN);
+
+	skb = alloc_skb(MAX_DATA, GFP_KERNEL);
+	if (!skb)
+		return NULL;
+	memcpy(__skb_put(skb, headlen), buf, headlen);
+
+	if (size > headlen) {
+		struct page *page = alloc_page(GFP_KERNEL);
+
+		if (!page) {
+			kfree_skb(skb);
+			return NULL;
+		}
+		memcpy(page_address(page), buf + headlen, size - headlen);
+		skb_fill_page_desc(skb, 0, page, 0, size - headlen);
+		skb->len += size - headlen;
+		skb->data_len += size - headlen;
+		skb->truesize += PAGE_SIZE;
+	}
+
+	skb_reset_mac_header(skb);
+	skb_set_network_header(skb, ETH_HLEN);
+	skb->protocol = htons(ETH_P_IP);
+	skb->mark = SKB_MARK;
+	skb->queue_mapping = SKB_QUEUE;
+	skb->rxhash = SKB_RXHASH;
+	skb->pkt_type = SKB_PKT_TYPE;
+	skb->dev = (flags & FLAG_NO_DEV) ? NULL : &test_dev;
+
+	return skb;
+}
+
+/* Run the packet through both implementations, on the same CPU */
+static void run_filter(const struct sk_filter *fp, const struct sk_buff *skb,
+		       u32 *interp, u32 *jit)
+{
+	preempt_disable();
+	*interp = sk_run_filter(skb, fp->insns);
+	*jit = SK_RUN_FILTER(fp, skb);
+	preempt_enable();
+}
+
+static unsigned int probe_filter_length(const struct sock_filter *insns)
+{
+	int len;
+
+	for (len = MAX_INSNS - 1; len > 0; len--)
+		if (insns[len].code || insns[len].k)
+			break;
+	return len + 1;
+}
+
+static int __init test_corpus(unsigned int *jited)
+{
+	int i, j, err_cnt = 0;
+
+	for (i = 0; i < ARRAY_SIZE(tests); i++) {
+		struct bpf_test *t = &tests[i];
+		struct sock_fprog fprog = {
+			.len	= probe_filter_length(t->insns),
+			.filter	= t->insns,
+		};
+		struct sk_filter *fp;
+		int err;
+
+		err = sk_unattached_filter_create(&fp, &fprog);
+		if (err) {
+			pr_err("#%d %s: filter rejected (%d)\n",
+			       i, t->descr, err);
+			err_cnt++;
+			continue;
+		}
+		if (fp->bpf_func != sk_run_filter)
+			(*jited)++;
+
+		for (j = 0; j < MAX_SUBTESTS && t->test[j].data_size; j++) {
+			unsigned int size = t->test[j].data_size;
+			struct sk_buff *skb;
+			u32 interp, jit;
+
+			skb = populate_skb(test_packet, size, t->flags);
+			if (!skb) {
+				sk_unattached_filter_destroy(fp);
+				return -ENOMEM;
+			}
+			run_filter(fp, skb, &interp, &jit);
+			kfree_skb(skb);
+
+			if (!(t->flags & FLAG_NO_EXPECT) &&
+			    interp != t->test[j].result) {
+				pr_err("#%d %s, %u bytes: interpreter returned %u, expected %u\n",
+				       i, t->descr, size, interp,
+				       t->test[j].result);
+				err_cnt++;
+			}
+			if (jit != interp) {
+				pr_err("#%d %s, %u bytes: JIT returned %u, interpreter %u\n",
+				       i, t->descr, size, jit, interp);
+				err_cnt++;
+			}
+		}
+
+		sk_unattached_filter_destroy(fp);
+	}
+
+	return err_cnt;
+}
+
+/*
+ * Random programs: every scratch word is written first, so that no
+ * result depends on uninitialised memory, then come up to
+ * RANDOM_MAX_BODY random instructions and a final RET A.  Shifts stay
+ * below 32 bits, beyond which C leaves the result undefined.
+ */
+#define RANDOM_MAX_BODY		48
+#define RANDOM_MAX_INSNS	(2 * BPF_MEMWORDS + RANDOM_MAX_BODY + 1)
+#define RANDOM_PACKETS		4
+
+static struct rnd_state rnd;
+
+static u32 __init rand_below(u32 n)
+{
+	return prandom32(&rnd) % n;
+}
+
+/* Small constants catch more corner cases than uniform 32 bit ones */
+static u32 __init rand_k(void)
+{
+	switch (rand_below(4)) {
+	case 0:
+		return rand_below(16);
+	case 1:
+		return rand_below(MAX_DATA + 8);
+	case 2:
+		return -rand_below(16);
+	default:
+		return prandom32(&rnd);
+	}
+}
+
+static u32 __init rand_ld_abs_k(void)
+{
+	static const u8 anc[] = {
+		SKF_AD_PROTOCOL, SKF_AD_IFINDEX, SKF_AD_MARK, SKF_AD_QUEUE,
+		SKF_AD_HATYPE, SKF_AD_RXHASH, SKF_AD_CPU,
+	};
+
+	switch (rand_below(20)) {
+	case 0 ... 2:
+		return SKF_NET_OFF + rand_below(MAX_DATA);
+	case 3 ... 4:
+		return SKF_LL_OFF + rand_below(MAX_DATA);
+	case 5:
+		return SKF_AD_OFF + anc[rand_below(ARRAY_SIZE(anc))];
+	default:
+		return rand_below(MAX_DATA + 8);
+	}
+}
+
+static void __init gen_insn(struct sock_filter *insns, int pc, int len)
+{
+	static const u16 size[] = { BPF_W, BPF_H, BPF_B };
+	static const u16 alu[] = {
+		BPF_ADD, BPF_SUB, BPF_MUL, BPF_DIV, BPF_AND, BPF_OR,
+		BPF_LSH, BPF_RSH, BPF_NEG,
+	};
+	/* X may hold anything here, so no shifts by X */
+	static const u16 alu_x[] = {
+		BPF_ADD, BPF_SUB, BPF_MUL, BPF_DIV, BPF_AND, BPF_OR,
+	};
+	static const u16 jmp[] = { BPF_JEQ, BPF_JGT, BPF_JGE, BPF_JSET };
+	struct sock_filter *insn = &insns[pc];
+	int left = len - pc - 1;	/* instructions after this one */
+	u16 op;
+
+	memset(insn, 0, sizeof(*insn));
+	switch (rand_below(12)) {
+	case 0:
+	case 1:
+		insn->code = BPF_LD | size[rand_below(3)] | BPF_ABS;
+		insn->k = rand_ld_abs_k();
+		break;
+	case 2:
+		insn->code = BPF_LD | size[rand_below(3)] | BPF_IND;
+		insn->k = rand_k();
+		break;
+	case 3:
+		insn->code = BPF_LDX | BPF_B | BPF_MSH;
+		insn->k = rand_below(MAX_DATA + 4);
+		break;
+	case 4:
+		insn->code = (rand_below(2) ? BPF_LD : BPF_LDX) |
+			     (rand_below(2) ? BPF_IMM : BPF_W | BPF_LEN);
+		insn->k = rand_k();
+		break;
+	case 5:
+		insn->code = (rand_below(2) ? BPF_LD : BPF_LDX) | BPF_MEM;
+		insn->k = rand_below(BPF_MEMWORDS);
+		break;
+	case 6:
+		insn->code = rand_below(2) ? BPF_ST : BPF_STX;
+		insn->k = rand_below(BPF_MEMWORDS);
+		break;
+	case 7:
+		op = alu[rand_below(ARRAY_SIZE(alu))];
+		insn->code = BPF_ALU | op | BPF_K;
+		insn->k = rand_k();
+		if (op == BPF_DIV && !insn->k)
+			insn->k = 1;
+		if (op == BPF_LSH || op == BPF_RSH)
+			insn->k &= 31;
+		break;
+	case 8:
+		insn->code = BPF_ALU | alu_x[rand_below(ARRAY_SIZE(alu_x))] |
+			     BPF_X;
+		break;
+	case 9:
+	case 10:
+		if (!rand_below(8)) {
+			insn->code = BPF_JMP | BPF_JA;
+			insn->k = rand_below(left);
+			break;
+		}
+		insn->code = BPF_JMP | jmp[rand_below(ARRAY_SIZE(jmp))] |
+			     (rand_below(2) ? BPF_X : BPF_K);
+		insn->k = rand_k();
+		insn->jt = rand_below(min(left, 256));
+		insn->jf = rand_below(min(left, 256));
+		break;
+	default:
+		if (!rand_below(8)) {
+			insn->code = BPF_RET | BPF_K;
+			insn->k = rand_below(2) ? 0 : rand_k();
+		} else {
+			insn->code = BPF_MISC |
+				     (rand_below(2) ? BPF_TAX : BPF_TXA);
+		}
+		break;
+	}
+}
+
+static int __init gen_program(struct sock_filter *insns)
+{
+	int len = 2 * BPF_MEMWORDS + 1 + rand_below(RANDOM_MAX_BODY) + 1;
+	int pc, i;
+
+	for (i = 0, pc = 0; i < BPF_MEMWORDS; i++) {
+		struct sock_filter ld = BPF_STMT(BPF_LD | BPF_IMM, 0);
+		struct sock_filter st = BPF_STMT(BPF_ST, i);
+
+		ld.k = rand_k();
+		insns[pc++] = ld;
+		insns[pc++] = st;
+	}
+	while (pc < len - 1)
+		gen_insn(insns, pc++, len);
+	insns[pc].code = BPF_RET | BPF_A;
+	insns[pc].jt = insns[pc].jf = insns[pc].k = 0;
+
+	return len;
+}
+
+static void __init dump_program(const struct sock_filter *insns, int len,
+				const u8 *data, unsigned int size,
+				unsigned int flags)
+{
+	int i;
+
+	for (i = 0; i < len; i++)
+		pr_err("  { 0x%02x, %u, %u, 0x%08x },\n", insns[i].code,
+		       insns[i].jt, insns[i].jf, insns[i].k);
+	pr_err("packet of %u bytes, flags 0x%x:\n", size, flags);
+	print_hex_dump(KERN_ERR, "  ", DUMP_PREFIX_OFFSET, 16, 1,
+		       data, size, false);
+}
+
+static int __init test_random(unsigned int *jited)
+{
+	static struct sock_filter insns[RANDOM_MAX_INSNS];
+	static struct sock_filter prog[RANDOM_MAX_INSNS];
+	static u8 data[MAX_DATA];
+	int run, i, j, err_cnt = 0;
+
+	prandom32_seed(&rnd, seed);
+
+	for (run = 0; run < random_runs; run++) {
+		int len = gen_program(insns);
+		struct sock_fprog fprog = { .len = len, .filter = prog };
+		struct sk_filter *fp;
+		int err;
+
+		/* sk_chk_filter() rewrites the copy, keep the original */
+		memcpy(prog, insns, len * sizeof(*insns));
+		err = sk_unattached_filter_create(&fp, &fprog);
+		if (err) {
+			pr_err("random program %d rejected (%d)\n", run, err);
+			dump_program(insns, len, NULL, 0, 0);
+			err_cnt++;
+			continue;
+		}
+		if (fp->bpf_func != sk_run_filter)
+			(*jited)++;
+
+		for (i = 0; i < RANDOM_PACKETS; i++) {
+			unsigned int size = rand_below(MAX_DATA + 1);
+			unsigned int flags = rand_below(4) &
+					     (FLAG_SKB_FRAG | FLAG_NO_DEV);
+			struct sk_buff *skb;
+			u32 interp, jit;
+
+			for (j = 0; j < size; j++)
+				data[j] = prandom32(&rnd);
+			skb = populate_skb(data, size, flags);
+			if (!skb) {
+				sk_unattached_filter_destroy(fp);
+				return -ENOMEM;
+			}
+			run_filter(fp, skb, &interp, &jit);
+			kfree_skb(skb);
+
+			if (jit != interp) {
+				pr_err("random program %d: JIT returned %u, interpreter %u\n",
+				       run, jit, interp);
+				dump_program(insns, len, data, size, flags);
+				err_cnt++;
+				break;
+			}
+		}
+
+		sk_unattached_filter_destroy(fp);
+	}
+
+	return err_cnt;
+}
+
+static int __init test_bpf_init(void)
+{
+	unsigned int jited = 0, random_jited = 0;
+	int err_corpus, err_random;
+
+	test_dev.ifindex = SKB_DEV_IFINDEX;
+	test_dev.type = SKB_DEV_TYPE;
+
+	err_corpus = test_corpus(&jited);
+	if (err_corpus < 0)
+		return err_corpus;
+	err_random = test_random(&random_jited);
+	if (err_random < 0)
+		return err_random;
+
+	pr_info("corpus: %zu filters, %u JIT compiled, %d failures\n",
+		ARRAY_SIZE(tests), jited, err_corpus);
+	pr_info("random: %u programs (seed %u), %u JIT compiled, %d failures\n",
+		random_runs, seed, random_jited, err_random);
+	if (!jited && !random_jited)
+		pr_info("nothing was JIT compiled, only the interpreter was checked\n");
+
+	return err_corpus || err_random ? -EINVAL : 0;
+}
+
+static void __exit test_bpf_exit(void)
+{
+}
+
+module_init(test_bpf_init);
+module_exit(test_bpf_exit);
+MODULE_LICENSE("GPL");
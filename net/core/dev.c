@@ -133,6 +133,7 @@
 #include <linux/pci.h>
 #include <linux/inetdevice.h>
 #include <linux/cpu_rmap.h>
+#include <net/busy_poll.h>
 
 #include "net-sysfs.h"
 
@@ -1517,6 +1518,8 @@ static inline int deliver_skb(struct sk_buff *skb,
 			      struct packet_type *pt_prev,
 			      struct net_device *orig_dev)
 {
+	if (unlikely(skb_orphan_frags(skb, GFP_ATOMIC)))
+		return -ENOMEM;
 	atomic_inc(&skb->users);
 	return pt_prev->func(skb, skb->dev, pt_prev, orig_dev);
 }
@@ -1573,8 +1576,12 @@ static void dev_queue_xmit_nit(struct sk_buff *skb, struct net_device *dev)
 			pt_prev = ptype;
 		}
 	}
-	if (pt_prev)
-		pt_prev->func(skb2, skb->dev, pt_prev, skb->dev);
+	if (pt_prev) {
+		if (unlikely(skb_orphan_frags(skb2, GFP_ATOMIC)))
+			kfree_skb(skb2);
+		else
+			pt_prev->func(skb2, skb->dev, pt_prev, skb->dev);
+	}
 	rcu_read_unlock();
 }
 
@@ -2000,25 +2007,6 @@ static int dev_gso_segment(struct sk_buff *skb, int features)
 	return 0;
 }
 
-/*
- * Try to orphan skb early, right before transmission by the device.
- * We cannot orphan skb if tx timestamp is requested or the sk-reference
- * is needed on driver level for other reasons, e.g. see net/can/raw.c
- */
-static inline void skb_orphan_try(struct sk_buff *skb)
-{
-	struct sock *sk = skb->sk;
-
-	if (sk && !skb_shinfo(skb)->tx_flags) {
-		/* skb_tx_hash() wont be able to get sk.
-		 * We copy sk_hash into skb->rxhash
-		 */
-		if (!skb->rxhash)
-			skb->rxhash = sk->sk_hash;
-		skb_orphan(skb);
-	}
-}
-
 static bool can_checksum_protocol(unsigned long features, __be16 protocol)
 {
 	return ((features & NETIF_F_GEN_CSUM) ||
@@ -2102,8 +2090,6 @@ int dev_hard_start_xmit(struct sk_buff *skb, struct net_device *dev,
 		if (!list_empty(&ptype_all))
 			dev_queue_xmit_nit(skb, dev);
 
-		skb_orphan_try(skb);
-
 		features = netif_skb_features(skb);
 
 		if (vlan_tx_tag_present(skb) &&
@@ -2169,7 +2155,7 @@ gso:
 			return rc;
 		}
 		txq_trans_update(txq);
-		if (unlikely(netif_tx_queue_stopped(txq) && skb->next))
+		if (unlikely(netif_xmit_stopped(txq) && skb->next))
 			return NETDEV_TX_BUSY;
 	} while (skb->next);
 
@@ -2443,7 +2429,7 @@ int dev_queue_xmit(struct sk_buff *skb)
 
 			HARD_TX_LOCK(dev, txq, cpu);
 
-			if (!netif_tx_queue_stopped(txq)) {
+			if (!netif_xmit_stopped(txq)) {
 				__this_cpu_inc(xmit_recursion);
 				rc = dev_hard_start_xmit(skb, dev, txq);
 				__this_cpu_dec(xmit_recursion);
@@ -3204,8 +3190,12 @@ ncls:
 	}
 
 	if (pt_prev) {
+		/* Local delivery may hold on to the data indefinitely */
+		if (unlikely(skb_orphan_frags(skb, GFP_ATOMIC)))
+			goto drop;
 		ret = pt_prev->func(skb, skb->dev, pt_prev, orig_dev);
 	} else {
+drop:
 		atomic_long_inc(&skb->dev->rx_dropped);
 		kfree_skb(skb);
 		/* Jamal, now you will not able to escape explaining
@@ -3307,6 +3297,11 @@ static int napi_gro_complete(struct sk_buff *skb)
 		goto out;
 	}
 
+	/* Tunnel handlers leave the network header at the innermost
+	 * packet, completion starts again from the outermost one.
+	 */
+	skb_reset_network_header(skb);
+
 	rcu_read_lock();
 	list_for_each_entry_rcu(ptype, head, list) {
 		if (ptype->type != type || ptype->dev || !ptype->gro_complete)
@@ -3369,6 +3364,7 @@ enum gro_result dev_gro_receive(struct napi_struct *napi, struct sk_buff *skb)
 		NAPI_GRO_CB(skb)->same_flow = 0;
 		NAPI_GRO_CB(skb)->flush = 0;
 		NAPI_GRO_CB(skb)->free = 0;
+		NAPI_GRO_CB(skb)->encap_mark = 0;
 
 		pp = ptype->gro_receive(&napi->gro_list, skb);
 		break;
@@ -3493,6 +3489,7 @@ EXPORT_SYMBOL(skb_gro_reset_offset);
 
 gro_result_t napi_gro_receive(struct napi_struct *napi, struct sk_buff *skb)
 {
+	skb_mark_napi_id(skb, napi);
 	skb_gro_reset_offset(skb);
 
 	return napi_skb_finish(__napi_gro_receive(napi, skb), skb);
@@ -3594,6 +3591,7 @@ gro_result_t napi_gro_frags(struct napi_struct *napi)
 	if (!skb)
 		return GRO_DROP;
 
+	skb_mark_napi_id(skb, napi);
 	return napi_frags_finish(napi, skb, __napi_gro_receive(napi, skb));
 }
 EXPORT_SYMBOL(napi_gro_frags);
@@ -3728,6 +3726,147 @@ void napi_complete(struct napi_struct *n)
 }
 EXPORT_SYMBOL(napi_complete);
 
+#ifdef CONFIG_NET_RX_BUSY_POLL
+/* NAPI contexts by id, for busy polling sockets to find theirs */
+#define NAPI_HASH_BITS	8
+static struct hlist_head napi_hash[1 << NAPI_HASH_BITS];
+static DEFINE_SPINLOCK(napi_hash_lock);
+static unsigned int napi_gen_id;
+
+static inline struct hlist_head *napi_hash_bucket(unsigned int napi_id)
+{
+	return &napi_hash[napi_id & ((1 << NAPI_HASH_BITS) - 1)];
+}
+
+/* must be called under rcu_read_lock() or napi_hash_lock */
+static struct napi_struct *napi_by_id(unsigned int napi_id)
+{
+	struct napi_struct *napi;
+	struct hlist_node *pos;
+
+	hlist_for_each_entry_rcu(napi, pos, napi_hash_bucket(napi_id),
+				 napi_hash_node)
+		if (napi->napi_id == napi_id)
+			return napi;
+	return NULL;
+}
+
+static void napi_hash_add(struct napi_struct *napi)
+{
+	spin_lock(&napi_hash_lock);
+	/* 0 means no id; after a wrap, skip ids still in use */
+	do {
+		if (unlikely(++napi_gen_id == 0))
+			napi_gen_id = 1;
+	} while (napi_by_id(napi_gen_id));
+	napi->napi_id = napi_gen_id;
+	hlist_add_head_rcu(&napi->napi_hash_node,
+			   napi_hash_bucket(napi->napi_id));
+	spin_unlock(&napi_hash_lock);
+}
+
+/* Returns true if a busy poller may still be looking at @napi */
+static bool napi_hash_del(struct napi_struct *napi)
+{
+	bool hashed;
+
+	spin_lock(&napi_hash_lock);
+	hashed = !hlist_unhashed(&napi->napi_hash_node);
+	if (hashed)
+		hlist_del_init_rcu(&napi->napi_hash_node);
+	spin_unlock(&napi_hash_lock);
+	return hashed;
+}
+
+/**
+ *	sk_busy_loop - poll the device queue of a socket for data
+ *	@sk: socket, not locked, whose receive queue is empty
+ *	@nonblock: poll once instead of for up to sk->sk_ll_usec
+ *
+ *	Calls the poll routine of the NAPI context @sk last received data
+ *	on, the way net_rx_action() would, until data shows up on the
+ *	receive queue of @sk or the time is up.  A NAPI context already
+ *	scheduled for the softirq is left alone.  Returns true if the
+ *	receive queue is no longer empty.
+ */
+bool sk_busy_loop(struct sock *sk, int nonblock)
+{
+	unsigned long end_time = !nonblock ? sk_busy_loop_end_time(sk) : 0;
+	struct napi_struct *napi;
+	bool owned = false;
+	void *have;
+	int work;
+
+	rcu_read_lock();
+	napi = napi_by_id(sk->sk_napi_id);
+	if (!napi)
+		goto out;
+
+	/* BHs are only disabled around each ->poll(), so softirqs queued
+	 * meanwhile still run; preemption stays off while the NAPI context
+	 * may be ours, so it is never left owned by a sleeping task.
+	 */
+	preempt_disable();
+	do {
+		local_bh_disable();
+		if (!owned) {
+			if (napi_disable_pending(napi) ||
+			    test_and_set_bit(NAPI_STATE_SCHED, &napi->state)) {
+				local_bh_enable();
+				goto next;
+			}
+			/* Not on any poll_list; napi_complete() will
+			 * list_del() it all the same.
+			 */
+			INIT_LIST_HEAD(&napi->poll_list);
+		}
+
+		have = netpoll_poll_lock(napi);
+		work = napi->poll(napi, BUSY_POLL_BUDGET);
+		trace_napi_poll(napi);
+		netpoll_poll_unlock(have);
+
+		/* Short of the budget, the driver has completed and
+		 * re-enabled its interrupt; otherwise it is still ours.
+		 */
+		owned = work == BUSY_POLL_BUDGET;
+		if (work > 0)
+			NET_ADD_STATS_BH(sock_net(sk),
+					 LINUX_MIB_BUSYPOLLRXPACKETS, work);
+		local_bh_enable();
+next:
+		if (nonblock || !skb_queue_empty(&sk->sk_receive_queue))
+			break;
+		cpu_relax();
+	} while (!need_resched() && !signal_pending(current) &&
+		 !local_softirq_pending() && !busy_loop_timeout(end_time));
+
+	if (owned) {
+		/* Hand the rest of the work back to the softirq */
+		local_bh_disable();
+		if (unlikely(napi_disable_pending(napi)))
+			napi_complete(napi);
+		else
+			__napi_schedule(napi);
+		local_bh_enable();
+	}
+	preempt_enable();
+out:
+	rcu_read_unlock();
+	return !skb_queue_empty(&sk->sk_receive_queue);
+}
+EXPORT_SYMBOL(sk_busy_loop);
+#else
+static inline void napi_hash_add(struct napi_struct *napi)
+{
+}
+
+static inline bool napi_hash_del(struct napi_struct *napi)
+{
+	return false;
+}
+#endif /* CONFIG_NET_RX_BUSY_POLL */
+
 void netif_napi_add(struct net_device *dev, struct napi_struct *napi,
 		    int (*poll)(struct napi_struct *, int), int weight)
 {
@@ -3744,6 +3883,7 @@ void netif_napi_add(struct net_device *dev, struct napi_struct *napi,
 	napi->poll_owner = -1;
 #endif
 	set_bit(NAPI_STATE_SCHED, &napi->state);
+	napi_hash_add(napi);
 }
 EXPORT_SYMBOL(netif_napi_add);
 
@@ -3751,6 +3891,8 @@ void netif_napi_del(struct napi_struct *napi)
 {
 	struct sk_buff *skb, *next;
 
+	if (napi_hash_del(napi))
+		synchronize_net();
 	list_del_init(&napi->dev_list);
 	napi_free_frags(napi);
 
@@ -5330,6 +5472,9 @@ static void netdev_init_one_queue(struct net_device *dev,
 	queue->xmit_lock_owner = -1;
 	netdev_queue_numa_node_write(queue, NUMA_NO_NODE);
 	queue->dev = dev;
+#ifdef CONFIG_BQL
+	dql_init(&queue->dql, HZ);
+#endif
 }
 
 static int netif_alloc_netdev_queues(struct net_device *dev)
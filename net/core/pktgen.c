@@ -156,6 +156,7 @@
 #include <linux/wait.h>
 #include <linux/etherdevice.h>
 #include <linux/kthread.h>
+#include <linux/jhash.h>
 #include <net/net_namespace.h>
 #include <net/checksum.h>
 #include <net/ipv6.h>
@@ -172,7 +173,7 @@
 #include <asm/dma.h>
 #include <asm/div64.h>		/* do_div */
 
-#define VERSION	"2.74"
+#define VERSION	"2.75"
 #define IP_NAME_SZ 32
 #define MAX_MPLS_LABELS 16 /* This is the max label stack depth */
 #define MPLS_STACK_BOTTOM htonl(0x00000100)
@@ -446,6 +447,7 @@ static void pktgen_reset_all_threads(void);
 static void pktgen_stop_all_threads_ifs(void);
 
 static void pktgen_stop(struct pktgen_thread *t);
+static void pktgen_rx_device_gone(struct net_device *dev);
 static void pktgen_clear_counters(struct pktgen_dev *pkt_dev);
 
 static unsigned int scan_ip6(const char *s, char ip[16]);
@@ -1990,6 +1992,7 @@ static int pktgen_device_event(struct notifier_block *unused,
 
 	case NETDEV_UNREGISTER:
 		pktgen_mark_device(dev->name);
+		pktgen_rx_device_gone(dev);
 		break;
 	}
 
@@ -3478,7 +3481,7 @@ static void pktgen_xmit(struct pktgen_dev *pkt_dev)
 
 	__netif_tx_lock_bh(txq);
 
-	if (unlikely(netif_tx_queue_frozen_or_stopped(txq))) {
+	if (unlikely(netif_xmit_frozen_or_stopped(txq))) {
 		ret = NETDEV_TX_BUSY;
 		pkt_dev->last_ok = 0;
 		goto unlock;
@@ -3842,6 +3845,380 @@ static int pktgen_remove_device(struct pktgen_thread *t,
 	return 0;
 }
 
+/*
+ * Receive side.
+ *
+ * When enabled, a packet handler recognises pktgen packets (UDP over
+ * IPv4 or IPv6 carrying struct pktgen_hdr) arriving on one device, or on
+ * all of them, and accounts them per flow: packets, bytes, loss and
+ * reordering derived from the sequence numbers, and the one-way latency
+ * from the transmit timestamp as a log2 histogram.  Latency is only
+ * meaningful when sender and receiver clocks agree, e.g. when both ends
+ * run on the same host.  Results are read from /proc/net/pktgen/pgrx.
+ *
+ * Sequence numbers are kept per pkt_dev, but the packet does not say
+ * which pkt_dev sent it, so a flow is keyed on the source address and
+ * the UDP ports.  Loss and reordering are only right when each pkt_dev
+ * sends with one source address and port pair of its own: ranges
+ * (src_min/src_max, udp_src_min/udp_src_max, ...) spread one sequence
+ * over many flows and report gaps as loss.
+ */
+#define PGRX		"pgrx"
+#define PG_RX_FLOWS	128
+#define PG_RX_HIST	32	/* slot i counts latencies below 2^i usec */
+
+struct pktgen_rx_flow {
+	spinlock_t lock;
+	bool used;
+	struct in6_addr saddr;	/* IPv4 senders are kept v4-mapped */
+	__be16 sport;
+	__be16 dport;
+	u32 next_seq;
+	u64 packets;
+	u64 bytes;
+	u64 lost;
+	u64 reordered;
+	ktime_t first;
+	ktime_t last;
+	u64 lat_sum;		/* usec */
+	u64 lat_min;
+	u64 lat_max;
+	u64 hist[PG_RX_HIST];
+};
+
+static struct pktgen_rx_flow *pg_rx_flows;
+static atomic_t pg_rx_overflow;		/* packets from senders not tracked */
+static struct net_device *pg_rx_dev;	/* NULL means all devices */
+static bool pg_rx_enabled;
+
+static void pktgen_rx_account(struct pktgen_rx_flow *f,
+			      const struct pktgen_hdr *pgh, unsigned int len)
+{
+	u32 seq = ntohl(pgh->seq_num);
+	struct timeval now;
+	s64 lat;
+	int slot;
+
+	do_gettimeofday(&now);
+	lat = (s64)(now.tv_sec - ntohl(pgh->tv_sec)) * USEC_PER_SEC +
+	      (now.tv_usec - (s32)ntohl(pgh->tv_usec));
+	if (lat < 0)
+		lat = 0;
+	slot = min_t(int, fls64(lat), PG_RX_HIST - 1);
+
+	if (f->packets == 0) {
+		f->first = ktime_now();
+		f->lat_min = lat;
+		f->next_seq = seq + 1;
+	} else if ((s32)(seq - f->next_seq) < 0) {
+		/* Counted as lost when the later packets overtook it */
+		f->reordered++;
+		if (f->lost)
+			f->lost--;
+	} else {
+		f->lost += seq - f->next_seq;
+		f->next_seq = seq + 1;
+	}
+
+	f->packets++;
+	f->bytes += len;
+	f->last = ktime_now();
+	f->lat_sum += lat;
+	if (lat < f->lat_min)
+		f->lat_min = lat;
+	if (lat > f->lat_max)
+		f->lat_max = lat;
+	f->hist[slot]++;
+}
+
+static struct pktgen_rx_flow *pktgen_rx_find_flow(const struct in6_addr *saddr,
+						   const struct udphdr *uh)
+{
+	u32 ports = (__force u32)uh->source << 16 | (__force u32)uh->dest;
+	unsigned int h = jhash_2words(jhash2(saddr->s6_addr32, 4, 0), ports,
+				      0) % PG_RX_FLOWS;
+	unsigned int i;
+
+	for (i = 0; i < PG_RX_FLOWS; i++) {
+		struct pktgen_rx_flow *f = &pg_rx_flows[(h + i) % PG_RX_FLOWS];
+
+		spin_lock(&f->lock);
+		if (!f->used) {
+			f->used = true;
+			ipv6_addr_copy(&f->saddr, saddr);
+			f->sport = uh->source;
+			f->dport = uh->dest;
+			return f;
+		}
+		if (ipv6_addr_equal(&f->saddr, saddr) &&
+		    f->sport == uh->source && f->dport == uh->dest)
+			return f;
+		spin_unlock(&f->lock);
+	}
+	return NULL;
+}
+
+static int pktgen_rx_rcv(struct sk_buff *skb, struct net_device *dev,
+			 struct packet_type *pt, struct net_device *orig_dev)
+{
+	const struct pktgen_hdr *pgh;
+	struct pktgen_hdr _pgh;
+	const struct udphdr *uh;
+	struct udphdr _uh;
+	struct pktgen_rx_flow *f;
+	struct in6_addr saddr;
+	unsigned int off;
+
+	if (skb->protocol == htons(ETH_P_IP)) {
+		const struct iphdr *iph;
+		struct iphdr _iph;
+
+		iph = skb_header_pointer(skb, 0, sizeof(_iph), &_iph);
+		if (iph == NULL || iph->ihl < 5 ||
+		    iph->protocol != IPPROTO_UDP ||
+		    (iph->frag_off & htons(IP_OFFSET)))
+			goto out;
+		off = iph->ihl * 4;
+		ipv6_addr_set_v4mapped(iph->saddr, &saddr);
+	} else {
+		const struct ipv6hdr *ip6h;
+		struct ipv6hdr _ip6h;
+
+		ip6h = skb_header_pointer(skb, 0, sizeof(_ip6h), &_ip6h);
+		if (ip6h == NULL || ip6h->nexthdr != IPPROTO_UDP)
+			goto out;
+		off = sizeof(*ip6h);
+		ipv6_addr_copy(&saddr, &ip6h->saddr);
+	}
+
+	uh = skb_header_pointer(skb, off, sizeof(_uh), &_uh);
+	pgh = skb_header_pointer(skb, off + sizeof(struct udphdr),
+				 sizeof(_pgh), &_pgh);
+	if (uh == NULL || pgh == NULL ||
+	    pgh->pgh_magic != htonl(PKTGEN_MAGIC))
+		goto out;
+
+	f = pktgen_rx_find_flow(&saddr, uh);
+	if (f == NULL) {
+		atomic_inc(&pg_rx_overflow);
+		goto out;
+	}
+	pktgen_rx_account(f, pgh, skb->len);
+	spin_unlock(&f->lock);
+out:
+	consume_skb(skb);
+	return NET_RX_SUCCESS;
+}
+
+static struct packet_type pktgen_rx_pt[] __read_mostly = {
+	{
+		.type = cpu_to_be16(ETH_P_IP),
+		.func = pktgen_rx_rcv,
+	},
+	{
+		.type = cpu_to_be16(ETH_P_IPV6),
+		.func = pktgen_rx_rcv,
+	},
+};
+
+static void pktgen_rx_reset(void)
+{
+	int i;
+
+	if (pg_rx_flows == NULL)
+		return;
+
+	for (i = 0; i < PG_RX_FLOWS; i++) {
+		struct pktgen_rx_flow *f = &pg_rx_flows[i];
+
+		spin_lock_bh(&f->lock);
+		memset((void *)f + sizeof(f->lock), 0,
+		       sizeof(*f) - sizeof(f->lock));
+		spin_unlock_bh(&f->lock);
+	}
+	atomic_set(&pg_rx_overflow, 0);
+}
+
+/* Called with pktgen_thread_lock held */
+static void pktgen_rx_disable(void)
+{
+	int i;
+
+	if (!pg_rx_enabled)
+		return;
+
+	for (i = 0; i < ARRAY_SIZE(pktgen_rx_pt); i++)
+		dev_remove_pack(&pktgen_rx_pt[i]);
+	if (pg_rx_dev)
+		dev_put(pg_rx_dev);
+	pg_rx_dev = NULL;
+	pg_rx_enabled = false;
+}
+
+/* Called with pktgen_thread_lock held */
+static int pktgen_rx_enable(const char *ifname)
+{
+	struct net_device *dev = NULL;
+	int i;
+
+	if (pg_rx_flows == NULL) {
+		pg_rx_flows = vzalloc(PG_RX_FLOWS * sizeof(*pg_rx_flows));
+		if (pg_rx_flows == NULL)
+			return -ENOMEM;
+		for (i = 0; i < PG_RX_FLOWS; i++)
+			spin_lock_init(&pg_rx_flows[i].lock);
+	}
+
+	if (strcmp(ifname, "all") != 0) {
+		dev = dev_get_by_name(&init_net, ifname);
+		if (dev == NULL)
+			return -ENODEV;
+	}
+
+	pktgen_rx_disable();
+	pktgen_rx_reset();
+
+	pg_rx_dev = dev;
+	for (i = 0; i < ARRAY_SIZE(pktgen_rx_pt); i++) {
+		pktgen_rx_pt[i].dev = dev;
+		dev_add_pack(&pktgen_rx_pt[i]);
+	}
+	pg_rx_enabled = true;
+	return 0;
+}
+
+static void pktgen_rx_device_gone(struct net_device *dev)
+{
+	mutex_lock(&pktgen_thread_lock);
+	if (pg_rx_enabled && pg_rx_dev == dev)
+		pktgen_rx_disable();
+	mutex_unlock(&pktgen_thread_lock);
+}
+
+static void pktgen_rx_show_flow(struct seq_file *seq,
+				const struct pktgen_rx_flow *f)
+{
+	u64 usec = ktime_to_us(ktime_sub(f->last, f->first));
+	u64 pps = 0, mbps = 0, avg;
+	int i;
+
+	if (ipv6_addr_v4mapped(&f->saddr))
+		seq_printf(seq, "Flow %pI4", &f->saddr.s6_addr32[3]);
+	else
+		seq_printf(seq, "Flow %pI6c", &f->saddr);
+	seq_printf(seq, " udp %u->%u:\n", ntohs(f->sport), ntohs(f->dport));
+
+	if (usec) {
+		pps = div64_u64(f->packets * USEC_PER_SEC, usec);
+		mbps = div64_u64(f->bytes * 8, usec);
+	}
+	seq_printf(seq, "  Received: %llu pkts %llu bytes in %llu usec, "
+		   "%llupps %lluMb/sec\n",
+		   (unsigned long long)f->packets,
+		   (unsigned long long)f->bytes,
+		   (unsigned long long)usec,
+		   (unsigned long long)pps,
+		   (unsigned long long)mbps);
+	seq_printf(seq, "  Lost: %llu  Reordered: %llu  Next seq: %u\n",
+		   (unsigned long long)f->lost,
+		   (unsigned long long)f->reordered, f->next_seq);
+
+	avg = div64_u64(f->lat_sum, f->packets);
+	seq_printf(seq, "  Latency (usec): min %llu avg %llu max %llu\n",
+		   (unsigned long long)f->lat_min,
+		   (unsigned long long)avg,
+		   (unsigned long long)f->lat_max);
+
+	seq_puts(seq, "  Histogram (usec):");
+	for (i = 0; i < PG_RX_HIST; i++) {
+		if (!f->hist[i])
+			continue;
+		seq_printf(seq, " <%llu:%llu", 1ULL << i,
+			   (unsigned long long)f->hist[i]);
+	}
+	seq_puts(seq, "\n");
+}
+
+static int pgrx_show(struct seq_file *seq, void *v)
+{
+	int i;
+
+	mutex_lock(&pktgen_thread_lock);
+	if (!pg_rx_enabled)
+		seq_puts(seq, "Receive: disabled\n");
+	else
+		seq_printf(seq, "Receive: %s\n",
+			   pg_rx_dev ? pg_rx_dev->name : "all");
+	seq_printf(seq, "Untracked: %d\n", atomic_read(&pg_rx_overflow));
+
+	for (i = 0; pg_rx_flows && i < PG_RX_FLOWS; i++) {
+		struct pktgen_rx_flow *f = &pg_rx_flows[i], snap;
+
+		spin_lock_bh(&f->lock);
+		snap = *f;
+		spin_unlock_bh(&f->lock);
+		if (snap.packets)
+			pktgen_rx_show_flow(seq, &snap);
+	}
+	mutex_unlock(&pktgen_thread_lock);
+	return 0;
+}
+
+static ssize_t pgrx_write(struct file *file, const char __user *buf,
+			  size_t count, loff_t *ppos)
+{
+	int err = 0;
+	char data[128];
+
+	if (!capable(CAP_NET_ADMIN)) {
+		err = -EPERM;
+		goto out;
+	}
+
+	if (count == 0)
+		goto out;
+	if (count > sizeof(data))
+		count = sizeof(data);
+
+	if (copy_from_user(data, buf, count)) {
+		err = -EFAULT;
+		goto out;
+	}
+	data[count - 1] = 0;	/* Make string */
+
+	mutex_lock(&pktgen_thread_lock);
+	if (!strncmp(data, "rx ", 3))
+		err = pktgen_rx_enable(strim(data + 3));
+	else if (!strcmp(data, "rx_reset"))
+		pktgen_rx_reset();
+	else if (!strcmp(data, "rx_disable"))
+		pktgen_rx_disable();
+	else {
+		pr_warning("Unknown command: %s\n", data);
+		err = -EINVAL;
+	}
+	mutex_unlock(&pktgen_thread_lock);
+
+	if (!err)
+		err = count;
+out:
+	return err;
+}
+
+static int pgrx_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, pgrx_show, PDE(inode)->data);
+}
+
+static const struct file_operations pktgen_rx_fops = {
+	.owner   = THIS_MODULE,
+	.open    = pgrx_open,
+	.read    = seq_read,
+	.llseek  = seq_lseek,
+	.write   = pgrx_write,
+	.release = single_release,
+};
+
 static int __init pg_init(void)
 {
 	int cpu;
@@ -3860,6 +4237,14 @@ static int __init pg_init(void)
 		return -EINVAL;
 	}
 
+	pe = proc_create(PGRX, 0600, pg_proc_dir, &pktgen_rx_fops);
+	if (pe == NULL) {
+		pr_err("ERROR: cannot create %s procfs entry\n", PGRX);
+		remove_proc_entry(PGCTRL, pg_proc_dir);
+		proc_net_remove(&init_net, PG_PROC_DIR);
+		return -EINVAL;
+	}
+
 	/* Register us to receive netdevice events */
 	register_netdevice_notifier(&pktgen_notifier_block);
 
@@ -3875,6 +4260,7 @@ static int __init pg_init(void)
 	if (list_empty(&pktgen_threads)) {
 		pr_err("ERROR: Initialization failed for all threads\n");
 		unregister_netdevice_notifier(&pktgen_notifier_block);
+		remove_proc_entry(PGRX, pg_proc_dir);
 		remove_proc_entry(PGCTRL, pg_proc_dir);
 		proc_net_remove(&init_net, PG_PROC_DIR);
 		return -ENODEV;
@@ -3900,7 +4286,13 @@ static void __exit pg_cleanup(void)
 	/* Un-register us from receiving netdevice events */
 	unregister_netdevice_notifier(&pktgen_notifier_block);
 
+	mutex_lock(&pktgen_thread_lock);
+	pktgen_rx_disable();
+	mutex_unlock(&pktgen_thread_lock);
+	vfree(pg_rx_flows);
+
 	/* Clean up proc file system */
+	remove_proc_entry(PGRX, pg_proc_dir);
 	remove_proc_entry(PGCTRL, pg_proc_dir);
 	proc_net_remove(&init_net, PG_PROC_DIR);
 }
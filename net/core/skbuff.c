@@ -232,6 +232,173 @@ nodata:
 }
 EXPORT_SYMBOL(__alloc_skb);
 
+/**
+ *	build_skb - build a network buffer around already allocated data
+ *	@data: data buffer provided by caller
+ *	@frag_size: size of the fragment @data lives in, or 0 if it was
+ *		allocated with kmalloc()
+ *
+ *	Allocate a new &sk_buff whose head is @data, which the caller has
+ *	typically already had a device DMA a frame into. The last
+ *	SKB_DATA_ALIGN(sizeof(struct skb_shared_info)) bytes of the buffer
+ *	hold the shared info, the rest is data area; no headroom is
+ *	reserved, tail room covers the whole data area. @data must come
+ *	from netdev_alloc_frag() if @frag_size is not 0.
+ *
+ *	Returns the buffer with a reference count of one, or %NULL.
+ */
+struct sk_buff *build_skb(void *data, unsigned int frag_size)
+{
+	struct skb_shared_info *shinfo;
+	struct sk_buff *skb;
+	unsigned int size = frag_size ? : ksize(data);
+
+	skb = kmem_cache_alloc(skbuff_head_cache, GFP_ATOMIC);
+	if (!skb)
+		return NULL;
+
+	size -= SKB_DATA_ALIGN(sizeof(struct skb_shared_info));
+
+	memset(skb, 0, offsetof(struct sk_buff, tail));
+	skb->truesize = size + sizeof(struct sk_buff);
+	skb->head_frag = frag_size != 0;
+	atomic_set(&skb->users, 1);
+	skb->head = data;
+	skb->data = data;
+	skb_reset_tail_pointer(skb);
+	skb->end = skb->tail + size;
+#ifdef NET_SKBUFF_DATA_USES_OFFSET
+	skb->mac_header = ~0U;
+#endif
+
+	/* make sure we initialize shinfo sequentially */
+	shinfo = skb_shinfo(skb);
+	memset(shinfo, 0, offsetof(struct skb_shared_info, dataref));
+	atomic_set(&shinfo->dataref, 1);
+	kmemcheck_annotate_variable(shinfo->destructor_arg);
+
+	return skb;
+}
+EXPORT_SYMBOL(build_skb);
+
+/**
+ *	__alloc_skb_head - allocate a network buffer without a data area
+ *	@gfp_mask: allocation mask
+ *	@node: numa node to allocate memory on
+ *
+ *	Allocate a new &sk_buff whose head, data and shared info are left
+ *	for the caller to point at memory it manages itself, such as a
+ *	frame of a memory mapped ring.  skb->head must be %NULL again by
+ *	the time the buffer is freed; the buffer's destructor can see to
+ *	that.
+ */
+struct sk_buff *__alloc_skb_head(gfp_t gfp_mask, int node)
+{
+	struct sk_buff *skb;
+
+	/* Get the HEAD */
+	skb = kmem_cache_alloc_node(skbuff_head_cache,
+				    gfp_mask & ~__GFP_DMA, node);
+	if (!skb)
+		goto out;
+
+	/*
+	 * Only clear those fields we need to clear, not those that we will
+	 * actually initialise below. Hence, don't put any more fields after
+	 * the tail pointer in struct sk_buff!
+	 */
+	memset(skb, 0, offsetof(struct sk_buff, tail));
+	skb->head = NULL;
+	skb->truesize = sizeof(struct sk_buff);
+	atomic_set(&skb->users, 1);
+#ifdef NET_SKBUFF_DATA_USES_OFFSET
+	skb->mac_header = ~0U;
+#endif
+out:
+	return skb;
+}
+EXPORT_SYMBOL(__alloc_skb_head);
+
+/*
+ * Per-cpu cache of the page receive buffers are carved from. Pages are
+ * high order when possible, so one allocation serves many buffers.
+ * The page refcount is raised once to a large bias that is paid back
+ * fragment by fragment; when the page is exhausted and every fragment
+ * has been freed again it is reused without going back to the page
+ * allocator.
+ */
+struct netdev_alloc_cache {
+	struct page	*page;
+	unsigned int	offset;
+	unsigned int	size;
+	unsigned int	pagecnt_bias;
+};
+static DEFINE_PER_CPU(struct netdev_alloc_cache, netdev_alloc_cache);
+
+#define NETDEV_FRAG_PAGE_MAX_ORDER	get_order(32768)
+#define NETDEV_FRAG_PAGE_MAX_SIZE	(PAGE_SIZE << NETDEV_FRAG_PAGE_MAX_ORDER)
+#define NETDEV_PAGECNT_MAX_BIAS		NETDEV_FRAG_PAGE_MAX_SIZE
+
+static void *__netdev_alloc_frag(unsigned int fragsz, gfp_t gfp_mask)
+{
+	struct netdev_alloc_cache *nc;
+	void *data = NULL;
+	unsigned long flags;
+	int order;
+
+	local_irq_save(flags);
+	nc = &__get_cpu_var(netdev_alloc_cache);
+	if (unlikely(!nc->page)) {
+refill:
+		for (order = NETDEV_FRAG_PAGE_MAX_ORDER; ;) {
+			gfp_t gfp = gfp_mask;
+
+			if (order)
+				gfp |= __GFP_COMP | __GFP_NOWARN;
+			nc->page = alloc_pages(gfp, order);
+			if (likely(nc->page))
+				break;
+			if (--order < 0)
+				goto end;
+		}
+		nc->size = PAGE_SIZE << order;
+recycle:
+		atomic_set(&nc->page->_count, NETDEV_PAGECNT_MAX_BIAS);
+		nc->pagecnt_bias = NETDEV_PAGECNT_MAX_BIAS;
+		nc->offset = 0;
+	}
+
+	if (nc->offset + fragsz > nc->size) {
+		/* Every fragment handed out has been freed, reuse the page. */
+		if (atomic_read(&nc->page->_count) == nc->pagecnt_bias ||
+		    atomic_sub_and_test(nc->pagecnt_bias, &nc->page->_count))
+			goto recycle;
+		goto refill;
+	}
+
+	data = page_address(nc->page) + nc->offset;
+	nc->offset += fragsz;
+	nc->pagecnt_bias--;
+end:
+	local_irq_restore(flags);
+	return data;
+}
+
+/**
+ *	netdev_alloc_frag - allocate a page fragment
+ *	@fragsz: fragment size, at most PAGE_SIZE
+ *
+ *	Allocates a receive buffer from a per-cpu page fragment cache.
+ *	The buffer is released with put_page(virt_to_head_page(data)),
+ *	or by the stack once it has been wrapped with build_skb().
+ *	May be called from interrupt context.
+ */
+void *netdev_alloc_frag(unsigned int fragsz)
+{
+	return __netdev_alloc_frag(fragsz, GFP_ATOMIC | __GFP_COLD);
+}
+EXPORT_SYMBOL(netdev_alloc_frag);
+
 /**
  *	__netdev_alloc_skb - allocate an skbuff for rx on a specific device
  *	@dev: network device to receive on
@@ -248,9 +415,22 @@ EXPORT_SYMBOL(__alloc_skb);
 struct sk_buff *__netdev_alloc_skb(struct net_device *dev,
 		unsigned int length, gfp_t gfp_mask)
 {
-	struct sk_buff *skb;
+	struct sk_buff *skb = NULL;
+	unsigned int fragsz = SKB_DATA_ALIGN(length + NET_SKB_PAD) +
+			      SKB_DATA_ALIGN(sizeof(struct skb_shared_info));
+
+	if (fragsz <= PAGE_SIZE && !(gfp_mask & (__GFP_WAIT | GFP_DMA))) {
+		void *data = __netdev_alloc_frag(fragsz, gfp_mask);
 
-	skb = __alloc_skb(length + NET_SKB_PAD, gfp_mask, 0, NUMA_NO_NODE);
+		if (likely(data)) {
+			skb = build_skb(data, fragsz);
+			if (unlikely(!skb))
+				put_page(virt_to_head_page(data));
+		}
+	} else {
+		skb = __alloc_skb(length + NET_SKB_PAD, gfp_mask,
+				  0, NUMA_NO_NODE);
+	}
 	if (likely(skb)) {
 		skb_reserve(skb, NET_SKB_PAD);
 		skb->dev = dev;
@@ -283,11 +463,7 @@ EXPORT_SYMBOL(skb_add_rx_frag);
  */
 struct sk_buff *dev_alloc_skb(unsigned int length)
 {
-	/*
-	 * There is more code here than it seems:
-	 * __dev_alloc_skb is an inline
-	 */
-	return __dev_alloc_skb(length, GFP_ATOMIC);
+	return __netdev_alloc_skb(NULL, length, GFP_ATOMIC);
 }
 EXPORT_SYMBOL(dev_alloc_skb);
 
@@ -317,6 +493,14 @@ static void skb_clone_fraglist(struct sk_buff *skb)
 		skb_get(list);
 }
 
+static void skb_free_head(struct sk_buff *skb)
+{
+	if (skb->head_frag)
+		put_page(virt_to_head_page(skb->head));
+	else
+		kfree(skb->head);
+}
+
 static void skb_release_data(struct sk_buff *skb)
 {
 	if (!skb->cloned ||
@@ -331,7 +515,8 @@ static void skb_release_data(struct sk_buff *skb)
 		if (skb_has_frag_list(skb))
 			skb_drop_fraglist(skb);
 
-		kfree(skb->head);
+		skb_zcopy_clear(skb, true);
+		skb_free_head(skb);
 	}
 }
 
@@ -401,7 +586,8 @@ static void skb_release_head_state(struct sk_buff *skb)
 static void skb_release_all(struct sk_buff *skb)
 {
 	skb_release_head_state(skb);
-	skb_release_data(skb);
+	if (likely(skb->head))
+		skb_release_data(skb);
 }
 
 /**
@@ -476,6 +662,7 @@ EXPORT_SYMBOL(consume_skb);
 bool skb_recycle_check(struct sk_buff *skb, int skb_size)
 {
 	struct skb_shared_info *shinfo;
+	bool head_frag;
 
 	if (irqs_disabled())
 		return false;
@@ -496,7 +683,9 @@ bool skb_recycle_check(struct sk_buff *skb, int skb_size)
 	memset(shinfo, 0, offsetof(struct skb_shared_info, dataref));
 	atomic_set(&shinfo->dataref, 1);
 
+	head_frag = skb->head_frag;
 	memset(skb, 0, offsetof(struct sk_buff, tail));
+	skb->head_frag = head_frag;
 	skb->data = skb->head + NET_SKB_PAD;
 	skb_reset_tail_pointer(skb);
 
@@ -541,6 +730,9 @@ static void __copy_skb_header(struct sk_buff *new, const struct sk_buff *old)
 #endif
 #endif
 	new->vlan_tci		= old->vlan_tci;
+#ifdef CONFIG_NET_RX_BUSY_POLL
+	new->napi_id		= old->napi_id;
+#endif
 
 	skb_copy_secmark(new, old);
 }
@@ -567,6 +759,7 @@ static struct sk_buff *__skb_clone(struct sk_buff *n, struct sk_buff *skb)
 	C(tail);
 	C(end);
 	C(head);
+	C(head_frag);
 	C(data);
 	C(truesize);
 	atomic_set(&n->users, 1);
@@ -735,6 +928,7 @@ struct sk_buff *pskb_copy(struct sk_buff *skb, gfp_t gfp_mask)
 			get_page(skb_shinfo(n)->frags[i].page);
 		}
 		skb_shinfo(n)->nr_frags = i;
+		skb_zcopy_set(n, skb_zcopy(skb));
 	}
 
 	if (skb_has_frag_list(skb)) {
@@ -791,7 +985,7 @@ int pskb_expand_head(struct sk_buff *skb, int nhead, int ntail,
 		fastpath = atomic_read(&skb_shinfo(skb)->dataref) == delta;
 	}
 
-	if (fastpath &&
+	if (fastpath && !skb->head_frag &&
 	    size + sizeof(struct skb_shared_info) <= ksize(skb->head)) {
 		memmove(skb->head + size, skb_shinfo(skb),
 			offsetof(struct skb_shared_info,
@@ -816,8 +1010,11 @@ int pskb_expand_head(struct sk_buff *skb, int nhead, int ntail,
 	       offsetof(struct skb_shared_info, frags[skb_shinfo(skb)->nr_frags]));
 
 	if (fastpath) {
-		kfree(skb->head);
+		skb_free_head(skb);
 	} else {
+		/* the copied shared info now also refers to the frags */
+		if (skb_zcopy(skb))
+			sock_zerocopy_get(skb_zcopy(skb));
 		for (i = 0; i < skb_shinfo(skb)->nr_frags; i++)
 			get_page(skb_shinfo(skb)->frags[i].page);
 
@@ -829,6 +1026,7 @@ int pskb_expand_head(struct sk_buff *skb, int nhead, int ntail,
 	off = (data + nhead) - skb->head;
 
 	skb->head     = data;
+	skb->head_frag = 0;
 adjust_others:
 	skb->data    += off;
 #ifdef NET_SKBUFF_DATA_USES_OFFSET
@@ -2080,6 +2278,7 @@ void skb_split(struct sk_buff *skb, struct sk_buff *skb1, const u32 len)
 {
 	int pos = skb_headlen(skb);
 
+	skb_zcopy_set(skb1, skb_zcopy(skb));
 	if (len < pos)	/* Split line is inside header. */
 		skb_split_inside_header(skb, skb1, len, pos);
 	else		/* Second chunk has no header, nothing to copy. */
@@ -2122,6 +2321,10 @@ int skb_shift(struct sk_buff *tgt, struct sk_buff *skb, int shiftlen)
 	BUG_ON(shiftlen > skb->len);
 	BUG_ON(skb_headlen(skb));	/* Would corrupt stream */
 
+	/* Frags of a zerocopy send must stay with skbs tracking it */
+	if (skb_zcopy(tgt) != skb_zcopy(skb))
+		return 0;
+
 	todo = shiftlen;
 	from = 0;
 	to = skb_shinfo(tgt)->nr_frags;
@@ -2592,6 +2795,7 @@ struct sk_buff *skb_segment(struct sk_buff *skb, u32 features)
 		}
 
 		frag = skb_shinfo(nskb)->frags;
+		skb_zcopy_set(nskb, skb_zcopy(skb));
 
 		skb_copy_from_linear_data_offset(skb, offset,
 						 skb_put(nskb, hsize), hsize);
@@ -3039,6 +3243,364 @@ void skb_tstamp_tx(struct sk_buff *orig_skb,
 }
 EXPORT_SYMBOL_GPL(skb_tstamp_tx);
 
+static void sock_ofree(struct sk_buff *skb)
+{
+	atomic_sub(skb->truesize, &skb->sk->sk_omem_alloc);
+}
+
+/* Allocates an skb charged to the option memory of @sk */
+static struct sk_buff *sock_omalloc(struct sock *sk, unsigned int size,
+				    gfp_t priority)
+{
+	struct sk_buff *skb;
+
+	if (atomic_read(&sk->sk_omem_alloc) + sizeof(*skb) + size >
+	    sysctl_optmem_max)
+		return NULL;
+
+	skb = alloc_skb(size, priority);
+	if (!skb)
+		return NULL;
+
+	atomic_add(skb->truesize, &sk->sk_omem_alloc);
+	skb->sk = sk;
+	skb->destructor = sock_ofree;
+	return skb;
+}
+
+static inline struct sk_buff *skb_from_uarg(struct ubuf_info *uarg)
+{
+	return container_of((void *)uarg, struct sk_buff, cb);
+}
+
+static struct ubuf_info *sock_zerocopy_alloc(struct sock *sk, size_t size)
+{
+	struct ubuf_info *uarg;
+	struct sk_buff *skb;
+
+	BUILD_BUG_ON(sizeof(*uarg) > sizeof(skb->cb));
+
+	skb = sock_omalloc(sk, 0, GFP_KERNEL);
+	if (!skb)
+		return NULL;
+
+	uarg = (void *)skb->cb;
+	uarg->sk = sk;
+	uarg->id = (u32)atomic_inc_return(&sk->sk_zckey) - 1;
+	uarg->len = 1;
+	uarg->zerocopy = 1;
+	uarg->bytelen = size;
+	atomic_set(&uarg->refcnt, 1);
+	sock_hold(sk);
+
+	return uarg;
+}
+
+/**
+ * sock_zerocopy_realloc - account a MSG_ZEROCOPY send
+ * @sk: sending socket, locked if @uarg is set
+ * @size: bytes in this send
+ * @uarg: zerocopy state of the skb the data will be appended to, if any
+ *
+ * Extends @uarg to cover one more send id when that keeps its id range
+ * contiguous, or starts a new one.  Returns it with a reference for the
+ * caller, who drops it with sock_zerocopy_put() once the data has been
+ * queued, or with sock_zerocopy_put_abort() if nothing was.
+ */
+struct ubuf_info *sock_zerocopy_realloc(struct sock *sk, size_t size,
+					struct ubuf_info *uarg)
+{
+	if (uarg) {
+		const u32 byte_limit = 1 << 19;	/* a few TSO frames */
+		u32 bytelen, next;
+
+		bytelen = uarg->bytelen + size;
+		if (uarg->len == USHRT_MAX - 1 || bytelen > byte_limit) {
+			/* TCP can start a new skb with its own state */
+			if (sk->sk_type == SOCK_STREAM)
+				goto new_alloc;
+			return NULL;
+		}
+
+		next = (u32)atomic_read(&sk->sk_zckey);
+		if ((u32)(uarg->id + uarg->len) == next) {
+			uarg->len++;
+			uarg->bytelen = bytelen;
+			atomic_set(&sk->sk_zckey, ++next);
+			sock_zerocopy_get(uarg);
+			return uarg;
+		}
+	}
+
+new_alloc:
+	return sock_zerocopy_alloc(sk, size);
+}
+EXPORT_SYMBOL_GPL(sock_zerocopy_realloc);
+
+static bool skb_zerocopy_notify_extend(struct sk_buff *skb, u32 lo, u16 len,
+				       u8 code)
+{
+	struct sock_exterr_skb *serr = SKB_EXT_ERR(skb);
+	u32 old_lo, old_hi;
+
+	if (serr->ee.ee_origin != SO_EE_ORIGIN_ZEROCOPY ||
+	    serr->ee.ee_code != code)
+		return false;
+
+	old_lo = serr->ee.ee_info;
+	old_hi = serr->ee.ee_data;
+	if (lo != old_hi + 1 ||
+	    (u64)old_hi - old_lo + 1 + len >= (1ULL << 32))
+		return false;
+
+	serr->ee.ee_data += len;
+	return true;
+}
+
+/*
+ * Queues the completion of sends @id to @id + @len - 1 on the error queue,
+ * merged into the last notification there if the ranges are adjacent.
+ */
+static void sock_zerocopy_callback(struct ubuf_info *uarg)
+{
+	struct sk_buff *tail, *skb = skb_from_uarg(uarg);
+	struct sock_exterr_skb *serr;
+	struct sock *sk = uarg->sk;
+	struct sk_buff_head *q;
+	unsigned long flags;
+	u32 lo, hi;
+	u16 len;
+	u8 code;
+
+	/* The only send it covered failed and was not queued */
+	if (!uarg->len)
+		goto release;
+
+	len = uarg->len;
+	lo = uarg->id;
+	hi = uarg->id + len - 1;
+	code = uarg->zerocopy ? 0 : SO_EE_CODE_ZEROCOPY_COPIED;
+
+	serr = SKB_EXT_ERR(skb);
+	memset(serr, 0, sizeof(*serr));
+	serr->ee.ee_errno = 0;
+	serr->ee.ee_origin = SO_EE_ORIGIN_ZEROCOPY;
+	serr->ee.ee_code = code;
+	serr->ee.ee_info = lo;
+	serr->ee.ee_data = hi;
+
+	q = &sk->sk_error_queue;
+	spin_lock_irqsave(&q->lock, flags);
+	tail = skb_peek_tail(q);
+	if (!tail || !skb_zerocopy_notify_extend(tail, lo, len, code)) {
+		__skb_queue_tail(q, skb);
+		skb = NULL;
+	}
+	spin_unlock_irqrestore(&q->lock, flags);
+
+	if (!sock_flag(sk, SOCK_DEAD))
+		sk->sk_error_report(sk);
+
+release:
+	consume_skb(skb);
+	sock_put(sk);
+}
+
+void sock_zerocopy_put(struct ubuf_info *uarg)
+{
+	if (uarg && atomic_dec_and_test(&uarg->refcnt))
+		sock_zerocopy_callback(uarg);
+}
+EXPORT_SYMBOL_GPL(sock_zerocopy_put);
+
+void sock_zerocopy_put_abort(struct ubuf_info *uarg)
+{
+	if (uarg) {
+		atomic_dec(&uarg->sk->sk_zckey);
+		uarg->len--;
+		sock_zerocopy_put(uarg);
+	}
+}
+EXPORT_SYMBOL_GPL(sock_zerocopy_put_abort);
+
+/*
+ * Pins @len bytes of user memory at @from and appends them to @skb as page
+ * frags.  Returns the number of bytes added, which is short if @skb ran out
+ * of frag slots, or a negative error if nothing could be added.
+ */
+static int skb_fill_user_frags(struct sk_buff *skb, unsigned long from,
+			       int len)
+{
+	struct page *pages[MAX_SKB_FRAGS];
+	int copied = 0;
+
+	while (copied < len) {
+		int i = skb_shinfo(skb)->nr_frags;
+		int off = (from + copied) & ~PAGE_MASK;
+		int n, j;
+
+		n = min_t(int, DIV_ROUND_UP(off + len - copied, PAGE_SIZE),
+			  MAX_SKB_FRAGS - i);
+		if (n <= 0)
+			break;
+
+		n = get_user_pages_fast((from + copied) & PAGE_MASK, n, 0,
+					pages);
+		if (n <= 0) {
+			if (!copied)
+				return -EFAULT;
+			break;
+		}
+
+		for (j = 0; j < n; j++) {
+			int size = min_t(int, PAGE_SIZE - off, len - copied);
+
+			if (skb_can_coalesce(skb, i, pages[j], off)) {
+				skb_shinfo(skb)->frags[i - 1].size += size;
+				put_page(pages[j]);
+			} else
+				skb_fill_page_desc(skb, i++, pages[j], off,
+						   size);
+			copied += size;
+			off = 0;
+		}
+	}
+
+	if (!copied)
+		return -EMSGSIZE;
+
+	skb->len += copied;
+	skb->data_len += copied;
+	skb->truesize += copied;
+	return copied;
+}
+
+/**
+ * skb_zerocopy_iter_stream - append user memory to a stream skb
+ * @sk: owning socket
+ * @skb: skb on the write queue of @sk
+ * @from: user memory
+ * @len: bytes at @from
+ * @uarg: zerocopy send the data belongs to
+ *
+ * Returns the number of bytes added, possibly short of @len, -EMSGSIZE if
+ * @skb has no frag slot left, -EEXIST if @skb already belongs to another
+ * zerocopy send, or -EFAULT.
+ */
+int skb_zerocopy_iter_stream(struct sock *sk, struct sk_buff *skb,
+			     const void __user *from, int len,
+			     struct ubuf_info *uarg)
+{
+	struct ubuf_info *orig_uarg = skb_zcopy(skb);
+	int copied;
+
+	if (orig_uarg && orig_uarg != uarg)
+		return -EEXIST;
+
+	copied = skb_fill_user_frags(skb, (unsigned long)from, len);
+	if (copied > 0) {
+		sk->sk_wmem_queued += copied;
+		sk_mem_charge(sk, copied);
+		skb_zcopy_set(skb, uarg);
+	}
+	return copied;
+}
+EXPORT_SYMBOL_GPL(skb_zerocopy_iter_stream);
+
+/**
+ * skb_zerocopy_iter_dgram - append user memory to a datagram skb
+ * @skb: skb being built, charged to the write memory of skb->sk
+ * @iov: user memory
+ * @offset: offset of the data in @iov
+ * @len: bytes to append
+ * @uarg: zerocopy send the data belongs to
+ *
+ * Appends all of it or fails, with -EMSGSIZE if @skb ran out of frags.
+ */
+int skb_zerocopy_iter_dgram(struct sk_buff *skb, const struct iovec *iov,
+			    int offset, int len, struct ubuf_info *uarg)
+{
+	struct ubuf_info *orig_uarg = skb_zcopy(skb);
+
+	if (orig_uarg && orig_uarg != uarg)
+		return -EEXIST;
+	skb_zcopy_set(skb, uarg);
+
+	for (; len > 0; iov++) {
+		int seg, copied;
+
+		if (offset >= iov->iov_len) {
+			offset -= iov->iov_len;
+			continue;
+		}
+
+		seg = min_t(int, iov->iov_len - offset, len);
+		copied = skb_fill_user_frags(skb,
+				(unsigned long)iov->iov_base + offset, seg);
+		if (copied < 0)
+			return copied;
+		atomic_add(copied, &skb->sk->sk_wmem_alloc);
+		if (copied < seg)
+			return -EMSGSIZE;
+
+		len -= seg;
+		offset = 0;
+	}
+	return 0;
+}
+EXPORT_SYMBOL_GPL(skb_zerocopy_iter_dgram);
+
+/**
+ * skb_copy_ubufs - copy the user frags of a zerocopy skb to kernel pages
+ * @skb: the skb, which must not be shared
+ * @gfp_mask: allocation priority
+ *
+ * Gives @skb private copies of the user memory its frags point to and
+ * drops its reference on the zerocopy send, which then reports that the
+ * data was copied.  A cloned skb gets its own shared info first, so
+ * clones keep the user pages.
+ */
+int skb_copy_ubufs(struct sk_buff *skb, gfp_t gfp_mask)
+{
+	int i, num_frags = skb_shinfo(skb)->nr_frags;
+	struct page *pages[MAX_SKB_FRAGS];
+
+	if (skb_shared(skb))
+		return -EINVAL;
+	if (skb_cloned(skb) && pskb_expand_head(skb, 0, 0, gfp_mask))
+		return -ENOMEM;
+
+	for (i = 0; i < num_frags; i++) {
+		skb_frag_t *f = &skb_shinfo(skb)->frags[i];
+		u8 *vaddr;
+
+		pages[i] = alloc_pages(gfp_mask | __GFP_COMP, get_order(f->size));
+		if (!pages[i]) {
+			while (--i >= 0)
+				__free_pages(pages[i],
+				     get_order(skb_shinfo(skb)->frags[i].size));
+			return -ENOMEM;
+		}
+
+		vaddr = kmap_skb_frag(f);
+		memcpy(page_address(pages[i]), vaddr + f->page_offset,
+		       f->size);
+		kunmap_skb_frag(vaddr);
+	}
+
+	for (i = 0; i < num_frags; i++) {
+		skb_frag_t *f = &skb_shinfo(skb)->frags[i];
+
+		put_page(f->page);
+		f->page = pages[i];
+		f->page_offset = 0;
+	}
+
+	skb_zcopy_clear(skb, false);
+	return 0;
+}
+EXPORT_SYMBOL_GPL(skb_copy_ubufs);
+
 
 /**
  * skb_partial_csum_set - set up and verify partial csum values for packet
@@ -18,7 +18,10 @@
 #include <linux/netdevice.h>
 #include <linux/version.h>
 #include <linux/spinlock.h>
+#include <linux/if_tunnel.h>
 #include <net/protocol.h>
+#include <net/ip.h>
+#include <net/inet_common.h>
 #include <net/gre.h>
 
 
@@ -120,10 +123,176 @@ drop:
 	kfree_skb(skb);
 }
 
+/* GRO and GSO only handle version 0 GRE carrying IPv4, optionally
+ * with a key. Checksummed or sequenced tunnels are left alone: merging
+ * would require rewriting those fields for every segment.
+ */
+static int gre_offload_hlen(__be16 flags, __be16 protocol)
+{
+	if ((flags & ~GRE_KEY) || protocol != htons(ETH_P_IP))
+		return -1;
+	return (flags & GRE_KEY) ? 8 : 4;
+}
+
+static struct sk_buff *gre_gso_segment(struct sk_buff *skb, u32 features)
+{
+	struct sk_buff *segs = ERR_PTR(-EINVAL);
+	int mac_len = skb->mac_len;
+	int thoff = skb_transport_header(skb) - skb_mac_header(skb);
+	__be16 *greh;
+	int ghl;
+
+	if (unlikely(!(skb_shinfo(skb)->gso_type & SKB_GSO_GRE)))
+		goto out;
+
+	if (unlikely(!pskb_may_pull(skb, 4)))
+		goto out;
+
+	greh = (__be16 *)skb->data;
+	ghl = gre_offload_hlen(greh[0], greh[1]);
+	if (ghl < 0 || unlikely(!pskb_may_pull(skb, ghl)))
+		goto out;
+
+	__skb_pull(skb, ghl);
+	skb_reset_network_header(skb);
+	skb->mac_len = skb_network_header(skb) - skb_mac_header(skb);
+
+	/* The device only sees the outer headers, so the inner packet is
+	 * segmented in software.  Clearing the checksum features alone is
+	 * not enough: with NETIF_F_SG the segments share the original
+	 * pages and stay CHECKSUM_PARTIAL, with csum_start at the inner
+	 * transport header.
+	 */
+	segs = inet_gso_segment(skb, features & ~(NETIF_F_ALL_CSUM |
+						  NETIF_F_GSO_MASK));
+	if (!segs || IS_ERR(segs))
+		goto out;
+
+	/* Hand the segments back to the outer IPv4 header, and finish
+	 * their inner checksums, which the device cannot find.
+	 */
+	for (skb = segs; skb; skb = skb->next) {
+		skb->mac_len = mac_len;
+		skb->network_header = skb->mac_header + mac_len;
+		skb->transport_header = skb->mac_header + thoff;
+
+		if (skb->ip_summed == CHECKSUM_PARTIAL &&
+		    skb_checksum_help(skb))
+			goto free_segs;
+	}
+
+out:
+	return segs;
+
+free_segs:
+	while (segs) {
+		skb = segs;
+		segs = segs->next;
+		kfree_skb(skb);
+	}
+	return ERR_PTR(-ENOMEM);
+}
+
+static struct sk_buff **gre_gro_receive(struct sk_buff **head,
+					struct sk_buff *skb)
+{
+	struct sk_buff **pp = NULL;
+	struct sk_buff *p;
+	unsigned int off, hlen;
+	__be16 *greh;
+	__wsum csum = 0;
+	int ghl;
+	int flush = 1;
+
+	/* Only one level of GRE is merged; deeper nesting would recurse
+	 * through inet_gro_receive() once per header.
+	 */
+	if (NAPI_GRO_CB(skb)->encap_mark)
+		goto out;
+	NAPI_GRO_CB(skb)->encap_mark = 1;
+
+	off = skb_gro_offset(skb);
+	hlen = off + 4;
+	greh = skb_gro_header_fast(skb, off);
+	if (skb_gro_header_hard(skb, hlen)) {
+		greh = skb_gro_header_slow(skb, hlen, off);
+		if (unlikely(!greh))
+			goto out;
+	}
+
+	ghl = gre_offload_hlen(greh[0], greh[1]);
+	if (ghl < 0)
+		goto out;
+
+	hlen = off + ghl;
+	if (skb_gro_header_hard(skb, hlen)) {
+		greh = skb_gro_header_slow(skb, hlen, off);
+		if (unlikely(!greh))
+			goto out;
+	}
+
+	flush = 0;
+
+	/* Packets of one tunnel have identical GRE headers: flags,
+	 * protocol and key.
+	 */
+	for (p = *head; p; p = p->next) {
+		if (!NAPI_GRO_CB(p)->same_flow)
+			continue;
+
+		if (memcmp(p->data + off, greh, ghl))
+			NAPI_GRO_CB(p)->same_flow = 0;
+	}
+
+	/* skb->csum covers the GRE header, take it out so the inner
+	 * protocol can verify its own checksum against it.
+	 */
+	if (skb->ip_summed == CHECKSUM_COMPLETE) {
+		csum = csum_partial(greh, ghl, 0);
+		skb->csum = csum_sub(skb->csum, csum);
+	}
+
+	skb_gro_pull(skb, ghl);
+	skb_set_network_header(skb, skb_gro_offset(skb));
+
+	pp = inet_gro_receive(head, skb);
+
+	/* Not consumed by the inner protocol, ipgre_rcv() expects the
+	 * GRE header to still be part of the checksum.
+	 */
+	if (skb->ip_summed == CHECKSUM_COMPLETE)
+		skb->csum = csum_add(skb->csum, csum);
+
+out:
+	NAPI_GRO_CB(skb)->flush |= flush;
+
+	return pp;
+}
+
+/* Called by inet_gro_complete() with the network header at the outer
+ * IPv4 header; the transport header already points at the inner TCP
+ * header.
+ */
+static int gre_gro_complete(struct sk_buff *skb)
+{
+	int off = skb_network_offset(skb) + ip_hdrlen(skb);
+	__be16 *greh = (__be16 *)(skb->data + off);
+	int err;
+
+	skb_set_network_header(skb, off + gre_offload_hlen(greh[0], greh[1]));
+	err = inet_gro_complete(skb);
+	skb_shinfo(skb)->gso_type |= SKB_GSO_GRE;
+
+	return err;
+}
+
 static const struct net_protocol net_gre_protocol = {
-	.handler     = gre_rcv,
-	.err_handler = gre_err,
-	.netns_ok    = 1,
+	.handler      = gre_rcv,
+	.err_handler  = gre_err,
+	.gso_segment  = gre_gso_segment,
+	.gro_receive  = gre_gro_receive,
+	.gro_complete = gre_gro_complete,
+	.netns_ok     = 1,
 };
 
 static int __init gre_init(void)
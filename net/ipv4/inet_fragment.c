@@ -146,6 +146,14 @@ void inet_frag_destroy(struct inet_frag_queue *q, struct inet_frags *f,
 		frag_kfree_skb(nf, f, fp, work);
 		fp = xp;
 	}
+	if (!RB_EMPTY_ROOT(&q->rb_fragments)) {
+		unsigned int sum_truesize;
+
+		sum_truesize = ip_frag_rbtree_purge(&q->rb_fragments);
+		if (work)
+			*work -= sum_truesize;
+		atomic_sub(sum_truesize, &nf->mem);
+	}
 
 	if (work)
 		*work -= f->qsize;
@@ -513,6 +513,10 @@ struct inet_peer *inet_getpeer(struct inetpeer_addr *daddr, int create)
 		p->pmtu_expires = 0;
 		p->pmtu_orig = 0;
 		memset(&p->redirect_learned, 0, sizeof(p->redirect_learned));
+		p->tcp_fastopen_cookie.len = 0;
+		p->tcp_fastopen_mss = 0;
+		p->tcp_fastopen_syn_loss = 0;
+		p->tcp_fastopen_syn_loss_ts = 0;
 		INIT_LIST_HEAD(&p->unused);
 
 
@@ -630,6 +630,19 @@ static int ipgre_rcv(struct sk_buff *skb)
 		skb->mac_header = skb->network_header;
 		__pskb_pull(skb, offset);
 		skb_postpull_rcsum(skb, skb_transport_header(skb), offset);
+		/* A GRE GRO packet is plain TCP once decapsulated, let the
+		 * egress device segment it if it gets forwarded.  The shared
+		 * info of a clone is not ours to change, so unclone first;
+		 * that moves the headers.
+		 */
+		if (skb_is_gso(skb)) {
+			if (skb_cloned(skb)) {
+				if (pskb_expand_head(skb, 0, 0, GFP_ATOMIC))
+					goto drop;
+				iph = ip_hdr(skb);
+			}
+			skb_shinfo(skb)->gso_type &= ~SKB_GSO_GRE;
+		}
 		skb->pkt_type = PACKET_HOST;
 #ifdef CONFIG_NET_IPGRE_BROADCAST
 		if (ipv4_is_multicast(iph->daddr)) {
@@ -781,6 +781,7 @@ static int __ip_append_data(struct sock *sk, struct sk_buff_head *queue,
 			    unsigned int flags)
 {
 	struct inet_sock *inet = inet_sk(sk);
+	struct ubuf_info *uarg = NULL;
 	struct sk_buff *skb;
 
 	struct ip_options *opt = cork->opt;
@@ -790,6 +791,7 @@ static int __ip_append_data(struct sock *sk, struct sk_buff_head *queue,
 	int copy;
 	int err;
 	int offset = 0;
+	int zc = 0;
 	unsigned int maxfraglen, fragheaderlen;
 	int csummode = CHECKSUM_NONE;
 	struct rtable *rt = (struct rtable *)cork->dst;
@@ -797,7 +799,10 @@ static int __ip_append_data(struct sock *sk, struct sk_buff_head *queue,
 	exthdrlen = transhdrlen ? rt->dst.header_len : 0;
 	length += exthdrlen;
 	transhdrlen += exthdrlen;
-	mtu = cork->fragsize;
+	/* A UDP_SEGMENT send is built as one datagram and cut into
+	 * gso_size pieces on the way out, never IP fragmented.
+	 */
+	mtu = cork->gso_size ? 0xFFFF : cork->fragsize;
 
 	hh_len = LL_RESERVED_SPACE(rt->dst.dev);
 
@@ -816,12 +821,29 @@ static int __ip_append_data(struct sock *sk, struct sk_buff_head *queue,
 	 */
 	if (transhdrlen &&
 	    length + fragheaderlen <= mtu &&
-	    rt->dst.dev->features & NETIF_F_V4_CSUM &&
+	    (rt->dst.dev->features & NETIF_F_V4_CSUM || cork->gso_size) &&
 	    !exthdrlen)
 		csummode = CHECKSUM_PARTIAL;
 
 	skb = skb_peek_tail(queue);
 
+	if ((flags & MSG_ZEROCOPY) && length && sock_flag(sk, SOCK_ZEROCOPY)) {
+		uarg = sock_zerocopy_realloc(sk, length, skb_zcopy(skb));
+		if (!uarg)
+			return -ENOBUFS;
+
+		/* The payload can only go out of user memory as it is:
+		 * no software checksum while copying, no fragmentation.
+		 */
+		if ((rt->dst.dev->features & NETIF_F_SG) &&
+		    csummode == CHECKSUM_PARTIAL &&
+		    getfrag == ip_generic_getfrag &&
+		    length >= SKB_ZEROCOPY_MIN_SIZE)
+			zc = 1;
+		else
+			uarg->zerocopy = 0;
+	}
+
 	cork->length += length;
 	if (((length > mtu) || (skb && skb_is_gso(skb))) &&
 	    (sk->sk_protocol == IPPROTO_UDP) &&
@@ -831,6 +853,9 @@ static int __ip_append_data(struct sock *sk, struct sk_buff_head *queue,
 					 mtu, flags);
 		if (err)
 			goto error;
+		if (uarg)
+			uarg->zerocopy = 0;
+		sock_zerocopy_put(uarg);
 		return 0;
 	}
 
@@ -855,6 +880,7 @@ static int __ip_append_data(struct sock *sk, struct sk_buff_head *queue,
 			unsigned int fraglen;
 			unsigned int fraggap;
 			unsigned int alloclen;
+			unsigned int pagedlen;
 			struct sk_buff *skb_prev;
 alloc_new_skb:
 			skb_prev = skb;
@@ -889,6 +915,11 @@ alloc_new_skb:
 				if (datalen > mtu - fragheaderlen - rt->dst.trailer_len)
 					datalen -= ALIGN(rt->dst.trailer_len, 8);
 			}
+
+			/* Zerocopy payload is attached as frags below */
+			pagedlen = zc ? datalen - transhdrlen - fraggap : 0;
+			alloclen -= pagedlen;
+
 			if (transhdrlen) {
 				skb = sock_alloc_send_skb(sk,
 						alloclen + hh_len + 15,
@@ -921,7 +952,7 @@ alloc_new_skb:
 			/*
 			 *	Find where to start putting bytes.
 			 */
-			data = skb_put(skb, fraglen);
+			data = skb_put(skb, fraglen - pagedlen);
 			skb_set_network_header(skb, exthdrlen);
 			skb->transport_header = (skb->network_header +
 						 fragheaderlen);
@@ -937,7 +968,7 @@ alloc_new_skb:
 				pskb_trim_unique(skb_prev, maxfraglen);
 			}
 
-			copy = datalen - transhdrlen - fraggap;
+			copy = datalen - transhdrlen - fraggap - pagedlen;
 			if (copy > 0 && getfrag(from, data + transhdrlen, offset, copy, fraggap, skb) < 0) {
 				err = -EFAULT;
 				kfree_skb(skb);
@@ -945,7 +976,7 @@ alloc_new_skb:
 			}
 
 			offset += copy;
-			length -= datalen - fraggap;
+			length -= datalen - fraggap - pagedlen;
 			transhdrlen = 0;
 			exthdrlen = 0;
 			csummode = CHECKSUM_NONE;
@@ -970,6 +1001,11 @@ alloc_new_skb:
 				err = -EFAULT;
 				goto error;
 			}
+		} else if (zc) {
+			err = skb_zerocopy_iter_dgram(skb, from, offset, copy,
+						      uarg);
+			if (err < 0)
+				goto error;
 		} else {
 			int i = skb_shinfo(skb)->nr_frags;
 			skb_frag_t *frag = &skb_shinfo(skb)->frags[i-1];
@@ -1021,9 +1057,11 @@ alloc_new_skb:
 		length -= copy;
 	}
 
+	sock_zerocopy_put(uarg);
 	return 0;
 
 error:
+	sock_zerocopy_put_abort(uarg);
 	cork->length -= length;
 	IP_INC_STATS(sock_net(sk), IPSTATS_MIB_OUTDISCARDS);
 	return err;
@@ -1063,6 +1101,7 @@ static int ip_setup_cork(struct sock *sk, struct inet_cork *cork,
 	cork->dst = &rt->dst;
 	cork->length = 0;
 	cork->tx_flags = ipc->tx_flags;
+	cork->gso_size = ipc->gso_size;
 	cork->page = NULL;
 	cork->off = 0;
 
@@ -1402,9 +1441,8 @@ struct sk_buff *ip_make_skb(struct sock *sk,
 					int len, int odd, struct sk_buff *skb),
 			    void *from, int length, int transhdrlen,
 			    struct ipcm_cookie *ipc, struct rtable **rtp,
-			    unsigned int flags)
+			    struct inet_cork *cork, unsigned int flags)
 {
-	struct inet_cork cork = {};
 	struct sk_buff_head queue;
 	int err;
 
@@ -1413,18 +1451,21 @@ struct sk_buff *ip_make_skb(struct sock *sk,
 
 	__skb_queue_head_init(&queue);
 
-	err = ip_setup_cork(sk, &cork, ipc, rtp);
+	cork->flags = 0;
+	cork->addr = 0;
+	cork->opt = NULL;
+	err = ip_setup_cork(sk, cork, ipc, rtp);
 	if (err)
 		return ERR_PTR(err);
 
-	err = __ip_append_data(sk, &queue, &cork, getfrag,
+	err = __ip_append_data(sk, &queue, cork, getfrag,
 			       from, length, transhdrlen, flags);
 	if (err) {
-		__ip_flush_pending_frames(sk, &queue, &cork);
+		__ip_flush_pending_frames(sk, &queue, cork);
 		return ERR_PTR(err);
 	}
 
-	return __ip_make_skb(sk, &queue, &cork);
+	return __ip_make_skb(sk, &queue, cork);
 }
 
 /*
@@ -1465,6 +1506,7 @@ void ip_send_reply(struct sock *sk, struct sk_buff *skb, struct ip_reply_arg *ar
 	daddr = ipc.addr = rt->rt_src;
 	ipc.opt = NULL;
 	ipc.tx_flags = 0;
+	ipc.gso_size = 0;
 
 	if (replyopts.opt.optlen) {
 		ipc.opt = &replyopts.opt;
@@ -17,6 +17,11 @@
 #include <linux/netdevice.h>
 #include <linux/module.h>
 #include <linux/icmp.h>
+#include <linux/jhash.h>
+#include <linux/log2.h>
+#include <linux/random.h>
+#include <linux/tcp.h>
+#include <linux/udp.h>
 #include <net/ip.h>
 #include <net/compat.h>
 #include <asm/uaccess.h>
@@ -27,6 +32,7 @@
 
 #include <linux/netfilter/x_tables.h>
 #include <linux/netfilter_ipv4/ip_tables.h>
+#include <linux/netfilter/xt_tcpudp.h>
 #include <net/netfilter/nf_log.h>
 #include "../../netfilter/xt_repldata.h"
 
@@ -293,6 +299,377 @@ struct ipt_entry *ipt_next_entry(const struct ipt_entry *entry)
 	return (void *)entry + entry->next_offset;
 }
 
+#ifdef CONFIG_IP_NF_IPTABLES_INDEX
+/*
+ * Rule index.
+ *
+ * Rulesets generated from address or service lists tend to be long runs
+ * of rules that differ only in the addresses, protocol and single ports
+ * they match.  Such runs are indexed by hash when the table is loaded:
+ * rules are grouped by "shape" (the masks and fields they look at), and
+ * a packet arriving at a rule inside a run looks up every shape of the
+ * run and continues with the first rule that can match.  The rule is
+ * then evaluated as usual, so counters, targets and non-terminal verdicts
+ * behave exactly as with the linear walk.
+ */
+#define IPT_INDEX_MIN_RUN	8
+#define IPT_INDEX_MAX_SHAPES	4
+
+#define IPT_INDEX_SPORT		0x01
+#define IPT_INDEX_DPORT		0x02
+#define IPT_INDEX_L4		0x04	/* rule has a tcp or udp match */
+
+struct ipt_index_shape {
+	__be32	smsk;
+	__be32	dmsk;
+	u8	proto;
+	u8	flags;
+};
+
+struct ipt_index_key {
+	__be32	saddr;
+	__be32	daddr;
+	__be16	sport;
+	__be16	dport;
+	u8	proto;
+	u8	shape;			/* shape number + 1, 0 if slot is free */
+	u16	pad;
+};
+
+struct ipt_index_node {
+	struct ipt_index_key	key;
+	unsigned int		offset;	/* of the rule within the table */
+};
+
+struct ipt_index_run {
+	unsigned int		start;	/* offset of the first rule */
+	unsigned int		end;	/* offset of the first rule after it */
+	unsigned int		nshapes;
+	unsigned int		hmask;
+	struct ipt_index_shape	shape[IPT_INDEX_MAX_SHAPES];
+	struct ipt_index_node	*node;
+};
+
+struct ipt_index {
+	u32			seed;
+	unsigned int		nruns;
+	struct ipt_index_run	*run;
+	/* one bit per possible rule offset, set for rules inside a run */
+	unsigned long		map[0];
+};
+
+static inline unsigned int ipt_index_slot(unsigned int offset)
+{
+	return offset / __alignof__(struct ipt_entry);
+}
+
+static inline u32 ipt_index_hash(const struct ipt_index *idx,
+				 const struct ipt_index_key *key)
+{
+	return jhash2((const u32 *)key, sizeof(*key) / sizeof(u32), idx->seed);
+}
+
+static inline bool ipt_index_key_equal(const struct ipt_index_key *a,
+				       const struct ipt_index_key *b)
+{
+	const u32 *x = (const u32 *)a, *y = (const u32 *)b;
+
+	return ((x[0] ^ y[0]) | (x[1] ^ y[1]) |
+		(x[2] ^ y[2]) | (x[3] ^ y[3])) == 0;
+}
+
+static const struct ipt_index_run *
+ipt_index_find_run(const struct ipt_index *idx, unsigned int offset)
+{
+	unsigned int lo = 0, hi = idx->nruns;
+
+	while (hi - lo > 1) {
+		unsigned int mid = (lo + hi) / 2;
+
+		if (idx->run[mid].start <= offset)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	return &idx->run[lo];
+}
+
+/*
+ * Returns the first rule at or after @e, within its run, that can match
+ * the packet, with *@indexed set; or the rule following the run, with
+ * *@indexed clear, if none can.  Fragments and truncated transport
+ * headers are left to the linear walk, which knows how to hotdrop them.
+ */
+static struct ipt_entry *
+ipt_index_lookup(const struct ipt_index *idx, const void *table_base,
+		 struct ipt_entry *e, const struct sk_buff *skb,
+		 const struct xt_action_param *par, bool *indexed)
+{
+	const struct iphdr *ip = ip_hdr(skb);
+	unsigned int offset = (void *)e - table_base;
+	const struct ipt_index_run *run = ipt_index_find_run(idx, offset);
+	unsigned int best = run->end;
+	const __be16 *ports = NULL;
+	struct tcphdr _hdr;
+	unsigned int s;
+
+	*indexed = true;
+	for (s = 0; s < run->nshapes; s++) {
+		const struct ipt_index_shape *shape = &run->shape[s];
+		struct ipt_index_key key;
+		unsigned int h;
+
+		if (shape->proto && shape->proto != ip->protocol)
+			continue;
+		if ((shape->flags & IPT_INDEX_L4) && ports == NULL) {
+			if (par->fragoff != 0)
+				return e;
+			ports = skb_header_pointer(skb, par->thoff,
+					ip->protocol == IPPROTO_TCP ?
+					sizeof(struct tcphdr) :
+					sizeof(struct udphdr), &_hdr);
+			if (ports == NULL)
+				return e;
+		}
+
+		memset(&key, 0, sizeof(key));
+		key.saddr = ip->saddr & shape->smsk;
+		key.daddr = ip->daddr & shape->dmsk;
+		key.proto = shape->proto;
+		key.shape = s + 1;
+		if (shape->flags & IPT_INDEX_SPORT)
+			key.sport = ports[0];
+		if (shape->flags & IPT_INDEX_DPORT)
+			key.dport = ports[1];
+
+		/* Equal keys were inserted in rule order, so the first one
+		 * at or after @e along the probe sequence is the earliest.
+		 */
+		for (h = ipt_index_hash(idx, &key) & run->hmask;
+		     run->node[h].key.shape != 0;
+		     h = (h + 1) & run->hmask) {
+			const struct ipt_index_node *node = &run->node[h];
+
+			if (node->offset >= offset &&
+			    ipt_index_key_equal(&node->key, &key)) {
+				if (node->offset < best)
+					best = node->offset;
+				break;
+			}
+		}
+	}
+
+	*indexed = best != run->end;
+	return (struct ipt_entry *)(table_base + best);
+}
+
+static bool ipt_index_port(const __u16 *pts, __be16 *port,
+			   struct ipt_index_shape *shape, u8 flag)
+{
+	if (pts[0] == 0 && pts[1] == 0xFFFF)
+		return true;
+	if (pts[0] != pts[1])
+		return false;
+	*port = htons(pts[0]);
+	shape->flags |= flag;
+	return true;
+}
+
+/*
+ * Describes @e by its shape and key, or returns false if the rule looks
+ * at anything besides masked addresses, the protocol and single ports.
+ */
+static bool ipt_index_classify(const struct ipt_entry *e,
+			       struct ipt_index_shape *shape,
+			       struct ipt_index_key *key)
+{
+	const struct ipt_ip *ipinfo = &e->ip;
+	const struct xt_entry_match *ematch;
+	unsigned int i;
+
+	if ((ipinfo->flags & ~IPT_F_GOTO) || ipinfo->invflags)
+		return false;
+	for (i = 0; i < IFNAMSIZ; i++)
+		if (ipinfo->iniface_mask[i] || ipinfo->outiface_mask[i])
+			return false;
+	if ((ipinfo->src.s_addr & ~ipinfo->smsk.s_addr) ||
+	    (ipinfo->dst.s_addr & ~ipinfo->dmsk.s_addr))
+		return false;
+	if (strcmp(ipt_get_target_c(e)->u.kernel.target->name,
+		   XT_ERROR_TARGET) == 0)
+		return false;
+
+	memset(shape, 0, sizeof(*shape));
+	shape->smsk  = ipinfo->smsk.s_addr;
+	shape->dmsk  = ipinfo->dmsk.s_addr;
+	shape->proto = ipinfo->proto;
+
+	memset(key, 0, sizeof(*key));
+	key->saddr = ipinfo->src.s_addr;
+	key->daddr = ipinfo->dst.s_addr;
+	key->proto = ipinfo->proto;
+
+	xt_ematch_foreach(ematch, e) {
+		const char *name = ematch->u.kernel.match->name;
+		const __u16 *spts, *dpts;
+
+		if (strcmp(name, "comment") == 0)
+			continue;
+		if (shape->flags & IPT_INDEX_L4)
+			return false;
+
+		if (strcmp(name, "tcp") == 0 && ipinfo->proto == IPPROTO_TCP) {
+			const struct xt_tcp *tcpinfo = (const void *)ematch->data;
+
+			if (tcpinfo->option || tcpinfo->flg_mask ||
+			    tcpinfo->flg_cmp || tcpinfo->invflags)
+				return false;
+			spts = tcpinfo->spts;
+			dpts = tcpinfo->dpts;
+		} else if (strcmp(name, "udp") == 0 &&
+			   ipinfo->proto == IPPROTO_UDP) {
+			const struct xt_udp *udpinfo = (const void *)ematch->data;
+
+			if (udpinfo->invflags)
+				return false;
+			spts = udpinfo->spts;
+			dpts = udpinfo->dpts;
+		} else
+			return false;
+
+		if (!ipt_index_port(spts, &key->sport, shape, IPT_INDEX_SPORT) ||
+		    !ipt_index_port(dpts, &key->dport, shape, IPT_INDEX_DPORT))
+			return false;
+		shape->flags |= IPT_INDEX_L4;
+	}
+	return true;
+}
+
+static int ipt_index_add_shape(struct ipt_index_run *run,
+			       const struct ipt_index_shape *shape)
+{
+	unsigned int s;
+
+	for (s = 0; s < run->nshapes; s++)
+		if (memcmp(&run->shape[s], shape, sizeof(*shape)) == 0)
+			return s;
+	if (run->nshapes == IPT_INDEX_MAX_SHAPES)
+		return -1;
+	run->shape[run->nshapes] = *shape;
+	return run->nshapes++;
+}
+
+static void ipt_index_fill(struct ipt_index *idx, struct ipt_index_run *run,
+			   const void *entry0)
+{
+	const struct ipt_entry *iter;
+	unsigned int offset;
+
+	for (offset = run->start; offset < run->end;
+	     offset += iter->next_offset) {
+		struct ipt_index_shape shape;
+		struct ipt_index_key key;
+		unsigned int h;
+
+		iter = entry0 + offset;
+		ipt_index_classify(iter, &shape, &key);
+		key.shape = ipt_index_add_shape(run, &shape) + 1;
+
+		h = ipt_index_hash(idx, &key) & run->hmask;
+		while (run->node[h].key.shape != 0)
+			h = (h + 1) & run->hmask;
+		run->node[h].key    = key;
+		run->node[h].offset = offset;
+		__set_bit(ipt_index_slot(offset), idx->map);
+	}
+}
+
+/*
+ * Splits the table into runs of indexable rules.  With @idx NULL, only
+ * counts the runs and hash slots needed; otherwise fills them in.  The
+ * split is deterministic, so both passes see the same runs.
+ */
+static unsigned int ipt_index_scan(const void *entry0, unsigned int size,
+				   struct ipt_index *idx, unsigned int *nslots)
+{
+	struct ipt_index_node *node = NULL;
+	const struct ipt_entry *iter;
+	struct ipt_index_run run;
+	unsigned int nrules = 0, nruns = 0;
+
+	if (idx != NULL)
+		node = (struct ipt_index_node *)(idx->run + idx->nruns);
+	*nslots = 0;
+
+	xt_entry_foreach(iter, entry0, size) {
+		unsigned int offset = (void *)iter - entry0;
+		struct ipt_index_shape shape;
+		struct ipt_index_key key;
+		bool simple;
+
+		simple = ipt_index_classify(iter, &shape, &key);
+		if (simple && nrules > 0 && ipt_index_add_shape(&run, &shape) >= 0) {
+			run.end = offset + iter->next_offset;
+			++nrules;
+			continue;
+		}
+
+		if (nrules >= IPT_INDEX_MIN_RUN) {
+			run.hmask = roundup_pow_of_two(2 * nrules) - 1;
+			if (idx != NULL) {
+				run.node = node;
+				run.nshapes = 0;
+				ipt_index_fill(idx, &run, entry0);
+				idx->run[nruns] = run;
+				node += run.hmask + 1;
+			}
+			*nslots += run.hmask + 1;
+			++nruns;
+		}
+
+		nrules = 0;
+		if (simple) {
+			memset(&run, 0, sizeof(run));
+			run.start = offset;
+			run.end = offset + iter->next_offset;
+			ipt_index_add_shape(&run, &shape);
+			nrules = 1;
+		}
+	}
+	return nruns;
+}
+
+/* The index is an optimisation only: tables load fine without it. */
+static void ipt_index_build(struct xt_table_info *newinfo, const void *entry0)
+{
+	unsigned int nruns, nslots, maplen;
+	struct ipt_index *idx;
+
+	nruns = ipt_index_scan(entry0, newinfo->size, NULL, &nslots);
+	if (nruns == 0)
+		return;
+
+	maplen = BITS_TO_LONGS(ipt_index_slot(newinfo->size)) *
+		 sizeof(unsigned long);
+	idx = vzalloc(sizeof(*idx) + maplen +
+		      nruns * sizeof(struct ipt_index_run) +
+		      nslots * sizeof(struct ipt_index_node));
+	if (idx == NULL)
+		return;
+
+	get_random_bytes(&idx->seed, sizeof(idx->seed));
+	idx->nruns = nruns;
+	idx->run = (void *)idx->map + maplen;
+	ipt_index_scan(entry0, newinfo->size, idx, &nslots);
+	newinfo->index = idx;
+}
+#else
+static inline void ipt_index_build(struct xt_table_info *newinfo,
+				   const void *entry0)
+{
+}
+#endif /* CONFIG_IP_NF_IPTABLES_INDEX */
+
 /* Returns one of the generic firewall policies, like NF_ACCEPT. */
 unsigned int
 ipt_do_table(struct sk_buff *skb,
@@ -311,6 +688,10 @@ ipt_do_table(struct sk_buff *skb,
 	unsigned int *stackptr, origptr, cpu;
 	const struct xt_table_info *private;
 	struct xt_action_param acpar;
+#ifdef CONFIG_IP_NF_IPTABLES_INDEX
+	const struct ipt_index *index;
+	bool indexed = false;
+#endif
 
 	/* Initialization */
 	ip = ip_hdr(skb);
@@ -338,6 +719,9 @@ ipt_do_table(struct sk_buff *skb,
 	jumpstack  = (struct ipt_entry **)private->jumpstack[cpu];
 	stackptr   = per_cpu_ptr(private->stackptr, cpu);
 	origptr    = *stackptr;
+#ifdef CONFIG_IP_NF_IPTABLES_INDEX
+	index      = private->index;
+#endif
 
 	e = get_entry(table_base, private->hook_entry[hook]);
 
@@ -350,6 +734,16 @@ ipt_do_table(struct sk_buff *skb,
 		const struct xt_entry_match *ematch;
 
 		IP_NF_ASSERT(e);
+#ifdef CONFIG_IP_NF_IPTABLES_INDEX
+		if (index != NULL && !indexed &&
+		    test_bit(ipt_index_slot((void *)e - table_base),
+			     index->map)) {
+			e = ipt_index_lookup(index, table_base, e, skb,
+					     &acpar, &indexed);
+			continue;
+		}
+		indexed = false;
+#endif
 		if (!ip_packet_match(ip, indev, outdev,
 		    &e->ip, acpar.fragoff)) {
  no_match:
@@ -874,6 +1268,7 @@ translate_table(struct net *net, struct xt_table_info *newinfo, void *entry0,
 			memcpy(newinfo->entries[i], entry0, newinfo->size);
 	}
 
+	ipt_index_build(newinfo, entry0);
 	return ret;
 }
 
@@ -1771,6 +2166,7 @@ translate_compat_table(struct net *net,
 		if (newinfo->entries[i] && newinfo->entries[i] != entry1)
 			memcpy(newinfo->entries[i], entry1, newinfo->size);
 
+	ipt_index_build(newinfo, entry1);
 	*pinfo = newinfo;
 	*pentry0 = entry1;
 	xt_free_table_info(info);
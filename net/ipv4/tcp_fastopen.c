@@ -0,0 +1,127 @@
+/*
+ * TCP Fast Open: server side cookie generation and the client side
+ * per-destination cookie cache.
+ *
+ *	This program is free software; you can redistribute it and/or
+ *	modify it under the terms of the GNU General Public License
+ *	as published by the Free Software Foundation; either version
+ *	2 of the License, or (at your option) any later version.
+ */
+
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/random.h>
+#include <linux/cryptohash.h>
+#include <linux/slab.h>
+#include <linux/tcp.h>
+#include <linux/ipv6.h>
+#include <net/inetpeer.h>
+#include <net/tcp.h>
+
+int sysctl_tcp_fastopen __read_mostly;
+
+/* The cookie is a keyed hash of the client address.  Like syncookies, the
+ * trailing words of the secret double as the initial SHA digest.
+ */
+static __u32 tcp_fastopen_secret[16 - 1 + SHA_DIGEST_WORDS];
+
+static DEFINE_PER_CPU(__u32 [16 + 5 + SHA_WORKSPACE_WORDS],
+		      tcp_fastopen_scratch);
+
+static __init int tcp_fastopen_init(void)
+{
+	get_random_bytes(tcp_fastopen_secret, sizeof(tcp_fastopen_secret));
+	return 0;
+}
+__initcall(tcp_fastopen_init);
+
+/* Called from BH context, on receipt of a SYN. */
+void tcp_fastopen_cookie_gen(__be32 addr, struct tcp_fastopen_cookie *foc)
+{
+	__u32 *tmp = __get_cpu_var(tcp_fastopen_scratch);
+
+	memcpy(tmp + 1, tcp_fastopen_secret, sizeof(tcp_fastopen_secret));
+	tmp[0] = (__force u32)addr;
+	sha_transform(tmp + 16, (__u8 *)tmp, tmp + 16 + 5);
+
+	memcpy(foc->val, tmp + 16, TCP_FASTOPEN_COOKIE_SIZE);
+	foc->len = TCP_FASTOPEN_COOKIE_SIZE;
+}
+
+int tcp_fastopen_init_queue(struct sock *sk, int backlog)
+{
+	struct request_sock_queue *queue = &inet_csk(sk)->icsk_accept_queue;
+
+	if (queue->fastopenq == NULL) {
+		queue->fastopenq = kzalloc(sizeof(struct fastopen_queue),
+					   sk->sk_allocation);
+		if (queue->fastopenq == NULL)
+			return -ENOMEM;
+		spin_lock_init(&queue->fastopenq->lock);
+	}
+	queue->fastopenq->max_qlen = backlog;
+	return 0;
+}
+
+/* The client remembers, per destination, the cookie handed out by the
+ * server, the MSS it advertised and whether recent SYNs carrying data
+ * went unanswered.  The state lives in the inet_peer entry of the
+ * destination, next to the other per-peer TCP state.
+ */
+static DEFINE_SEQLOCK(fastopen_seqlock);
+
+static struct inet_peer *tcp_fastopen_getpeer(struct sock *sk, int create)
+{
+	if (sk->sk_family == AF_INET)
+		return inet_getpeer_v4(inet_sk(sk)->inet_daddr, create);
+#if defined(CONFIG_IPV6) || defined(CONFIG_IPV6_MODULE)
+	if (sk->sk_family == AF_INET6)
+		return inet_getpeer_v6(&inet6_sk(sk)->daddr, create);
+#endif
+	return NULL;
+}
+
+void tcp_fastopen_cache_get(struct sock *sk, u16 *mss,
+			    struct tcp_fastopen_cookie *cookie,
+			    int *syn_loss, unsigned long *last_syn_loss)
+{
+	struct inet_peer *peer = tcp_fastopen_getpeer(sk, 0);
+	unsigned int seq;
+
+	if (peer == NULL)
+		return;
+
+	do {
+		seq = read_seqbegin(&fastopen_seqlock);
+		if (peer->tcp_fastopen_mss)
+			*mss = peer->tcp_fastopen_mss;
+		*cookie = peer->tcp_fastopen_cookie;
+		*syn_loss = peer->tcp_fastopen_syn_loss;
+		*last_syn_loss = *syn_loss ?
+				 peer->tcp_fastopen_syn_loss_ts : 0;
+	} while (read_seqretry(&fastopen_seqlock, seq));
+
+	inet_putpeer(peer);
+}
+
+void tcp_fastopen_cache_set(struct sock *sk, u16 mss,
+			    struct tcp_fastopen_cookie *cookie, bool syn_lost)
+{
+	struct inet_peer *peer = tcp_fastopen_getpeer(sk, 1);
+
+	if (peer == NULL)
+		return;
+
+	write_seqlock_bh(&fastopen_seqlock);
+	peer->tcp_fastopen_mss = mss;
+	if (cookie->len > 0)
+		peer->tcp_fastopen_cookie = *cookie;
+	if (syn_lost) {
+		++peer->tcp_fastopen_syn_loss;
+		peer->tcp_fastopen_syn_loss_ts = jiffies;
+	} else
+		peer->tcp_fastopen_syn_loss = 0;
+	write_sequnlock_bh(&fastopen_seqlock);
+
+	inet_putpeer(peer);
+}
@@ -179,7 +179,8 @@ clean_from_lists(struct nf_conn *ct)
 {
 	pr_debug("clean_from_lists(%p)\n", ct);
 	hlist_nulls_del_rcu(&ct->tuplehash[IP_CT_DIR_ORIGINAL].hnnode);
-	hlist_nulls_del_rcu(&ct->tuplehash[IP_CT_DIR_REPLY].hnnode);
+	/* Leaves the reply node unhashed: nf_ct_delete() relies on it. */
+	hlist_nulls_del_init_rcu(&ct->tuplehash[IP_CT_DIR_REPLY].hnnode);
 
 	/* Destroy all pending expectations */
 	nf_ct_remove_expectations(ct);
@@ -194,7 +195,6 @@ destroy_conntrack(struct nf_conntrack *nfct)
 
 	pr_debug("destroy_conntrack(%p)\n", ct);
 	NF_CT_ASSERT(atomic_read(&nfct->use) == 0);
-	NF_CT_ASSERT(!timer_pending(&ct->timeout));
 
 	/* To make sure we don't get any weird locking issues here:
 	 * destroy_conntrack() MUST NOT be called with a write lock
@@ -229,75 +229,75 @@ destroy_conntrack(struct nf_conntrack *nfct)
 	nf_conntrack_free(ct);
 }
 
-void nf_ct_delete_from_lists(struct nf_conn *ct)
+static void nf_ct_insert_dying_list(struct nf_conn *ct)
 {
 	struct net *net = nf_ct_net(ct);
 
-	nf_ct_helper_destroy(ct);
-	spin_lock_bh(&nf_conntrack_lock);
-	/* Inside lock so preempt is disabled on module removal path.
-	 * Otherwise we can get spurious warnings. */
-	NF_CT_STAT_INC(net, delete_list);
-	clean_from_lists(ct);
-	spin_unlock_bh(&nf_conntrack_lock);
-}
-EXPORT_SYMBOL_GPL(nf_ct_delete_from_lists);
-
-static void death_by_event(unsigned long ul_conntrack)
-{
-	struct nf_conn *ct = (void *)ul_conntrack;
-	struct net *net = nf_ct_net(ct);
-
-	if (nf_conntrack_event(IPCT_DESTROY, ct) < 0) {
-		/* bad luck, let's retry again */
-		ct->timeout.expires = jiffies +
-			(random32() % net->ct.sysctl_events_retry_timeout);
-		add_timer(&ct->timeout);
-		return;
-	}
-	/* we've got the event delivered, now it's dying */
-	set_bit(IPS_DYING_BIT, &ct->status);
-	spin_lock(&nf_conntrack_lock);
-	hlist_nulls_del(&ct->tuplehash[IP_CT_DIR_ORIGINAL].hnnode);
-	spin_unlock(&nf_conntrack_lock);
-	nf_ct_put(ct);
-}
-
-void nf_ct_insert_dying_list(struct nf_conn *ct)
-{
-	struct net *net = nf_ct_net(ct);
+	/* the gc worker retries the event once ct->timeout has passed */
+	ct->timeout = jiffies + 1 +
+		(random32() % net->ct.sysctl_events_retry_timeout);
 
 	/* add this conntrack to the dying list */
 	spin_lock_bh(&nf_conntrack_lock);
 	hlist_nulls_add_head(&ct->tuplehash[IP_CT_DIR_ORIGINAL].hnnode,
 			     &net->ct.dying);
 	spin_unlock_bh(&nf_conntrack_lock);
-	/* set a new timer to retry event delivery */
-	setup_timer(&ct->timeout, death_by_event, (unsigned long)ct);
-	ct->timeout.expires = jiffies +
-		(random32() % net->ct.sysctl_events_retry_timeout);
-	add_timer(&ct->timeout);
 }
-EXPORT_SYMBOL_GPL(nf_ct_insert_dying_list);
 
-static void death_by_timeout(unsigned long ul_conntrack)
+/*
+ * Unlink a confirmed conntrack from the hash table, report its death
+ * and drop the reference the table held.  Returns false if the entry
+ * was not in the table, e.g. because someone else got there first.
+ */
+bool nf_ct_delete(struct nf_conn *ct, u32 pid, int report)
 {
-	struct nf_conn *ct = (void *)ul_conntrack;
+	struct net *net = nf_ct_net(ct);
 	struct nf_conn_tstamp *tstamp;
 
+	/* The reply tuple stays hashed for as long as the entry is in the
+	 * table, so whoever unhashes it owns the teardown. */
+	spin_lock_bh(&nf_conntrack_lock);
+	if (!nf_ct_is_confirmed(ct) ||
+	    hlist_nulls_unhashed(&ct->tuplehash[IP_CT_DIR_REPLY].hnnode)) {
+		spin_unlock_bh(&nf_conntrack_lock);
+		return false;
+	}
+	/* Inside lock so preempt is disabled on module removal path.
+	 * Otherwise we can get spurious warnings. */
+	NF_CT_STAT_INC(net, delete_list);
+	clean_from_lists(ct);
+	spin_unlock_bh(&nf_conntrack_lock);
+
+	nf_ct_helper_destroy(ct);
+
 	tstamp = nf_conn_tstamp_find(ct);
 	if (tstamp && tstamp->stop == 0)
 		tstamp->stop = ktime_to_ns(ktime_get_real());
 
 	if (!test_bit(IPS_DYING_BIT, &ct->status) &&
-	    unlikely(nf_conntrack_event(IPCT_DESTROY, ct) < 0)) {
+	    unlikely(nf_conntrack_event_report(IPCT_DESTROY, ct,
+					       pid, report) < 0)) {
 		/* destroy event was not delivered */
-		nf_ct_delete_from_lists(ct);
 		nf_ct_insert_dying_list(ct);
-		return;
+		return true;
 	}
 	set_bit(IPS_DYING_BIT, &ct->status);
-	nf_ct_delete_from_lists(ct);
+	nf_ct_put(ct);
+	return true;
+}
+EXPORT_SYMBOL_GPL(nf_ct_delete);
+
+/* Reap an entry found expired by a lockless walk of the hash table. */
+static void nf_ct_gc_expired(struct nf_conn *ct)
+{
+	if (!atomic_inc_not_zero(&ct->ct_general.use))
+		return;
+
+	/* The slab is SLAB_DESTROY_BY_RCU: recheck now that we hold it. */
+	if (nf_ct_is_confirmed(ct) && !nf_ct_is_dying(ct) &&
+	    nf_ct_is_expired(ct))
+		nf_ct_kill(ct);
+
 	nf_ct_put(ct);
 }
 
@@ -310,10 +310,12 @@ static void death_by_timeout(unsigned long ul_conntrack)
  */
 static struct nf_conntrack_tuple_hash *
 ____nf_conntrack_find(struct net *net, u16 zone,
-		      const struct nf_conntrack_tuple *tuple, u32 hash)
+		      const struct nf_conntrack_tuple *tuple, u32 hash,
+		      bool gc)
 {
 	struct nf_conntrack_tuple_hash *h;
 	struct hlist_nulls_node *n;
+	struct nf_conn *ct;
 	unsigned int bucket = hash_bucket(hash, net);
 
 	/* Disable BHs the entire time since we normally need to disable them
@@ -322,8 +324,15 @@ ____nf_conntrack_find(struct net *net, u16 zone,
 	local_bh_disable();
 begin:
 	hlist_nulls_for_each_entry_rcu(h, n, &net->ct.hash[bucket], hnnode) {
+		ct = nf_ct_tuplehash_to_ctrack(h);
 		if (nf_ct_tuple_equal(tuple, &h->tuple) &&
-		    nf_ct_zone(nf_ct_tuplehash_to_ctrack(h)) == zone) {
+		    nf_ct_zone(ct) == zone) {
+			/* Not yet reaped by the gc worker: a new packet
+			 * for this tuple starts a new connection. */
+			if (gc && nf_ct_is_expired(ct)) {
+				nf_ct_gc_expired(ct);
+				continue;
+			}
 			NF_CT_STAT_INC(net, found);
 			local_bh_enable();
 			return h;
@@ -349,21 +358,26 @@ __nf_conntrack_find(struct net *net, u16 zone,
 		    const struct nf_conntrack_tuple *tuple)
 {
 	return ____nf_conntrack_find(net, zone, tuple,
-				     hash_conntrack_raw(tuple, zone));
+				     hash_conntrack_raw(tuple, zone), false);
 }
 EXPORT_SYMBOL_GPL(__nf_conntrack_find);
 
-/* Find a connection corresponding to a tuple. */
+/*
+ * Find a connection corresponding to a tuple.  Only the packet path
+ * sets gc: reaping an expired entry takes nf_conntrack_lock, which
+ * other callers (ctnetlink) may already hold.
+ */
 static struct nf_conntrack_tuple_hash *
 __nf_conntrack_find_get(struct net *net, u16 zone,
-			const struct nf_conntrack_tuple *tuple, u32 hash)
+			const struct nf_conntrack_tuple *tuple, u32 hash,
+			bool gc)
 {
 	struct nf_conntrack_tuple_hash *h;
 	struct nf_conn *ct;
 
 	rcu_read_lock();
 begin:
-	h = ____nf_conntrack_find(net, zone, tuple, hash);
+	h = ____nf_conntrack_find(net, zone, tuple, hash, gc);
 	if (h) {
 		ct = nf_ct_tuplehash_to_ctrack(h);
 		if (unlikely(nf_ct_is_dying(ct) ||
@@ -387,7 +401,7 @@ nf_conntrack_find_get(struct net *net, u16 zone,
 		      const struct nf_conntrack_tuple *tuple)
 {
 	return __nf_conntrack_find_get(net, zone, tuple,
-				       hash_conntrack_raw(tuple, zone));
+				       hash_conntrack_raw(tuple, zone), false);
 }
 EXPORT_SYMBOL_GPL(nf_conntrack_find_get);
 
@@ -487,11 +501,10 @@ __nf_conntrack_confirm(struct sk_buff *skb)
 	/* Remove from unconfirmed list */
 	hlist_nulls_del_rcu(&ct->tuplehash[IP_CT_DIR_ORIGINAL].hnnode);
 
-	/* Timer relative to confirmation time, not original
+	/* Timeout relative to confirmation time, not original
 	   setting time, otherwise we'd get timer wrap in
 	   weird delay cases. */
-	ct->timeout.expires += jiffies;
-	add_timer(&ct->timeout);
+	ct->timeout += jiffies;
 	atomic_inc(&ct->ct_general.use);
 	ct->status |= IPS_CONFIRMED;
 
@@ -504,7 +517,7 @@ __nf_conntrack_confirm(struct sk_buff *skb)
 		tstamp->start = ktime_to_ns(skb->tstamp);
 	}
 	/* Since the lookup is lockless, hash insertion must be done after
-	 * starting the timer and setting the CONFIRMED bit. The RCU barriers
+	 * setting the timeout and the CONFIRMED bit. The RCU barriers
 	 * guarantee that no other CPU can find the conntrack before the above
 	 * stores are visible.
 	 */
@@ -567,11 +580,13 @@ EXPORT_SYMBOL_GPL(nf_conntrack_tuple_taken);
    connection.  Too bad: we're in trouble anyway. */
 static noinline int early_drop(struct net *net, unsigned int hash)
 {
-	/* Use oldest entry, which is roughly LRU */
+	/* Use an expired entry if there is one, else the oldest
+	   unassured entry, which is roughly LRU */
 	struct nf_conntrack_tuple_hash *h;
 	struct nf_conn *ct = NULL, *tmp;
 	struct hlist_nulls_node *n;
 	unsigned int i, cnt = 0;
+	bool expired = false;
 	int dropped = 0;
 
 	rcu_read_lock();
@@ -579,6 +594,11 @@ static noinline int early_drop(struct net *net, unsigned int hash)
 		hlist_nulls_for_each_entry_rcu(h, n, &net->ct.hash[hash],
 					 hnnode) {
 			tmp = nf_ct_tuplehash_to_ctrack(h);
+			if (nf_ct_is_expired(tmp)) {
+				ct = tmp;
+				expired = true;
+				break;
+			}
 			if (!test_bit(IPS_ASSURED_BIT, &tmp->status))
 				ct = tmp;
 			cnt++;
@@ -588,8 +608,8 @@ static noinline int early_drop(struct net *net, unsigned int hash)
 			if (likely(!nf_ct_is_dying(ct) &&
 				   atomic_inc_not_zero(&ct->ct_general.use)))
 				break;
-			else
-				ct = NULL;
+			ct = NULL;
+			expired = false;
 		}
 
 		if (cnt >= NF_CT_EVICTION_RANGE)
@@ -602,10 +622,10 @@ static noinline int early_drop(struct net *net, unsigned int hash)
 	if (!ct)
 		return dropped;
 
-	if (del_timer(&ct->timeout)) {
-		death_by_timeout((unsigned long)ct);
+	if (nf_ct_kill(ct)) {
 		dropped = 1;
-		NF_CT_STAT_INC_ATOMIC(net, early_drop);
+		if (!expired)
+			NF_CT_STAT_INC_ATOMIC(net, early_drop);
 	}
 	nf_ct_put(ct);
 	return dropped;
@@ -678,8 +698,7 @@ __nf_conntrack_alloc(struct net *net, u16 zone,
 	ct->tuplehash[IP_CT_DIR_REPLY].tuple = *repl;
 	/* save hash for reusing when confirming */
 	*(unsigned long *)(&ct->tuplehash[IP_CT_DIR_REPLY].hnnode.pprev) = hash;
-	/* Don't set timer yet: wait for confirmation */
-	setup_timer(&ct->timeout, death_by_timeout, (unsigned long)ct);
+	/* ct->timeout is relative until confirmation */
 	write_pnet(&ct->ct_net, net);
 #ifdef CONFIG_NF_CONNTRACK_ZONES
 	if (zone) {
@@ -837,7 +856,7 @@ resolve_normal_ct(struct net *net, struct nf_conn *tmpl,
 
 	/* look for tuple match */
 	hash = hash_conntrack_raw(&tuple, zone);
-	h = __nf_conntrack_find_get(net, zone, &tuple, hash);
+	h = __nf_conntrack_find_get(net, zone, &tuple, hash, true);
 	if (!h) {
 		h = init_conntrack(net, tmpl, &tuple, l3proto, l4proto,
 				   skb, dataoff, hash);
@@ -1018,24 +1037,23 @@ void __nf_ct_refresh_acct(struct nf_conn *ct,
 			  unsigned long extra_jiffies,
 			  int do_acct)
 {
-	NF_CT_ASSERT(ct->timeout.data == (unsigned long)ct);
 	NF_CT_ASSERT(skb);
 
 	/* Only update if this is not a fixed timeout */
 	if (test_bit(IPS_FIXED_TIMEOUT_BIT, &ct->status))
 		goto acct;
 
-	/* If not in hash table, timer will not be active yet */
+	/* If not in hash table, the timeout is relative until confirmed */
 	if (!nf_ct_is_confirmed(ct)) {
-		ct->timeout.expires = extra_jiffies;
+		ct->timeout = extra_jiffies;
 	} else {
 		unsigned long newtime = jiffies + extra_jiffies;
 
 		/* Only update the timeout if the new timeout is at least
-		   HZ jiffies from the old timeout. Need del_timer for race
-		   avoidance (may already be dying). */
-		if (newtime - ct->timeout.expires >= HZ)
-			mod_timer_pending(&ct->timeout, newtime);
+		   HZ jiffies from the old timeout, to avoid dirtying the
+		   cache line on every packet. */
+		if (newtime - ct->timeout >= HZ)
+			ct->timeout = newtime;
 	}
 
 acct:
@@ -1071,11 +1089,7 @@ bool __nf_ct_kill_acct(struct nf_conn *ct,
 		}
 	}
 
-	if (del_timer(&ct->timeout)) {
-		ct->timeout.function((unsigned long)ct);
-		return true;
-	}
-	return false;
+	return nf_ct_delete(ct, 0, 0);
 }
 EXPORT_SYMBOL_GPL(__nf_ct_kill_acct);
 
@@ -1192,10 +1206,7 @@ void nf_ct_iterate_cleanup(struct net *net,
 
 	while ((ct = get_next_corpse(net, iter, data, &bucket)) != NULL) {
 		/* Time to push up daises... */
-		if (del_timer(&ct->timeout))
-			death_by_timeout((unsigned long)ct);
-		/* ... else the timer will get him soon. */
-
+		nf_ct_kill(ct);
 		nf_ct_put(ct);
 	}
 }
@@ -1215,12 +1226,12 @@ static int kill_report(struct nf_conn *i, void *data)
 	if (tstamp && tstamp->stop == 0)
 		tstamp->stop = ktime_to_ns(ktime_get_real());
 
-	/* If we fail to deliver the event, death_by_timeout() will retry */
+	/* If we fail to deliver the event, nf_ct_delete() will retry */
 	if (nf_conntrack_event_report(IPCT_DESTROY, i,
 				      fr->pid, fr->report) < 0)
 		return 1;
 
-	/* Avoid the delivery of the destroy event in death_by_timeout(). */
+	/* Avoid the delivery of the destroy event in nf_ct_delete(). */
 	set_bit(IPS_DYING_BIT, &i->status);
 	return 1;
 }
@@ -1250,21 +1261,100 @@ void nf_conntrack_flush_report(struct net *net, u32 pid, int report)
 }
 EXPORT_SYMBOL_GPL(nf_conntrack_flush_report);
 
-static void nf_ct_release_dying_list(struct net *net)
+/*
+ * Retry the destroy events that could not be delivered before.  Unless
+ * @all is set, only entries whose retry time has come are considered.
+ */
+static void nf_ct_dying_redeliver(struct net *net, bool all)
 {
 	struct nf_conntrack_tuple_hash *h;
-	struct nf_conn *ct;
 	struct hlist_nulls_node *n;
+	unsigned long now = jiffies;
+	struct nf_conn *ct;
 
+restart:
 	spin_lock_bh(&nf_conntrack_lock);
 	hlist_nulls_for_each_entry(h, n, &net->ct.dying, hnnode) {
 		ct = nf_ct_tuplehash_to_ctrack(h);
-		/* never fails to remove them, no listeners at this point */
-		nf_ct_kill(ct);
+		if (!all && (long)(ct->timeout - now) > 0)
+			continue;
+
+		hlist_nulls_del(&ct->tuplehash[IP_CT_DIR_ORIGINAL].hnnode);
+		spin_unlock_bh(&nf_conntrack_lock);
+
+		if (nf_conntrack_event(IPCT_DESTROY, ct) < 0) {
+			/* bad luck, let's retry again */
+			nf_ct_insert_dying_list(ct);
+		} else {
+			/* we've got the event delivered, now it's dying */
+			set_bit(IPS_DYING_BIT, &ct->status);
+			nf_ct_put(ct);
+		}
+		goto restart;
 	}
 	spin_unlock_bh(&nf_conntrack_lock);
 }
 
+static void nf_ct_release_dying_list(struct net *net)
+{
+	/* never fails to remove them, no listeners at this point */
+	nf_ct_dying_redeliver(net, true);
+}
+
+/*
+ * Each run of the gc worker walks 1/GC_MAX_BUCKETS_DIV of the hash
+ * table, so the whole table is covered every
+ * GC_MAX_BUCKETS_DIV * GC_INTERVAL.  A run stops early after
+ * GC_MAX_EVICTS evictions and is repeated right away if most of what it
+ * looked at had expired.
+ */
+#define GC_MAX_BUCKETS_DIV	16u
+#define GC_MAX_EVICTS		256u
+#define GC_INTERVAL		HZ
+
+static void gc_worker(struct work_struct *work)
+{
+	struct net *net = container_of(to_delayed_work(work), struct net,
+				       ct.gc_work);
+	unsigned int i, goal, buckets = 0, scanned = 0, expired = 0;
+	unsigned long next_run = GC_INTERVAL;
+
+	goal = max(net->ct.htable_size / GC_MAX_BUCKETS_DIV, 1u);
+	i = net->ct.gc_bucket;
+
+	do {
+		struct nf_conntrack_tuple_hash *h;
+		struct hlist_nulls_node *n;
+		struct nf_conn *ct;
+
+		rcu_read_lock();
+		if (i >= net->ct.htable_size)
+			i = 0;
+		hlist_nulls_for_each_entry_rcu(h, n, &net->ct.hash[i],
+					       hnnode) {
+			ct = nf_ct_tuplehash_to_ctrack(h);
+			scanned++;
+			if (nf_ct_is_expired(ct)) {
+				nf_ct_gc_expired(ct);
+				expired++;
+			}
+		}
+		rcu_read_unlock();
+		i++;
+		cond_resched();
+	} while (++buckets < goal && expired < GC_MAX_EVICTS);
+
+	net->ct.gc_bucket = i;
+
+	nf_ct_dying_redeliver(net, false);
+
+	if (expired >= GC_MAX_EVICTS ||
+	    (scanned && expired * 100 / scanned >= 90))
+		next_run = 0;
+
+	schedule_delayed_work(&net->ct.gc_work, next_run);
+}
+
 static int untrack_refs(void)
 {
 	int cnt = 0, cpu;
@@ -1291,6 +1381,7 @@ static void nf_conntrack_cleanup_init_net(void)
 
 static void nf_conntrack_cleanup_net(struct net *net)
 {
+	cancel_delayed_work_sync(&net->ct.gc_work);
  i_see_dead_people:
 	nf_ct_iterate_cleanup(net, kill_all, NULL);
 	nf_ct_release_dying_list(net);
@@ -1533,6 +1624,8 @@ static int nf_conntrack_init_net(struct net *net)
 	if (ret < 0)
 		goto err_ecache;
 
+	INIT_DELAYED_WORK(&net->ct.gc_work, gc_worker);
+	schedule_delayed_work(&net->ct.gc_work, GC_INTERVAL);
 	return 0;
 
 err_ecache:
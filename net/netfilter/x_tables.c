@@ -719,6 +719,8 @@ void xt_free_table_info(struct xt_table_info *info)
 	else
 		kfree(info->jumpstack);
 
+	vfree(info->index);
+
 	free_percpu(info->stackptr);
 
 	kfree(info);
@@ -234,8 +234,9 @@ conntrack_mt(const struct sk_buff *skb, struct xt_action_param *par,
 	if (info->match_flags & XT_CONNTRACK_EXPIRES) {
 		unsigned long expires = 0;
 
-		if (timer_pending(&ct->timeout))
-			expires = (ct->timeout.expires - jiffies) / HZ;
+		/* the timeout is relative until the entry is confirmed */
+		if (test_bit(IPS_CONFIRMED_BIT, &ct->status))
+			expires = nf_ct_expires(ct) / HZ;
 		if ((expires >= info->expires_min &&
 		    expires <= info->expires_max) ^
 		    !(info->invert_flags & XT_CONNTRACK_EXPIRES))
@@ -0,0 +1,713 @@
+/*
+ * netmap: packet I/O through rings shared with userspace
+ *
+ * A /dev/netmap descriptor bound to an interface exposes one TX and one
+ * RX ring of slots plus the packet buffers they point to, all in a
+ * single vmalloc()ed area the application mmap()s.  Packets move with
+ * one ioctl() or poll() per batch instead of one system call and one
+ * socket buffer per packet.
+ *
+ * Drivers with native support (see struct netmap_adapter) work on their
+ * own descriptor rings in the sync callbacks.  Every other interface is
+ * driven in generic mode: received frames are diverted by an rx_handler
+ * and copied into the RX ring, TX slots are sent as ordinary skbs.  The
+ * host stack keeps transmitting on the same queue in generic mode.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/fs.h>
+#include <linux/miscdevice.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/slab.h>
+#include <linux/poll.h>
+#include <linux/netdevice.h>
+#include <linux/etherdevice.h>
+#include <linux/if_arp.h>
+#include <linux/rtnetlink.h>
+#include <linux/skbuff.h>
+#include <linux/kref.h>
+#include <linux/workqueue.h>
+#include <linux/nsproxy.h>
+#include <linux/netmap.h>
+#include <net/net_namespace.h>
+#include <asm/uaccess.h>
+
+static unsigned int ring_size __read_mostly = 256;
+module_param(ring_size, uint, 0644);
+MODULE_PARM_DESC(ring_size, "Slots per ring unless the driver asks otherwise");
+
+#define NETMAP_MIN_SLOTS	8
+#define NETMAP_MAX_SLOTS	4096
+
+/* One per open /dev/netmap */
+struct netmap_priv {
+	struct list_head	list;		/* netmap_bound, under RTNL */
+	struct mutex		lock;		/* binding and syncs */
+	struct netmap_adapter	*na;		/* NULL unless bound */
+	struct net_device	*dev;
+
+	/*
+	 * The shared area outlives the binding: the application may still
+	 * have it mapped after the interface went away.
+	 */
+	void			*mem;
+	size_t			memsize;
+
+	wait_queue_head_t	wait;
+
+	/*
+	 * Generic mode TX skbs still owned by the driver.  Each holds a
+	 * reference, so the last one may well be dropped in softirq
+	 * context; the area is then freed from a work item.
+	 */
+	atomic_t		tx_inflight;
+	struct kref		kref;
+	struct work_struct	free_work;
+};
+
+struct netmap_generic_adapter {
+	struct netmap_adapter	up;
+	struct netmap_priv	*priv;
+};
+
+static LIST_HEAD(netmap_bound);
+
+static void netmap_priv_free_work(struct work_struct *work)
+{
+	struct netmap_priv *priv = container_of(work, struct netmap_priv,
+						free_work);
+
+	vfree(priv->mem);
+	kfree(priv);
+	module_put(THIS_MODULE);
+}
+
+static void netmap_priv_release(struct kref *kref)
+{
+	struct netmap_priv *priv = container_of(kref, struct netmap_priv, kref);
+
+	schedule_work(&priv->free_work);
+}
+
+static inline void netmap_priv_put(struct netmap_priv *priv)
+{
+	kref_put(&priv->kref, netmap_priv_release);
+}
+
+/* Is i within [from, to] going round the ring? */
+static inline bool netmap_in_range(const struct netmap_kring *kring,
+				   u32 i, u32 from, u32 to)
+{
+	u32 n = kring->num_slots;
+
+	return (i + n - from) % n <= (to + n - from) % n;
+}
+
+/* Slots the application owns */
+static inline u32 netmap_kring_space(const struct netmap_kring *kring)
+{
+	u32 n = kring->num_slots;
+
+	return (kring->nr_hwtail + n - kring->rhead) % n;
+}
+
+/*
+ * Generic mode.
+ */
+
+static rx_handler_result_t netmap_generic_rx(struct sk_buff **pskb)
+{
+	struct sk_buff *skb = *pskb;
+	struct netmap_adapter *na = rcu_dereference(skb->dev->rx_handler_data);
+	struct netmap_kring *kring = &na->rx_ring;
+	struct netmap_ring *ring = kring->ring;
+	struct netmap_slot *slot;
+	int off = skb_mac_header(skb) - skb->data;
+	unsigned int len = skb->len - off;
+	bool delivered = false;
+	void *buf;
+	u32 i;
+
+	spin_lock(&kring->lock);
+	i = kring->nr_hwtail;
+	if (unlikely(netmap_next(kring, i) == kring->nr_hwcur ||
+		     len > NETMAP_BUF_SIZE))
+		goto drop;
+
+	slot = &ring->slot[i];
+	buf = netmap_buf(na, slot);
+	/* The skb may be shared, copy from the MAC header without a push */
+	if (unlikely(!buf) || skb_copy_bits(skb, off, buf, len))
+		goto drop;
+	netmap_buf_for_user(buf, len);
+	slot->len = len;
+	slot->flags = 0;
+
+	kring->nr_hwtail = netmap_next(kring, i);
+	smp_wmb();
+	ring->tail = kring->nr_hwtail;
+	delivered = true;
+drop:
+	spin_unlock(&kring->lock);
+
+	if (delivered) {
+		netmap_wake(na);
+		consume_skb(skb);
+	} else {
+		atomic_long_inc(&skb->dev->rx_dropped);
+		kfree_skb(skb);
+	}
+	return RX_HANDLER_CONSUMED;
+}
+
+static void netmap_generic_tx_destruct(struct sk_buff *skb)
+{
+	struct netmap_priv *priv = skb_shinfo(skb)->destructor_arg;
+
+	atomic_dec(&priv->tx_inflight);
+	wake_up_interruptible(&priv->wait);
+	netmap_priv_put(priv);
+}
+
+static int netmap_generic_txsync(struct netmap_adapter *na)
+{
+	struct netmap_priv *priv = container_of(na,
+			struct netmap_generic_adapter, up)->priv;
+	struct net_device *dev = na->ifp;
+	struct netmap_kring *kring = &na->tx_ring;
+	struct netmap_ring *ring = kring->ring;
+	u32 i, n = kring->num_slots;
+
+	for (i = kring->nr_hwcur; i != kring->rhead; i = netmap_next(kring, i)) {
+		struct netmap_slot *slot = &ring->slot[i];
+		unsigned int len = ACCESS_ONCE(slot->len);
+		void *buf = netmap_buf(na, slot);
+		struct sk_buff *skb;
+
+		if (unlikely(!buf || len < ETH_HLEN || len > NETMAP_BUF_SIZE)) {
+			dev->stats.tx_dropped++;
+			continue;
+		}
+
+		skb = alloc_skb(LL_RESERVED_SPACE(dev) + len, GFP_ATOMIC);
+		if (unlikely(!skb))
+			break;	/* retried on the next sync */
+		skb_reserve(skb, LL_RESERVED_SPACE(dev));
+		netmap_buf_for_kernel(buf, len);
+		skb_copy_to_linear_data(skb, buf, len);
+		skb_put(skb, len);
+		skb_reset_mac_header(skb);
+		skb_set_network_header(skb, ETH_HLEN);
+		skb->protocol = eth_hdr(skb)->h_proto;
+		skb->dev = dev;
+
+		/* Holds the slot until the driver is done with the skb */
+		kref_get(&priv->kref);
+		atomic_inc(&priv->tx_inflight);
+		skb->destructor = netmap_generic_tx_destruct;
+		skb_shinfo(skb)->destructor_arg = priv;
+
+		dev_queue_xmit(skb);
+	}
+	kring->nr_hwcur = i;
+	kring->nr_hwtail = (i + n - 1 - atomic_read(&priv->tx_inflight)) % n;
+
+	return 0;
+}
+
+static int netmap_generic_rxsync(struct netmap_adapter *na)
+{
+	/* netmap_generic_rx() fills the ring as frames come in */
+	return 0;
+}
+
+static int netmap_generic_register(struct netmap_adapter *na, int onoff)
+{
+	int err = 0;
+
+	if (onoff) {
+		err = netdev_rx_handler_register(na->ifp, netmap_generic_rx, na);
+	} else {
+		netdev_rx_handler_unregister(na->ifp);
+		synchronize_net();
+	}
+	return err;
+}
+
+static struct netmap_adapter *netmap_generic_alloc(struct netmap_priv *priv,
+						   struct net_device *dev)
+{
+	struct netmap_generic_adapter *gna;
+
+	gna = kzalloc(sizeof(*gna), GFP_KERNEL);
+	if (!gna)
+		return NULL;
+
+	gna->priv = priv;
+	gna->up.ifp = dev;
+	gna->up.generic = 1;
+	gna->up.nm_register = netmap_generic_register;
+	gna->up.nm_txsync = netmap_generic_txsync;
+	gna->up.nm_rxsync = netmap_generic_rxsync;
+
+	return &gna->up;
+}
+
+/*
+ * Shared area: netmap_if, the TX ring, the RX ring and, starting on a
+ * page boundary, one buffer per slot.  Buffers are NETMAP_BUF_SIZE
+ * aligned and so never cross a page, which lets drivers DMA straight
+ * to and from them.
+ */
+static size_t netmap_ring_bytes(u32 slots)
+{
+	return ALIGN(sizeof(struct netmap_ring) +
+		     slots * sizeof(struct netmap_slot), SMP_CACHE_BYTES);
+}
+
+static void netmap_kring_init(struct netmap_kring *kring,
+			      struct netmap_ring *ring, u32 slots,
+			      size_t ring_ofs, size_t buf_ofs, u32 first_buf)
+{
+	u32 i;
+
+	ring->num_slots = slots;
+	ring->buf_size = NETMAP_BUF_SIZE;
+	ring->buf_ofs = buf_ofs - ring_ofs;
+	for (i = 0; i < slots; i++)
+		ring->slot[i].buf_idx = first_buf + i;
+
+	kring->ring = ring;
+	kring->num_slots = slots;
+	spin_lock_init(&kring->lock);
+}
+
+static int netmap_mem_init(struct netmap_priv *priv, struct netmap_adapter *na,
+			   u32 ntx, u32 nrx)
+{
+	size_t if_bytes, tx_ofs, rx_ofs, buf_ofs;
+	struct netmap_if *nifp;
+
+	if_bytes = ALIGN(sizeof(struct netmap_if) + 2 * sizeof(__s64),
+			 SMP_CACHE_BYTES);
+	tx_ofs = if_bytes;
+	rx_ofs = tx_ofs + netmap_ring_bytes(ntx);
+	buf_ofs = PAGE_ALIGN(rx_ofs + netmap_ring_bytes(nrx));
+
+	priv->memsize = buf_ofs + (size_t)(ntx + nrx) * NETMAP_BUF_SIZE;
+	priv->memsize = PAGE_ALIGN(priv->memsize);
+	priv->mem = vmalloc_user(priv->memsize);
+	if (!priv->mem)
+		return -ENOMEM;
+
+	nifp = priv->mem;
+	strlcpy(nifp->ni_name, na->ifp->name, IFNAMSIZ);
+	nifp->ni_version = NETMAP_API;
+	nifp->ni_flags = na->generic ? NI_GENERIC : 0;
+	nifp->ni_tx_rings = 1;
+	nifp->ni_rx_rings = 1;
+	nifp->ring_ofs[0] = tx_ofs;
+	nifp->ring_ofs[1] = rx_ofs;
+
+	netmap_kring_init(&na->tx_ring, priv->mem + tx_ofs, ntx,
+			  tx_ofs, buf_ofs, 0);
+	netmap_kring_init(&na->rx_ring, priv->mem + rx_ofs, nrx,
+			  rx_ofs, buf_ofs, ntx);
+
+	/* The application starts out owning every TX slot but one */
+	na->tx_ring.nr_hwtail = na->tx_ring.ring->tail = ntx - 1;
+
+	na->buf_base = priv->mem + buf_ofs;
+	na->num_bufs = ntx + nrx;
+	na->wait = &priv->wait;
+
+	return 0;
+}
+
+static u32 netmap_slots(u32 want)
+{
+	return clamp_t(u32, want ? : ring_size,
+		       NETMAP_MIN_SLOTS, NETMAP_MAX_SLOTS);
+}
+
+/* What NIOCREGIF would set up for nmr->nr_name; called with RTNL held */
+static int netmap_getinfo(struct nmreq *nmr)
+{
+	struct net_device *dev;
+	struct netmap_adapter *na;
+
+	nmr->nr_name[IFNAMSIZ - 1] = '\0';
+	dev = __dev_get_by_name(current->nsproxy->net_ns, nmr->nr_name);
+	if (!dev)
+		return -ENODEV;
+
+	na = dev->nm_adapter;
+	if (nmr->nr_flags & NR_GENERIC)
+		na = NULL;
+
+	nmr->nr_version = NETMAP_API;
+	nmr->nr_offset = 0;
+	nmr->nr_tx_slots = netmap_slots(na ? na->num_tx_desc : 0);
+	nmr->nr_rx_slots = netmap_slots(na ? na->num_rx_desc : 0);
+	nmr->nr_memsize = 0;
+	nmr->nr_tx_rings = 1;
+	nmr->nr_rx_rings = 1;
+	nmr->nr_flags = na ? 0 : NR_GENERIC;
+	return 0;
+}
+
+/* Called with RTNL and priv->lock held */
+static int netmap_regif(struct netmap_priv *priv, struct nmreq *nmr)
+{
+	struct net_device *dev;
+	struct netmap_adapter *na;
+	int err;
+
+	if (priv->mem)
+		return -EBUSY;
+
+	nmr->nr_name[IFNAMSIZ - 1] = '\0';
+	dev = __dev_get_by_name(current->nsproxy->net_ns, nmr->nr_name);
+	if (!dev)
+		return -ENODEV;
+	if (!netif_running(dev))
+		return -ENETDOWN;
+
+	na = dev->nm_adapter;
+	if (na && na->active)
+		return -EBUSY;
+	if (!na || (nmr->nr_flags & NR_GENERIC)) {
+		if (dev->type != ARPHRD_ETHER && dev->type != ARPHRD_LOOPBACK)
+			return -EOPNOTSUPP;
+		na = netmap_generic_alloc(priv, dev);
+		if (!na)
+			return -ENOMEM;
+	} else if (rtnl_dereference(dev->rx_handler) == netmap_generic_rx) {
+		return -EBUSY;
+	}
+
+	err = netmap_mem_init(priv, na, netmap_slots(na->num_tx_desc),
+			      netmap_slots(na->num_rx_desc));
+	if (err)
+		goto out_free;
+
+	na->active = 1;
+	err = na->nm_register(na, 1);
+	if (err) {
+		na->active = 0;
+		vfree(priv->mem);
+		priv->mem = NULL;
+		goto out_free;
+	}
+
+	dev_hold(dev);
+	priv->dev = dev;
+	priv->na = na;
+	list_add(&priv->list, &netmap_bound);
+
+	nmr->nr_version = NETMAP_API;
+	nmr->nr_offset = 0;
+	nmr->nr_memsize = priv->memsize;
+	nmr->nr_tx_slots = na->tx_ring.num_slots;
+	nmr->nr_rx_slots = na->rx_ring.num_slots;
+	nmr->nr_tx_rings = 1;
+	nmr->nr_rx_rings = 1;
+	return 0;
+
+out_free:
+	if (na->generic)
+		kfree(na);
+	return err;
+}
+
+/* Called with RTNL and priv->lock held */
+static void netmap_unregif(struct netmap_priv *priv)
+{
+	struct netmap_adapter *na = priv->na;
+
+	if (!na)
+		return;
+
+	na->nm_register(na, 0);
+	na->active = 0;
+	na->wait = NULL;
+	if (na->generic)
+		kfree(na);
+
+	list_del(&priv->list);
+	dev_put(priv->dev);
+	priv->dev = NULL;
+	priv->na = NULL;
+
+	/* Pollers see POLLERR from now on */
+	wake_up_interruptible(&priv->wait);
+}
+
+/*
+ * Syncs.  The kring lock keeps them away from netmap_reset() and, in
+ * generic mode, from netmap_generic_rx().
+ */
+static int netmap_txsync(struct netmap_adapter *na)
+{
+	struct netmap_kring *kring = &na->tx_ring;
+	struct netmap_ring *ring = kring->ring;
+	u32 head;
+	int err;
+
+	spin_lock_bh(&kring->lock);
+	head = ACCESS_ONCE(ring->head);
+	if (unlikely(head >= kring->num_slots ||
+		     !netmap_in_range(kring, head, kring->nr_hwcur,
+				      kring->nr_hwtail))) {
+		err = -EINVAL;
+		goto out;
+	}
+	kring->rhead = head;
+
+	err = na->nm_txsync(na);
+	smp_wmb();
+	ring->tail = kring->nr_hwtail;
+out:
+	spin_unlock_bh(&kring->lock);
+	return err;
+}
+
+static int netmap_rxsync(struct netmap_adapter *na)
+{
+	struct netmap_kring *kring = &na->rx_ring;
+	struct netmap_ring *ring = kring->ring;
+	u32 head;
+	int err;
+
+	spin_lock_bh(&kring->lock);
+	head = ACCESS_ONCE(ring->head);
+	if (unlikely(head >= kring->num_slots ||
+		     !netmap_in_range(kring, head, kring->nr_hwcur,
+				      kring->nr_hwtail))) {
+		err = -EINVAL;
+		goto out;
+	}
+	/* Slots the application is done with can be filled again */
+	kring->rhead = kring->nr_hwcur = head;
+
+	err = na->nm_rxsync(na);
+	smp_wmb();
+	ring->tail = kring->nr_hwtail;
+out:
+	spin_unlock_bh(&kring->lock);
+	return err;
+}
+
+static int netmap_sync(struct netmap_priv *priv, int (*sync)(struct netmap_adapter *))
+{
+	int err;
+
+	mutex_lock(&priv->lock);
+	err = priv->na ? sync(priv->na) : -ENXIO;
+	mutex_unlock(&priv->lock);
+
+	return err;
+}
+
+/*
+ * File operations.
+ */
+
+static int netmap_open(struct inode *inode, struct file *file)
+{
+	struct netmap_priv *priv;
+
+	priv = kzalloc(sizeof(*priv), GFP_KERNEL);
+	if (!priv)
+		return -ENOMEM;
+
+	mutex_init(&priv->lock);
+	init_waitqueue_head(&priv->wait);
+	atomic_set(&priv->tx_inflight, 0);
+	kref_init(&priv->kref);
+	INIT_WORK(&priv->free_work, netmap_priv_free_work);
+	__module_get(THIS_MODULE);
+
+	file->private_data = priv;
+	return nonseekable_open(inode, file);
+}
+
+static int netmap_release(struct inode *inode, struct file *file)
+{
+	struct netmap_priv *priv = file->private_data;
+
+	rtnl_lock();
+	mutex_lock(&priv->lock);
+	netmap_unregif(priv);
+	mutex_unlock(&priv->lock);
+	rtnl_unlock();
+
+	netmap_priv_put(priv);
+	return 0;
+}
+
+static long netmap_ioctl(struct file *file, unsigned int cmd,
+			 unsigned long arg)
+{
+	struct netmap_priv *priv = file->private_data;
+	void __user *argp = (void __user *)arg;
+	struct nmreq nmr;
+	int err;
+
+	switch (cmd) {
+	case NIOCTXSYNC:
+		return netmap_sync(priv, netmap_txsync);
+
+	case NIOCRXSYNC:
+		return netmap_sync(priv, netmap_rxsync);
+
+	case NIOCGINFO:
+		if (copy_from_user(&nmr, argp, sizeof(nmr)))
+			return -EFAULT;
+
+		rtnl_lock();
+		err = netmap_getinfo(&nmr);
+		rtnl_unlock();
+		break;
+
+	case NIOCREGIF:
+		/* Takes the interface's receive path away from the stack */
+		if (!capable(CAP_NET_ADMIN))
+			return -EPERM;
+		if (copy_from_user(&nmr, argp, sizeof(nmr)))
+			return -EFAULT;
+		if (nmr.nr_version != NETMAP_API)
+			return -EINVAL;
+
+		rtnl_lock();
+		mutex_lock(&priv->lock);
+		err = netmap_regif(priv, &nmr);
+		mutex_unlock(&priv->lock);
+		rtnl_unlock();
+		break;
+
+	default:
+		return -ENOTTY;
+	}
+
+	if (!err && copy_to_user(argp, &nmr, sizeof(nmr)))
+		err = -EFAULT;
+	return err;
+}
+
+static unsigned int netmap_poll(struct file *file, poll_table *wait)
+{
+	struct netmap_priv *priv = file->private_data;
+	struct netmap_adapter *na;
+	unsigned int mask = 0;
+
+	poll_wait(file, &priv->wait, wait);
+
+	mutex_lock(&priv->lock);
+	na = priv->na;
+	if (!na) {
+		mask = POLLERR;
+		goto out;
+	}
+
+	if (netmap_txsync(na))
+		mask |= POLLERR;
+	else if (netmap_kring_space(&na->tx_ring))
+		mask |= POLLOUT | POLLWRNORM;
+
+	if (netmap_rxsync(na))
+		mask |= POLLERR;
+	else if (netmap_kring_space(&na->rx_ring))
+		mask |= POLLIN | POLLRDNORM;
+out:
+	mutex_unlock(&priv->lock);
+	return mask;
+}
+
+static int netmap_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct netmap_priv *priv = file->private_data;
+	unsigned long size = vma->vm_end - vma->vm_start;
+	int err = -EINVAL;
+
+	mutex_lock(&priv->lock);
+	if (priv->mem && vma->vm_pgoff == 0 && size <= priv->memsize)
+		err = remap_vmalloc_range(vma, priv->mem, 0);
+	mutex_unlock(&priv->lock);
+
+	return err;
+}
+
+static const struct file_operations netmap_fops = {
+	.owner		= THIS_MODULE,
+	.open		= netmap_open,
+	.release	= netmap_release,
+	.unlocked_ioctl	= netmap_ioctl,
+	.compat_ioctl	= netmap_ioctl,
+	.poll		= netmap_poll,
+	.mmap		= netmap_mmap,
+	.llseek		= no_llseek,
+};
+
+static struct miscdevice netmap_miscdev = {
+	.minor	= MISC_DYNAMIC_MINOR,
+	.name	= "netmap",
+	.fops	= &netmap_fops,
+};
+
+/* Let go of interfaces that are being unregistered */
+static int netmap_netdev_event(struct notifier_block *this,
+			       unsigned long event, void *ptr)
+{
+	struct net_device *dev = ptr;
+	struct netmap_priv *priv, *tmp;
+
+	if (event != NETDEV_UNREGISTER)
+		return NOTIFY_DONE;
+
+	list_for_each_entry_safe(priv, tmp, &netmap_bound, list) {
+		if (priv->dev != dev)
+			continue;
+		mutex_lock(&priv->lock);
+		netmap_unregif(priv);
+		mutex_unlock(&priv->lock);
+	}
+	return NOTIFY_DONE;
+}
+
+static struct notifier_block netmap_notifier = {
+	.notifier_call	= netmap_netdev_event,
+};
+
+static int __init netmap_init(void)
+{
+	int err;
+
+	err = register_netdevice_notifier(&netmap_notifier);
+	if (err)
+		return err;
+
+	err = misc_register(&netmap_miscdev);
+	if (err)
+		unregister_netdevice_notifier(&netmap_notifier);
+	return err;
+}
+
+static void __exit netmap_exit(void)
+{
+	misc_deregister(&netmap_miscdev);
+	unregister_netdevice_notifier(&netmap_notifier);
+}
+
+module_init(netmap_init);
+module_exit(netmap_exit);
+MODULE_DESCRIPTION("netmap shared ring packet I/O");
+MODULE_LICENSE("GPL");
@@ -161,13 +161,36 @@ struct packet_mreq_max {
 	unsigned char	mr_address[MAX_ADDR_LEN];
 };
 
-static int packet_set_ring(struct sock *sk, struct tpacket_req *req,
+static int packet_set_ring(struct sock *sk, union tpacket_req_u *req_u,
 		int closing, int tx_ring);
 
 struct pgv {
 	char *buffer;
 };
 
+/* kbdq - kernel block descriptor queue, the TPACKET_V3 receive state */
+struct tpacket_kbdq_core {
+	struct pgv	*pkbdq;
+	unsigned int	feature_req_word;
+	unsigned int	knum_blocks;
+	unsigned int	kactive_blk_num;
+	unsigned int	kblk_size;
+	unsigned int	blk_sizeof_priv;
+	unsigned int	blk_open:1,	/* kactive block is being filled */
+			blk_frozen:1,	/* waiting for userspace to return it */
+			delete_blk_timer:1;
+	char		*nxt_offset;
+	char		*prev;
+	u64		knxt_seq_num;
+	atomic_t	blk_fill_in_prog;
+
+	/* Default is set to 8ms */
+#define DEFAULT_PRB_RETIRE_TOV	(8)
+	unsigned int	retire_blk_tov;
+	unsigned long	tov_in_jiffies;
+	struct timer_list retire_blk_timer;
+};
+
 struct packet_ring_buffer {
 	struct pgv		*pg_vec;
 	unsigned int		head;
@@ -179,18 +202,26 @@ struct packet_ring_buffer {
 	unsigned int		pg_vec_pages;
 	unsigned int		pg_vec_len;
 
+	struct tpacket_kbdq_core	prb_bdqc;
 	atomic_t		pending;
 };
 
+#define BLK_HDR_LEN	(ALIGN(sizeof(struct tpacket_block_desc), 8))
+#define BLK_PLUS_PRIV(sz_of_priv) \
+	(BLK_HDR_LEN + ALIGN((sz_of_priv), 8))
+#define TOTAL_PKT_LEN_INCL_ALIGN(length) (ALIGN((length), 8))
+
 struct packet_sock;
 static int tpacket_snd(struct packet_sock *po, struct msghdr *msg);
 
 static void packet_flush_mclist(struct sock *sk);
 
+struct packet_fanout;
+
 struct packet_sock {
 	/* struct sock has to be the first member of packet_sock */
 	struct sock		sk;
-	struct tpacket_stats	stats;
+	struct tpacket_stats_v3	stats;
 	struct packet_ring_buffer	rx_ring;
 	struct packet_ring_buffer	tx_ring;
 	int			copy_thresh;
@@ -203,6 +234,7 @@ struct packet_sock {
 	int			ifindex;	/* bound device		*/
 	__be16			num;
 	struct packet_mclist	*mclist;
+	struct packet_fanout	*fanout;
 	atomic_t		mapped;
 	enum tpacket_versions	tp_version;
 	unsigned int		tp_hdrlen;
@@ -212,6 +244,27 @@ struct packet_sock {
 	struct packet_type	prot_hook ____cacheline_aligned_in_smp;
 };
 
+#define PACKET_FANOUT_MAX	256
+
+/*
+ * A fanout group owns a single prot_hook for the device/protocol its
+ * members are bound to and hands each packet to one running member.
+ */
+struct packet_fanout {
+#ifdef CONFIG_NET_NS
+	struct net		*net;
+#endif
+	unsigned int		num_members;
+	u16			id;
+	u8			type;
+	atomic_t		rr_cur;
+	struct list_head	list;
+	struct sock		*arr[PACKET_FANOUT_MAX];
+	spinlock_t		lock;
+	atomic_t		sk_ref;
+	struct packet_type	prot_hook ____cacheline_aligned_in_smp;
+};
+
 struct packet_skb_cb {
 	unsigned int origlen;
 	union {
@@ -329,6 +382,289 @@ static inline struct packet_sock *pkt_sk(struct sock *sk)
 	return (struct packet_sock *)sk;
 }
 
+/*
+ * TPACKET_V3 packs variable length frames back to back into blocks and
+ * hands a whole block to userspace at once: when the next frame no longer
+ * fits, or when the retire timer fires on a partially filled block.  The
+ * block state is protected by sk_receive_queue.lock; only the frame copy
+ * runs outside of it and is tracked by blk_fill_in_prog, which has to
+ * drain before a block may be handed over.
+ */
+
+#define GET_PBLOCK_DESC(x, bid)	\
+	((struct tpacket_block_desc *)((x)->pkbdq[(bid)].buffer))
+#define GET_CURR_PBLOCK_DESC_FROM_CORE(x)	\
+	GET_PBLOCK_DESC(x, (x)->kactive_blk_num)
+#define GET_NEXT_PRB_BLK_NUM(x) \
+	(((x)->kactive_blk_num < ((x)->knum_blocks-1)) ? \
+	((x)->kactive_blk_num+1) : 0)
+#define GET_PREV_PRB_BLK_NUM(x) \
+	((x)->kactive_blk_num ? ((x)->kactive_blk_num-1) : \
+	((x)->knum_blocks-1))
+
+static void prb_retire_rx_blk_timer_expired(unsigned long data);
+
+static int prb_get_block_status(struct tpacket_block_desc *pbd)
+{
+	smp_rmb();
+	flush_dcache_page(pgv_to_page(&pbd->hdr.bh1.block_status));
+	return pbd->hdr.bh1.block_status;
+}
+
+static void prb_open_block(struct tpacket_kbdq_core *pkc,
+		struct tpacket_block_desc *pbd)
+{
+	struct tpacket_hdr_v1 *h1 = &pbd->hdr.bh1;
+
+	pbd->version = TPACKET_V3;
+	pbd->offset_to_priv = BLK_HDR_LEN;
+	h1->num_pkts = 0;
+	h1->offset_to_first_pkt = BLK_PLUS_PRIV(pkc->blk_sizeof_priv);
+	h1->blk_len = h1->offset_to_first_pkt;
+	h1->seq_num = pkc->knxt_seq_num++;
+
+	pkc->nxt_offset = (char *)pbd + h1->offset_to_first_pkt;
+	pkc->prev = NULL;
+	pkc->blk_open = 1;
+
+	mod_timer(&pkc->retire_blk_timer, jiffies + pkc->tov_in_jiffies);
+}
+
+static void prb_close_block(struct packet_sock *po,
+		struct tpacket_kbdq_core *pkc, unsigned int status)
+{
+	struct tpacket_block_desc *pbd = GET_CURR_PBLOCK_DESC_FROM_CORE(pkc);
+	struct tpacket_hdr_v1 *h1 = &pbd->hdr.bh1;
+	struct tpacket3_hdr *first, *last;
+	struct sock *sk = &po->sk;
+
+	/* Frames still being copied in on other cpus belong to this block */
+	while (atomic_read(&pkc->blk_fill_in_prog))
+		cpu_relax();
+	smp_rmb();
+
+	first = (struct tpacket3_hdr *)((char *)pbd + h1->offset_to_first_pkt);
+	last = (struct tpacket3_hdr *)pkc->prev;
+	last->tp_next_offset = 0;
+	h1->ts_first_pkt.ts_sec = first->tp_sec;
+	h1->ts_first_pkt.ts_nsec = first->tp_nsec;
+	h1->ts_last_pkt.ts_sec = last->tp_sec;
+	h1->ts_last_pkt.ts_nsec = last->tp_nsec;
+	h1->blk_len = pkc->nxt_offset - (char *)pbd;
+
+	smp_wmb();
+	h1->block_status = TP_STATUS_USER | status;
+	flush_dcache_page(pgv_to_page(&h1->block_status));
+
+	pkc->blk_open = 0;
+	pkc->kactive_blk_num = GET_NEXT_PRB_BLK_NUM(pkc);
+
+	sk->sk_data_ready(sk, 0);
+}
+
+/*
+ * Open the block at kactive_blk_num if userspace has returned it.  If it
+ * has not, the queue is frozen and frames are dropped until it does.
+ */
+static int prb_open_next_block(struct packet_sock *po,
+		struct tpacket_kbdq_core *pkc)
+{
+	struct tpacket_block_desc *pbd = GET_CURR_PBLOCK_DESC_FROM_CORE(pkc);
+
+	if (prb_get_block_status(pbd) != TP_STATUS_KERNEL) {
+		if (!pkc->blk_frozen) {
+			pkc->blk_frozen = 1;
+			po->stats.tp_freeze_q_cnt++;
+		}
+		return 0;
+	}
+
+	pkc->blk_frozen = 0;
+	prb_open_block(pkc, pbd);
+	return 1;
+}
+
+static void prb_retire_rx_blk_timer_expired(unsigned long data)
+{
+	struct packet_sock *po = (struct packet_sock *)data;
+	struct tpacket_kbdq_core *pkc = &po->rx_ring.prb_bdqc;
+	struct sock *sk = &po->sk;
+
+	spin_lock(&sk->sk_receive_queue.lock);
+	if (unlikely(pkc->delete_blk_timer))
+		goto out;
+
+	if (pkc->blk_open) {
+		if (!GET_CURR_PBLOCK_DESC_FROM_CORE(pkc)->hdr.bh1.num_pkts)
+			goto refresh;
+		prb_close_block(po, pkc, TP_STATUS_BLK_TMO);
+	}
+
+	/* Opening a block re-arms the timer */
+	if (prb_open_next_block(po, pkc))
+		goto out;
+
+refresh:
+	mod_timer(&pkc->retire_blk_timer, jiffies + pkc->tov_in_jiffies);
+out:
+	spin_unlock(&sk->sk_receive_queue.lock);
+}
+
+static void init_prb_bdqc(struct packet_sock *po,
+		struct packet_ring_buffer *rb,
+		struct tpacket_req3 *req3)
+{
+	struct tpacket_kbdq_core *pkc = &rb->prb_bdqc;
+
+	memset(pkc, 0, sizeof(*pkc));
+	pkc->pkbdq = rb->pg_vec;
+	pkc->knum_blocks = req3->tp_block_nr;
+	pkc->kblk_size = req3->tp_block_size;
+	pkc->blk_sizeof_priv = req3->tp_sizeof_priv;
+	pkc->feature_req_word = req3->tp_feature_req_word;
+	pkc->retire_blk_tov = req3->tp_retire_blk_tov ? :
+			      DEFAULT_PRB_RETIRE_TOV;
+	pkc->tov_in_jiffies = msecs_to_jiffies(pkc->retire_blk_tov) ? : 1;
+	pkc->knxt_seq_num = 1;
+	atomic_set(&pkc->blk_fill_in_prog, 0);
+	setup_timer(&pkc->retire_blk_timer, prb_retire_rx_blk_timer_expired,
+		    (unsigned long)po);
+
+	prb_open_block(pkc, GET_CURR_PBLOCK_DESC_FROM_CORE(pkc));
+}
+
+static void prb_shutdown_retire_blk_timer(struct packet_sock *po,
+		struct sk_buff_head *rb_queue)
+{
+	struct tpacket_kbdq_core *pkc = &po->rx_ring.prb_bdqc;
+
+	spin_lock_bh(&rb_queue->lock);
+	pkc->delete_blk_timer = 1;
+	spin_unlock_bh(&rb_queue->lock);
+
+	del_timer_sync(&pkc->retire_blk_timer);
+}
+
+/* Reserve len bytes in the active block, moving on to the next if needed */
+static void *__packet_lookup_frame_in_block(struct packet_sock *po,
+		unsigned int len)
+{
+	struct tpacket_kbdq_core *pkc = &po->rx_ring.prb_bdqc;
+	struct tpacket_block_desc *pbd;
+	struct tpacket3_hdr *ppd;
+
+	if (!pkc->blk_open && !prb_open_next_block(po, pkc))
+		return NULL;
+
+	len = TOTAL_PKT_LEN_INCL_ALIGN(len);
+	pbd = GET_CURR_PBLOCK_DESC_FROM_CORE(pkc);
+	if (pkc->nxt_offset + len > (char *)pbd + pkc->kblk_size) {
+		prb_close_block(po, pkc, 0);
+		if (!prb_open_next_block(po, pkc))
+			return NULL;
+		pbd = GET_CURR_PBLOCK_DESC_FROM_CORE(pkc);
+	}
+
+	ppd = (struct tpacket3_hdr *)pkc->nxt_offset;
+	ppd->tp_next_offset = len;
+	pkc->prev = pkc->nxt_offset;
+	pkc->nxt_offset += len;
+	pbd->hdr.bh1.num_pkts++;
+	atomic_inc(&pkc->blk_fill_in_prog);
+
+	return ppd;
+}
+
+static void *__prb_previous_block(struct packet_sock *po,
+		struct packet_ring_buffer *rb,
+		int status)
+{
+	struct tpacket_kbdq_core *pkc = &rb->prb_bdqc;
+	struct tpacket_block_desc *pbd;
+
+	pbd = GET_PBLOCK_DESC(pkc, GET_PREV_PRB_BLK_NUM(pkc));
+	if (status != prb_get_block_status(pbd))
+		return NULL;
+
+	return pbd;
+}
+
+static void *packet_current_rx_frame(struct packet_sock *po,
+		unsigned int len)
+{
+	void *frame;
+
+	if (po->tp_version == TPACKET_V3)
+		return __packet_lookup_frame_in_block(po, len);
+
+	frame = packet_current_frame(po, &po->rx_ring, TP_STATUS_KERNEL);
+	if (frame)
+		packet_increment_head(&po->rx_ring);
+	return frame;
+}
+
+static void *packet_previous_rx_frame(struct packet_sock *po,
+		struct packet_ring_buffer *rb,
+		int status)
+{
+	if (po->tp_version == TPACKET_V3)
+		return __prb_previous_block(po, rb, status);
+
+	return packet_previous_frame(po, rb, status);
+}
+
+static void __fanout_unlink(struct sock *sk, struct packet_sock *po);
+static void __fanout_link(struct sock *sk, struct packet_sock *po);
+
+/* register_prot_hook must be invoked with the po->bind_lock held,
+ * or from a context in which asynchronous accesses to the packet
+ * socket is not possible (packet_create()).
+ */
+static void register_prot_hook(struct sock *sk)
+{
+	struct packet_sock *po = pkt_sk(sk);
+
+	if (!po->running) {
+		if (po->fanout)
+			__fanout_link(sk, po);
+		else
+			dev_add_pack(&po->prot_hook);
+		sock_hold(sk);
+		po->running = 1;
+	}
+}
+
+/* {,__}unregister_prot_hook() must be invoked with the po->bind_lock
+ * held.  If the sync parameter is true, the bind_lock is dropped around
+ * a synchronize_net() so that no receive path still refers to the
+ * socket once we return.  Otherwise the caller has to take care of it.
+ */
+static void __unregister_prot_hook(struct sock *sk, bool sync)
+{
+	struct packet_sock *po = pkt_sk(sk);
+
+	po->running = 0;
+	if (po->fanout)
+		__fanout_unlink(sk, po);
+	else
+		__dev_remove_pack(&po->prot_hook);
+	__sock_put(sk);
+
+	if (sync) {
+		spin_unlock(&po->bind_lock);
+		synchronize_net();
+		spin_lock(&po->bind_lock);
+	}
+}
+
+static void unregister_prot_hook(struct sock *sk, bool sync)
+{
+	struct packet_sock *po = pkt_sk(sk);
+
+	if (po->running)
+		__unregister_prot_hook(sk, sync);
+}
+
 static void packet_sock_destruct(struct sock *sk)
 {
 	skb_queue_purge(&sk->sk_error_queue);
@@ -345,6 +681,210 @@ static void packet_sock_destruct(struct sock *sk)
 }
 
 
+static struct sock *fanout_demux_hash(struct packet_fanout *f,
+				      struct sk_buff *skb,
+				      unsigned int num)
+{
+	u32 idx, hash = skb_get_rxhash(skb);
+
+	idx = ((u64)hash * num) >> 32;
+
+	return f->arr[idx];
+}
+
+static unsigned int fanout_rr_next(struct packet_fanout *f, unsigned int num)
+{
+	int x = atomic_read(&f->rr_cur) + 1;
+
+	if (x >= num)
+		x = 0;
+
+	return x;
+}
+
+static struct sock *fanout_demux_lb(struct packet_fanout *f,
+				    struct sk_buff *skb,
+				    unsigned int num)
+{
+	int cur, old;
+
+	cur = atomic_read(&f->rr_cur);
+	while ((old = atomic_cmpxchg(&f->rr_cur, cur,
+				     fanout_rr_next(f, num))) != cur)
+		cur = old;
+	if (unlikely(cur >= num))
+		cur = 0;
+
+	return f->arr[cur];
+}
+
+static struct sock *fanout_demux_cpu(struct packet_fanout *f,
+				     struct sk_buff *skb,
+				     unsigned int num)
+{
+	unsigned int cpu = smp_processor_id();
+
+	return f->arr[cpu % num];
+}
+
+static int packet_rcv_fanout(struct sk_buff *skb, struct net_device *dev,
+			     struct packet_type *pt,
+			     struct net_device *orig_dev)
+{
+	struct packet_fanout *f = pt->af_packet_priv;
+	unsigned int num = ACCESS_ONCE(f->num_members);
+	struct packet_sock *po;
+	struct sock *sk;
+
+	if (!net_eq(dev_net(dev), read_pnet(&f->net)) ||
+	    !num) {
+		kfree_skb(skb);
+		return 0;
+	}
+	smp_rmb();
+
+	switch (f->type) {
+	case PACKET_FANOUT_HASH:
+	default:
+		sk = fanout_demux_hash(f, skb, num);
+		break;
+	case PACKET_FANOUT_LB:
+		sk = fanout_demux_lb(f, skb, num);
+		break;
+	case PACKET_FANOUT_CPU:
+		sk = fanout_demux_cpu(f, skb, num);
+		break;
+	}
+
+	po = pkt_sk(sk);
+
+	return po->prot_hook.func(skb, dev, &po->prot_hook, orig_dev);
+}
+
+static DEFINE_MUTEX(fanout_mutex);
+static LIST_HEAD(fanout_list);
+
+static void __fanout_link(struct sock *sk, struct packet_sock *po)
+{
+	struct packet_fanout *f = po->fanout;
+
+	spin_lock(&f->lock);
+	f->arr[f->num_members] = sk;
+	smp_wmb();
+	f->num_members++;
+	spin_unlock(&f->lock);
+}
+
+static void __fanout_unlink(struct sock *sk, struct packet_sock *po)
+{
+	struct packet_fanout *f = po->fanout;
+	int i;
+
+	spin_lock(&f->lock);
+	for (i = 0; i < f->num_members; i++) {
+		if (f->arr[i] == sk)
+			break;
+	}
+	BUG_ON(i >= f->num_members);
+	f->arr[i] = f->arr[f->num_members - 1];
+	f->num_members--;
+	spin_unlock(&f->lock);
+}
+
+static int fanout_add(struct sock *sk, u16 id, u16 type)
+{
+	struct packet_sock *po = pkt_sk(sk);
+	struct packet_fanout *f, *match;
+	int err;
+
+	switch (type) {
+	case PACKET_FANOUT_HASH:
+	case PACKET_FANOUT_LB:
+	case PACKET_FANOUT_CPU:
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	mutex_lock(&fanout_mutex);
+	spin_lock(&po->bind_lock);
+
+	/* Tested under the locks: two racing PACKET_FANOUT calls on one
+	 * socket must not both link it into a group.
+	 */
+	err = -EALREADY;
+	if (po->fanout)
+		goto out;
+
+	err = -EINVAL;
+	if (!po->running)
+		goto out;
+
+	match = NULL;
+	list_for_each_entry(f, &fanout_list, list) {
+		if (f->id == id &&
+		    read_pnet(&f->net) == sock_net(sk)) {
+			match = f;
+			break;
+		}
+	}
+	if (!match) {
+		err = -ENOMEM;
+		match = kzalloc(sizeof(*match), GFP_ATOMIC);
+		if (!match)
+			goto out;
+		write_pnet(&match->net, sock_net(sk));
+		match->id = id;
+		match->type = type;
+		atomic_set(&match->rr_cur, 0);
+		INIT_LIST_HEAD(&match->list);
+		spin_lock_init(&match->lock);
+		atomic_set(&match->sk_ref, 0);
+		match->prot_hook.type = po->prot_hook.type;
+		match->prot_hook.dev = po->prot_hook.dev;
+		match->prot_hook.func = packet_rcv_fanout;
+		match->prot_hook.af_packet_priv = match;
+		dev_add_pack(&match->prot_hook);
+		list_add(&match->list, &fanout_list);
+	}
+	err = -EINVAL;
+	if (match->type == type &&
+	    match->prot_hook.type == po->prot_hook.type &&
+	    match->prot_hook.dev == po->prot_hook.dev) {
+		err = -ENOSPC;
+		if (atomic_read(&match->sk_ref) < PACKET_FANOUT_MAX) {
+			__dev_remove_pack(&po->prot_hook);
+			po->fanout = match;
+			atomic_inc(&match->sk_ref);
+			__fanout_link(sk, po);
+			err = 0;
+		}
+	}
+out:
+	spin_unlock(&po->bind_lock);
+	mutex_unlock(&fanout_mutex);
+	return err;
+}
+
+static void fanout_release(struct sock *sk)
+{
+	struct packet_sock *po = pkt_sk(sk);
+	struct packet_fanout *f;
+
+	mutex_lock(&fanout_mutex);
+	f = po->fanout;
+	if (f) {
+		po->fanout = NULL;
+
+		if (atomic_dec_and_test(&f->sk_ref)) {
+			list_del(&f->list);
+			dev_remove_pack(&f->prot_hook);
+			kfree(f);
+		}
+	}
+	mutex_unlock(&fanout_mutex);
+}
+
 static const struct proto_ops packet_ops;
 
 static const struct proto_ops packet_ops_spkt;
@@ -538,7 +1078,7 @@ static inline unsigned int run_filter(const struct sk_buff *skb,
 	rcu_read_lock();
 	filter = rcu_dereference(sk->sk_filter);
 	if (filter != NULL)
-		res = sk_run_filter(skb, filter->insns);
+		res = SK_RUN_FILTER(filter, skb);
 	rcu_read_unlock();
 
 	return res;
@@ -675,6 +1215,7 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev,
 	union {
 		struct tpacket_hdr *h1;
 		struct tpacket2_hdr *h2;
+		struct tpacket3_hdr *h3;
 		void *raw;
 	} h;
 	u8 *skb_head = skb->data;
@@ -746,10 +1287,9 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev,
 	}
 
 	spin_lock(&sk->sk_receive_queue.lock);
-	h.raw = packet_current_frame(po, &po->rx_ring, TP_STATUS_KERNEL);
+	h.raw = packet_current_rx_frame(po, macoff + snaplen);
 	if (!h.raw)
 		goto ring_is_full;
-	packet_increment_head(&po->rx_ring);
 	po->stats.tp_packets++;
 	if (copy_skb) {
 		status |= TP_STATUS_COPY;
@@ -801,6 +1341,33 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev,
 		h.h2->tp_vlan_tci = vlan_tx_tag_get(skb);
 		hdrlen = sizeof(*h.h2);
 		break;
+	case TPACKET_V3:
+		/* tp_next_offset is maintained by the block code */
+		h.h3->tp_status = status;
+		h.h3->tp_len = skb->len;
+		h.h3->tp_snaplen = snaplen;
+		h.h3->tp_mac = macoff;
+		h.h3->tp_net = netoff;
+		if ((po->tp_tstamp & SOF_TIMESTAMPING_SYS_HARDWARE)
+				&& shhwtstamps->syststamp.tv64)
+			ts = ktime_to_timespec(shhwtstamps->syststamp);
+		else if ((po->tp_tstamp & SOF_TIMESTAMPING_RAW_HARDWARE)
+				&& shhwtstamps->hwtstamp.tv64)
+			ts = ktime_to_timespec(shhwtstamps->hwtstamp);
+		else if (skb->tstamp.tv64)
+			ts = ktime_to_timespec(skb->tstamp);
+		else
+			getnstimeofday(&ts);
+		h.h3->tp_sec = ts.tv_sec;
+		h.h3->tp_nsec = ts.tv_nsec;
+		if (po->rx_ring.prb_bdqc.feature_req_word &
+		    TP_FT_REQ_FILL_RXHASH)
+			h.h3->hv1.tp_rxhash = skb_get_rxhash(skb);
+		else
+			h.h3->hv1.tp_rxhash = 0;
+		h.h3->hv1.tp_vlan_tci = vlan_tx_tag_get(skb);
+		hdrlen = sizeof(*h.h3);
+		break;
 	default:
 		BUG();
 	}
@@ -816,7 +1383,8 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev,
 	else
 		sll->sll_ifindex = dev->ifindex;
 
-	__packet_set_status(po, h.raw, status);
+	if (po->tp_version <= TPACKET_V2)
+		__packet_set_status(po, h.raw, status);
 	smp_mb();
 #if ARCH_IMPLEMENTS_FLUSH_DCACHE_PAGE == 1
 	{
@@ -828,7 +1396,11 @@ static int tpacket_rcv(struct sk_buff *skb, struct net_device *dev,
 	}
 #endif
 
-	sk->sk_data_ready(sk, 0);
+	/* A V3 reader is woken once per block, when the block is retired */
+	if (po->tp_version <= TPACKET_V2)
+		sk->sk_data_ready(sk, 0);
+	else
+		atomic_dec(&po->rx_ring.prb_bdqc.blk_fill_in_prog);
 
 drop_n_restore:
 	if (skb_head != skb->data && skb_shared(skb)) {
@@ -1314,7 +1886,7 @@ static int packet_release(struct socket *sock)
 	struct sock *sk = sock->sk;
 	struct packet_sock *po;
 	struct net *net;
-	struct tpacket_req req;
+	union tpacket_req_u req_u;
 
 	if (!sk)
 		return 0;
@@ -1328,26 +1900,24 @@ static int packet_release(struct socket *sock)
 	spin_unlock_bh(&net->packet.sklist_lock);
 
 	spin_lock(&po->bind_lock);
-	if (po->running) {
-		/*
-		 * Remove from protocol table
-		 */
-		po->running = 0;
-		po->num = 0;
-		__dev_remove_pack(&po->prot_hook);
-		__sock_put(sk);
-	}
+	/*
+	 * Remove from protocol table
+	 */
+	unregister_prot_hook(sk, false);
+	po->num = 0;
 	spin_unlock(&po->bind_lock);
 
 	packet_flush_mclist(sk);
 
-	memset(&req, 0, sizeof(req));
+	memset(&req_u, 0, sizeof(req_u));
 
 	if (po->rx_ring.pg_vec)
-		packet_set_ring(sk, &req, 1, 0);
+		packet_set_ring(sk, &req_u, 1, 0);
 
 	if (po->tx_ring.pg_vec)
-		packet_set_ring(sk, &req, 1, 1);
+		packet_set_ring(sk, &req_u, 1, 1);
+
+	fanout_release(sk);
 
 	synchronize_net();
 	/*
@@ -1372,6 +1942,11 @@ static int packet_release(struct socket *sock)
 static int packet_do_bind(struct sock *sk, struct net_device *dev, __be16 protocol)
 {
 	struct packet_sock *po = pkt_sk(sk);
+
+	/* A fanout member shares the group's device and protocol */
+	if (po->fanout)
+		return -EINVAL;
+
 	/*
 	 *	Detach an existing hook if present.
 	 */
@@ -1379,14 +1954,7 @@ static int packet_do_bind(struct sock *sk, struct net_device *dev, __be16 protoc
 	lock_sock(sk);
 
 	spin_lock(&po->bind_lock);
-	if (po->running) {
-		__sock_put(sk);
-		po->running = 0;
-		po->num = 0;
-		spin_unlock(&po->bind_lock);
-		dev_remove_pack(&po->prot_hook);
-		spin_lock(&po->bind_lock);
-	}
+	unregister_prot_hook(sk, true);
 
 	po->num = protocol;
 	po->prot_hook.type = protocol;
@@ -1398,9 +1966,7 @@ static int packet_do_bind(struct sock *sk, struct net_device *dev, __be16 protoc
 		goto out_unlock;
 
 	if (!dev || (dev->flags & IFF_UP)) {
-		dev_add_pack(&po->prot_hook);
-		sock_hold(sk);
-		po->running = 1;
+		register_prot_hook(sk);
 	} else {
 		sk->sk_err = ENETDOWN;
 		if (!sock_flag(sk, SOCK_DEAD))
@@ -1531,9 +2097,7 @@ static int packet_create(struct net *net, struct socket *sock, int protocol,
 
 	if (proto) {
 		po->prot_hook.type = proto;
-		dev_add_pack(&po->prot_hook);
-		sock_hold(sk);
-		po->running = 1;
+		register_prot_hook(sk);
 	}
 
 	spin_lock_bh(&net->packet.sklist_lock);
@@ -1656,13 +2220,16 @@ static int packet_recvmsg(struct kiocb *iocb, struct socket *sock,
 			/* This is a hint as to how much should be linear. */
 			vnet_hdr.hdr_len = skb_headlen(skb);
 			vnet_hdr.gso_size = sinfo->gso_size;
-			if (sinfo->gso_type & SKB_GSO_TCPV4)
+			if (sinfo->gso_type & SKB_GSO_GRE)
+				goto out_free;
+			else if (sinfo->gso_type & SKB_GSO_TCPV4)
 				vnet_hdr.gso_type = VIRTIO_NET_HDR_GSO_TCPV4;
 			else if (sinfo->gso_type & SKB_GSO_TCPV6)
 				vnet_hdr.gso_type = VIRTIO_NET_HDR_GSO_TCPV6;
 			else if (sinfo->gso_type & SKB_GSO_UDP)
 				vnet_hdr.gso_type = VIRTIO_NET_HDR_GSO_UDP;
-			else if (sinfo->gso_type & SKB_GSO_FCOE)
+			else if (sinfo->gso_type & (SKB_GSO_FCOE |
+						    SKB_GSO_UDP_L4))
 				goto out_free;
 			else
 				BUG();
@@ -1972,15 +2539,27 @@ packet_setsockopt(struct socket *sock, int level, int optname, char __user *optv
 	case PACKET_RX_RING:
 	case PACKET_TX_RING:
 	{
-		struct tpacket_req req;
+		union tpacket_req_u req_u;
+		int len;
 
-		if (optlen < sizeof(req))
+		switch (po->tp_version) {
+		case TPACKET_V1:
+		case TPACKET_V2:
+			len = sizeof(req_u.req);
+			break;
+		case TPACKET_V3:
+		default:
+			len = sizeof(req_u.req3);
+			break;
+		}
+		if (optlen < len)
 			return -EINVAL;
 		if (pkt_sk(sk)->has_vnet_hdr)
 			return -EINVAL;
-		if (copy_from_user(&req, optval, sizeof(req)))
+		if (copy_from_user(&req_u, optval, len))
 			return -EFAULT;
-		return packet_set_ring(sk, &req, 0, optname == PACKET_TX_RING);
+		return packet_set_ring(sk, &req_u, 0,
+				       optname == PACKET_TX_RING);
 	}
 	case PACKET_COPY_THRESH:
 	{
@@ -2007,6 +2586,7 @@ packet_setsockopt(struct socket *sock, int level, int optname, char __user *optv
 		switch (val) {
 		case TPACKET_V1:
 		case TPACKET_V2:
+		case TPACKET_V3:
 			po->tp_version = val;
 			return 0;
 		default:
@@ -2091,6 +2671,17 @@ packet_setsockopt(struct socket *sock, int level, int optname, char __user *optv
 		po->tp_tstamp = val;
 		return 0;
 	}
+	case PACKET_FANOUT:
+	{
+		int val;
+
+		if (optlen != sizeof(val))
+			return -EINVAL;
+		if (copy_from_user(&val, optval, sizeof(val)))
+			return -EFAULT;
+
+		return fanout_add(sk, val & 0xffff, val >> 16);
+	}
 	default:
 		return -ENOPROTOOPT;
 	}
@@ -2104,7 +2695,7 @@ static int packet_getsockopt(struct socket *sock, int level, int optname,
 	struct sock *sk = sock->sk;
 	struct packet_sock *po = pkt_sk(sk);
 	void *data;
-	struct tpacket_stats st;
+	struct tpacket_stats_v3 st;
 
 	if (level != SOL_PACKET)
 		return -ENOPROTOOPT;
@@ -2117,8 +2708,13 @@ static int packet_getsockopt(struct socket *sock, int level, int optname,
 
 	switch (optname) {
 	case PACKET_STATISTICS:
-		if (len > sizeof(struct tpacket_stats))
-			len = sizeof(struct tpacket_stats);
+		if (po->tp_version == TPACKET_V3) {
+			if (len > sizeof(struct tpacket_stats_v3))
+				len = sizeof(struct tpacket_stats_v3);
+		} else {
+			if (len > sizeof(struct tpacket_stats))
+				len = sizeof(struct tpacket_stats);
+		}
 		spin_lock_bh(&sk->sk_receive_queue.lock);
 		st = po->stats;
 		memset(&po->stats, 0, sizeof(st));
@@ -2166,6 +2762,9 @@ static int packet_getsockopt(struct socket *sock, int level, int optname,
 		case TPACKET_V2:
 			val = sizeof(struct tpacket2_hdr);
 			break;
+		case TPACKET_V3:
+			val = sizeof(struct tpacket3_hdr);
+			break;
 		default:
 			return -EINVAL;
 		}
@@ -2189,6 +2788,15 @@ static int packet_getsockopt(struct socket *sock, int level, int optname,
 		val = po->tp_tstamp;
 		data = &val;
 		break;
+	case PACKET_FANOUT:
+		if (len > sizeof(int))
+			len = sizeof(int);
+		val = (po->fanout ?
+		       ((u32)po->fanout->id |
+			((u32)po->fanout->type << 16)) :
+		       0);
+		data = &val;
+		break;
 	default:
 		return -ENOPROTOOPT;
 	}
@@ -2222,9 +2830,7 @@ static int packet_notifier(struct notifier_block *this, unsigned long msg, void
 			if (dev->ifindex == po->ifindex) {
 				spin_lock(&po->bind_lock);
 				if (po->running) {
-					__dev_remove_pack(&po->prot_hook);
-					__sock_put(sk);
-					po->running = 0;
+					__unregister_prot_hook(sk, false);
 					sk->sk_err = ENETDOWN;
 					if (!sock_flag(sk, SOCK_DEAD))
 						sk->sk_error_report(sk);
@@ -2239,11 +2845,8 @@ static int packet_notifier(struct notifier_block *this, unsigned long msg, void
 		case NETDEV_UP:
 			if (dev->ifindex == po->ifindex) {
 				spin_lock(&po->bind_lock);
-				if (po->num && !po->running) {
-					dev_add_pack(&po->prot_hook);
-					sock_hold(sk);
-					po->running = 1;
-				}
+				if (po->num)
+					register_prot_hook(sk);
 				spin_unlock(&po->bind_lock);
 			}
 			break;
@@ -2316,7 +2919,8 @@ static unsigned int packet_poll(struct file *file, struct socket *sock,
 
 	spin_lock_bh(&sk->sk_receive_queue.lock);
 	if (po->rx_ring.pg_vec) {
-		if (!packet_previous_frame(po, &po->rx_ring, TP_STATUS_KERNEL))
+		if (!packet_previous_rx_frame(po, &po->rx_ring,
+					      TP_STATUS_KERNEL))
 			mask |= POLLIN | POLLRDNORM;
 	}
 	spin_unlock_bh(&sk->sk_receive_queue.lock);
@@ -2435,7 +3039,7 @@ out_free_pgvec:
 	goto out;
 }
 
-static int packet_set_ring(struct sock *sk, struct tpacket_req *req,
+static int packet_set_ring(struct sock *sk, union tpacket_req_u *req_u,
 		int closing, int tx_ring)
 {
 	struct pgv *pg_vec = NULL;
@@ -2443,12 +3047,18 @@ static int packet_set_ring(struct sock *sk, struct tpacket_req *req,
 	int was_running, order = 0;
 	struct packet_ring_buffer *rb;
 	struct sk_buff_head *rb_queue;
+	struct tpacket_req *req = &req_u->req;
 	__be16 num;
 	int err;
 
 	rb = tx_ring ? &po->tx_ring : &po->rx_ring;
 	rb_queue = tx_ring ? &sk->sk_write_queue : &sk->sk_receive_queue;
 
+	/* The block based TPACKET_V3 layout only exists for the rx ring */
+	err = -EINVAL;
+	if (!closing && tx_ring && po->tp_version == TPACKET_V3)
+		goto out;
+
 	err = -EBUSY;
 	if (!closing) {
 		if (atomic_read(&po->mapped))
@@ -2470,6 +3080,9 @@ static int packet_set_ring(struct sock *sk, struct tpacket_req *req,
 		case TPACKET_V2:
 			po->tp_hdrlen = TPACKET2_HDRLEN;
 			break;
+		case TPACKET_V3:
+			po->tp_hdrlen = TPACKET3_HDRLEN;
+			break;
 		}
 
 		err = -EINVAL;
@@ -2489,6 +3102,12 @@ static int packet_set_ring(struct sock *sk, struct tpacket_req *req,
 		if (unlikely((rb->frames_per_block * req->tp_block_nr) !=
 					req->tp_frame_nr))
 			goto out;
+		/* Every block must hold its header plus at least one frame */
+		if (po->tp_version == TPACKET_V3 &&
+		    (unlikely(req_u->req3.tp_sizeof_priv >= req->tp_block_size) ||
+		     unlikely(BLK_PLUS_PRIV(req_u->req3.tp_sizeof_priv) +
+			      req->tp_frame_size > req->tp_block_size)))
+			goto out;
 
 		err = -ENOMEM;
 		order = get_order(req->tp_block_size);
@@ -2510,10 +3129,8 @@ static int packet_set_ring(struct sock *sk, struct tpacket_req *req,
 	was_running = po->running;
 	num = po->num;
 	if (was_running) {
-		__dev_remove_pack(&po->prot_hook);
 		po->num = 0;
-		po->running = 0;
-		__sock_put(sk);
+		__unregister_prot_hook(sk, false);
 	}
 	spin_unlock(&po->bind_lock);
 
@@ -2523,11 +3140,16 @@ static int packet_set_ring(struct sock *sk, struct tpacket_req *req,
 	mutex_lock(&po->pg_vec_lock);
 	if (closing || atomic_read(&po->mapped) == 0) {
 		err = 0;
+		if (!tx_ring && po->tp_version == TPACKET_V3 && rb->pg_vec)
+			prb_shutdown_retire_blk_timer(po, rb_queue);
+
 		spin_lock_bh(&rb_queue->lock);
 		swap(rb->pg_vec, pg_vec);
 		rb->frame_max = (req->tp_frame_nr - 1);
 		rb->head = 0;
 		rb->frame_size = req->tp_frame_size;
+		if (!tx_ring && po->tp_version == TPACKET_V3 && rb->pg_vec)
+			init_prb_bdqc(po, rb, &req_u->req3);
 		spin_unlock_bh(&rb_queue->lock);
 
 		swap(rb->pg_vec_order, order);
@@ -2544,11 +3166,9 @@ static int packet_set_ring(struct sock *sk, struct tpacket_req *req,
 	mutex_unlock(&po->pg_vec_lock);
 
 	spin_lock(&po->bind_lock);
-	if (was_running && !po->running) {
-		sock_hold(sk);
-		po->running = 1;
+	if (was_running) {
 		po->num = num;
-		dev_add_pack(&po->prot_hook);
+		register_prot_hook(sk);
 	}
 	spin_unlock(&po->bind_lock);
 
@@ -0,0 +1,799 @@
+/*
+ * net/sched/cls_flower.c		Flower classifier
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ * Every packet is parsed once into a struct fl_flow_key. Filters are
+ * grouped by their mask; each distinct mask owns a hash table of the
+ * masked keys of its filters, so a packet is classified with one hash
+ * lookup per distinct mask no matter how many filters are installed.
+ * Masks are tried in the order they were first created.
+ */
+
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/errno.h>
+#include <linux/jhash.h>
+#include <linux/rtnetlink.h>
+#include <linux/skbuff.h>
+#include <linux/if_arp.h>
+#include <linux/if_ether.h>
+#include <linux/in6.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+#include <net/ip.h>
+#include <net/ipv6.h>
+#include <net/netlink.h>
+#include <net/act_api.h>
+#include <net/pkt_cls.h>
+
+#define FL_HASH_MIN_BITS	4
+#define FL_HASH_MAX_BITS	12
+
+struct fl_flow_key {
+	int	indev_ifindex;
+	struct {
+		u8	dst[ETH_ALEN];
+		u8	src[ETH_ALEN];
+	} eth;
+	__be16	n_proto;
+	u8	ip_proto;
+	union {
+		struct {
+			__be32	src;
+			__be32	dst;
+		} ipv4;
+		struct {
+			struct in6_addr	src;
+			struct in6_addr	dst;
+		} ipv6;
+	};
+	struct {
+		__be16	src;
+		__be16	dst;
+	} tp;
+} __aligned(BITS_PER_LONG / 8); /* Ensure that we can do comparisons as longs. */
+
+struct fl_flow_mask {
+	struct fl_flow_key	key;
+	/* Only bytes [start, end) of the key are covered by the mask. */
+	unsigned short		start;
+	unsigned short		end;
+	unsigned int		hash_bits;
+	unsigned int		count;
+	struct hlist_head	*buckets;
+	struct list_head	list;
+};
+
+struct cls_fl_head {
+	u32			hgenerator;
+	struct list_head	filters;
+	struct list_head	masks;
+};
+
+struct cls_fl_filter {
+	u32			handle;
+	struct fl_flow_mask	*mask;
+	struct fl_flow_key	key;	/* already masked */
+	char			indev[IFNAMSIZ];
+	struct tcf_result	res;
+	struct tcf_exts		exts;
+	struct hlist_node	hnode;
+	struct list_head	list;
+};
+
+static const struct tcf_ext_map fl_ext_map = {
+	.action = TCA_FLOWER_ACT,
+};
+
+static void *fl_key_get_start(const struct fl_flow_key *key,
+			      const struct fl_flow_mask *mask)
+{
+	return (u8 *) key + mask->start;
+}
+
+static void fl_set_masked_key(struct fl_flow_key *mkey,
+			      const struct fl_flow_key *key,
+			      const struct fl_flow_mask *mask)
+{
+	const long *lkey = fl_key_get_start(key, mask);
+	const long *lmask = fl_key_get_start(&mask->key, mask);
+	long *lmkey = fl_key_get_start(mkey, mask);
+	int i;
+
+	for (i = mask->start; i < mask->end; i += sizeof(long))
+		*lmkey++ = *lkey++ & *lmask++;
+}
+
+static struct hlist_head *fl_mask_bucket(const struct fl_flow_mask *mask,
+					 const struct fl_flow_key *mkey,
+					 struct hlist_head *buckets,
+					 unsigned int bits)
+{
+	u32 hash = jhash2(fl_key_get_start(mkey, mask),
+			  (mask->end - mask->start) / sizeof(u32), 0);
+
+	return &buckets[hash & ((1U << bits) - 1)];
+}
+
+static struct cls_fl_filter *fl_lookup(const struct fl_flow_mask *mask,
+				       const struct fl_flow_key *mkey)
+{
+	struct cls_fl_filter *f;
+	struct hlist_node *node;
+	struct hlist_head *head;
+
+	head = fl_mask_bucket(mask, mkey, mask->buckets, mask->hash_bits);
+	hlist_for_each_entry(f, node, head, hnode)
+		if (!memcmp(fl_key_get_start(&f->key, mask),
+			    fl_key_get_start(mkey, mask),
+			    mask->end - mask->start))
+			return f;
+	return NULL;
+}
+
+static void fl_key_from_skb(struct sk_buff *skb, struct fl_flow_key *key)
+{
+	int thoff = -1;
+
+	memset(key, 0, sizeof(*key));
+
+	key->indev_ifindex = skb->skb_iif;
+	if (skb_mac_header_was_set(skb) &&
+	    skb->dev && skb->dev->type == ARPHRD_ETHER) {
+		const struct ethhdr *eth = eth_hdr(skb);
+
+		memcpy(key->eth.dst, eth->h_dest, ETH_ALEN);
+		memcpy(key->eth.src, eth->h_source, ETH_ALEN);
+	}
+	key->n_proto = skb->protocol;
+
+	switch (skb->protocol) {
+	case htons(ETH_P_IP): {
+		const struct iphdr *iph;
+
+		if (!pskb_network_may_pull(skb, sizeof(*iph)))
+			return;
+		iph = ip_hdr(skb);
+		key->ip_proto = iph->protocol;
+		key->ipv4.src = iph->saddr;
+		key->ipv4.dst = iph->daddr;
+		if (!(iph->frag_off & htons(IP_MF | IP_OFFSET)))
+			thoff = iph->ihl * 4;
+		break;
+	}
+	case htons(ETH_P_IPV6): {
+		const struct ipv6hdr *ip6h;
+
+		if (!pskb_network_may_pull(skb, sizeof(*ip6h)))
+			return;
+		ip6h = ipv6_hdr(skb);
+		key->ip_proto = ip6h->nexthdr;
+		ipv6_addr_copy(&key->ipv6.src, &ip6h->saddr);
+		ipv6_addr_copy(&key->ipv6.dst, &ip6h->daddr);
+		thoff = sizeof(*ip6h);
+		break;
+	}
+	default:
+		return;
+	}
+
+	if (thoff >= 0 &&
+	    (key->ip_proto == IPPROTO_TCP || key->ip_proto == IPPROTO_UDP) &&
+	    pskb_network_may_pull(skb, thoff + 2 * sizeof(__be16))) {
+		const __be16 *ports;
+
+		ports = (const __be16 *) (skb_network_header(skb) + thoff);
+		key->tp.src = ports[0];
+		key->tp.dst = ports[1];
+	}
+}
+
+static int fl_classify(struct sk_buff *skb, struct tcf_proto *tp,
+		       struct tcf_result *res)
+{
+	struct cls_fl_head *head = tp->root;
+	struct fl_flow_key skb_key, skb_mkey;
+	struct fl_flow_mask *mask;
+	struct cls_fl_filter *f;
+	int r;
+
+	if (list_empty(&head->masks))
+		return -1;
+
+	fl_key_from_skb(skb, &skb_key);
+
+	list_for_each_entry(mask, &head->masks, list) {
+		fl_set_masked_key(&skb_mkey, &skb_key, mask);
+		f = fl_lookup(mask, &skb_mkey);
+		if (f == NULL)
+			continue;
+		*res = f->res;
+		r = tcf_exts_exec(skb, &f->exts, res);
+		if (r < 0)
+			continue;
+		return r;
+	}
+	return -1;
+}
+
+static unsigned long fl_get(struct tcf_proto *tp, u32 handle)
+{
+	struct cls_fl_head *head = tp->root;
+	struct cls_fl_filter *f;
+
+	if (head == NULL)
+		return 0UL;
+
+	list_for_each_entry(f, &head->filters, list)
+		if (f->handle == handle)
+			return (unsigned long) f;
+
+	return 0UL;
+}
+
+static void fl_put(struct tcf_proto *tp, unsigned long f)
+{
+}
+
+static int fl_init(struct tcf_proto *tp)
+{
+	struct cls_fl_head *head;
+
+	head = kzalloc(sizeof(*head), GFP_KERNEL);
+	if (head == NULL)
+		return -ENOBUFS;
+	INIT_LIST_HEAD(&head->filters);
+	INIT_LIST_HEAD(&head->masks);
+	tp->root = head;
+	return 0;
+}
+
+static struct fl_flow_mask *fl_mask_create(const struct fl_flow_key *key)
+{
+	const u8 *bytes = (const u8 *) key;
+	struct fl_flow_mask *mask;
+	size_t i, first = sizeof(*key), last = 0;
+
+	mask = kzalloc(sizeof(*mask), GFP_KERNEL);
+	if (mask == NULL)
+		return NULL;
+
+	mask->hash_bits = FL_HASH_MIN_BITS;
+	mask->buckets = kcalloc(1U << mask->hash_bits,
+				sizeof(*mask->buckets), GFP_KERNEL);
+	if (mask->buckets == NULL) {
+		kfree(mask);
+		return NULL;
+	}
+
+	memcpy(&mask->key, key, sizeof(*key));
+	for (i = 0; i < sizeof(*key); i++) {
+		if (!bytes[i])
+			continue;
+		if (first == sizeof(*key))
+			first = i;
+		last = i;
+	}
+	if (first < sizeof(*key)) {
+		mask->start = rounddown(first, sizeof(long));
+		mask->end = roundup(last + 1, sizeof(long));
+	}
+	return mask;
+}
+
+static void fl_mask_free(struct fl_flow_mask *mask)
+{
+	kfree(mask->buckets);
+	kfree(mask);
+}
+
+/* Double the hash table of @mask once it holds more filters than buckets.
+ * Failing to allocate the bigger table is not an error, lookups just get
+ * slower.
+ */
+static void fl_mask_grow(struct tcf_proto *tp, struct fl_flow_mask *mask)
+{
+	unsigned int i, bits = mask->hash_bits + 1;
+	struct hlist_head *buckets, *old;
+	struct hlist_node *node, *tmp;
+	struct cls_fl_filter *f;
+
+	if (mask->count <= (1U << mask->hash_bits) ||
+	    mask->hash_bits >= FL_HASH_MAX_BITS)
+		return;
+
+	buckets = kcalloc(1U << bits, sizeof(*buckets), GFP_KERNEL);
+	if (buckets == NULL)
+		return;
+
+	tcf_tree_lock(tp);
+	old = mask->buckets;
+	for (i = 0; i < (1U << mask->hash_bits); i++) {
+		hlist_for_each_entry_safe(f, node, tmp, &old[i], hnode) {
+			hlist_del(&f->hnode);
+			hlist_add_head(&f->hnode,
+				       fl_mask_bucket(mask, &f->key,
+						      buckets, bits));
+		}
+	}
+	mask->buckets = buckets;
+	mask->hash_bits = bits;
+	tcf_tree_unlock(tp);
+
+	kfree(old);
+}
+
+static void fl_destroy_filter(struct tcf_proto *tp, struct cls_fl_filter *f)
+{
+	tcf_unbind_filter(tp, &f->res);
+	tcf_exts_destroy(tp, &f->exts);
+	kfree(f);
+}
+
+static void fl_destroy(struct tcf_proto *tp)
+{
+	struct cls_fl_head *head = tp->root;
+	struct cls_fl_filter *f, *next;
+	struct fl_flow_mask *mask, *mnext;
+
+	list_for_each_entry_safe(f, next, &head->filters, list) {
+		list_del(&f->list);
+		fl_destroy_filter(tp, f);
+	}
+	list_for_each_entry_safe(mask, mnext, &head->masks, list) {
+		list_del(&mask->list);
+		fl_mask_free(mask);
+	}
+	kfree(head);
+}
+
+/* Unlink @f from its mask and the filter list. Returns the mask if this
+ * was its last filter, the caller frees it after dropping the tree lock.
+ */
+static struct fl_flow_mask *fl_unlink_filter(struct cls_fl_filter *f)
+{
+	struct fl_flow_mask *mask = f->mask;
+
+	list_del(&f->list);
+	hlist_del(&f->hnode);
+	if (--mask->count)
+		return NULL;
+	list_del(&mask->list);
+	return mask;
+}
+
+static int fl_delete(struct tcf_proto *tp, unsigned long arg)
+{
+	struct cls_fl_filter *f = (struct cls_fl_filter *) arg;
+	struct fl_flow_mask *mask;
+
+	tcf_tree_lock(tp);
+	mask = fl_unlink_filter(f);
+	tcf_tree_unlock(tp);
+
+	if (mask)
+		fl_mask_free(mask);
+	fl_destroy_filter(tp, f);
+	return 0;
+}
+
+static const struct nla_policy fl_policy[TCA_FLOWER_MAX + 1] = {
+	[TCA_FLOWER_CLASSID]		= { .type = NLA_U32 },
+	[TCA_FLOWER_INDEV]		= { .type = NLA_STRING,
+					    .len = IFNAMSIZ },
+	[TCA_FLOWER_ACT]		= { .type = NLA_NESTED },
+	[TCA_FLOWER_KEY_ETH_DST]	= { .len = ETH_ALEN },
+	[TCA_FLOWER_KEY_ETH_DST_MASK]	= { .len = ETH_ALEN },
+	[TCA_FLOWER_KEY_ETH_SRC]	= { .len = ETH_ALEN },
+	[TCA_FLOWER_KEY_ETH_SRC_MASK]	= { .len = ETH_ALEN },
+	[TCA_FLOWER_KEY_ETH_TYPE]	= { .type = NLA_U16 },
+	[TCA_FLOWER_KEY_IP_PROTO]	= { .type = NLA_U8 },
+	[TCA_FLOWER_KEY_IPV4_SRC]	= { .type = NLA_U32 },
+	[TCA_FLOWER_KEY_IPV4_SRC_MASK]	= { .type = NLA_U32 },
+	[TCA_FLOWER_KEY_IPV4_DST]	= { .type = NLA_U32 },
+	[TCA_FLOWER_KEY_IPV4_DST_MASK]	= { .type = NLA_U32 },
+	[TCA_FLOWER_KEY_IPV6_SRC]	= { .len = sizeof(struct in6_addr) },
+	[TCA_FLOWER_KEY_IPV6_SRC_MASK]	= { .len = sizeof(struct in6_addr) },
+	[TCA_FLOWER_KEY_IPV6_DST]	= { .len = sizeof(struct in6_addr) },
+	[TCA_FLOWER_KEY_IPV6_DST_MASK]	= { .len = sizeof(struct in6_addr) },
+	[TCA_FLOWER_KEY_TCP_SRC]	= { .type = NLA_U16 },
+	[TCA_FLOWER_KEY_TCP_DST]	= { .type = NLA_U16 },
+	[TCA_FLOWER_KEY_UDP_SRC]	= { .type = NLA_U16 },
+	[TCA_FLOWER_KEY_UDP_DST]	= { .type = NLA_U16 },
+};
+
+static void fl_set_key_val(struct nlattr **tb,
+			   void *val, int val_type,
+			   void *mask, int mask_type, int len)
+{
+	if (!tb[val_type])
+		return;
+	memcpy(val, nla_data(tb[val_type]), len);
+	if (mask_type == TCA_FLOWER_UNSPEC || !tb[mask_type])
+		memset(mask, 0xff, len);
+	else
+		memcpy(mask, nla_data(tb[mask_type]), len);
+}
+
+static int fl_set_key(struct nlattr **tb, struct fl_flow_key *key,
+		      struct fl_flow_key *mask)
+{
+	fl_set_key_val(tb, key->eth.dst, TCA_FLOWER_KEY_ETH_DST,
+		       mask->eth.dst, TCA_FLOWER_KEY_ETH_DST_MASK,
+		       sizeof(key->eth.dst));
+	fl_set_key_val(tb, key->eth.src, TCA_FLOWER_KEY_ETH_SRC,
+		       mask->eth.src, TCA_FLOWER_KEY_ETH_SRC_MASK,
+		       sizeof(key->eth.src));
+	fl_set_key_val(tb, &key->n_proto, TCA_FLOWER_KEY_ETH_TYPE,
+		       &mask->n_proto, TCA_FLOWER_UNSPEC,
+		       sizeof(key->n_proto));
+
+	/* Upper layer keys are only meaningful for the matching lower
+	 * layer protocol, reject filters that could never match.
+	 */
+	if (tb[TCA_FLOWER_KEY_IP_PROTO]) {
+		if (key->n_proto != htons(ETH_P_IP) &&
+		    key->n_proto != htons(ETH_P_IPV6))
+			return -EINVAL;
+		fl_set_key_val(tb, &key->ip_proto, TCA_FLOWER_KEY_IP_PROTO,
+			       &mask->ip_proto, TCA_FLOWER_UNSPEC,
+			       sizeof(key->ip_proto));
+	}
+
+	if (tb[TCA_FLOWER_KEY_IPV4_SRC] || tb[TCA_FLOWER_KEY_IPV4_DST]) {
+		if (key->n_proto != htons(ETH_P_IP))
+			return -EINVAL;
+		fl_set_key_val(tb, &key->ipv4.src, TCA_FLOWER_KEY_IPV4_SRC,
+			       &mask->ipv4.src, TCA_FLOWER_KEY_IPV4_SRC_MASK,
+			       sizeof(key->ipv4.src));
+		fl_set_key_val(tb, &key->ipv4.dst, TCA_FLOWER_KEY_IPV4_DST,
+			       &mask->ipv4.dst, TCA_FLOWER_KEY_IPV4_DST_MASK,
+			       sizeof(key->ipv4.dst));
+	} else if (tb[TCA_FLOWER_KEY_IPV6_SRC] || tb[TCA_FLOWER_KEY_IPV6_DST]) {
+		if (key->n_proto != htons(ETH_P_IPV6))
+			return -EINVAL;
+		fl_set_key_val(tb, &key->ipv6.src, TCA_FLOWER_KEY_IPV6_SRC,
+			       &mask->ipv6.src, TCA_FLOWER_KEY_IPV6_SRC_MASK,
+			       sizeof(key->ipv6.src));
+		fl_set_key_val(tb, &key->ipv6.dst, TCA_FLOWER_KEY_IPV6_DST,
+			       &mask->ipv6.dst, TCA_FLOWER_KEY_IPV6_DST_MASK,
+			       sizeof(key->ipv6.dst));
+	}
+
+	if (tb[TCA_FLOWER_KEY_TCP_SRC] || tb[TCA_FLOWER_KEY_TCP_DST]) {
+		if (!tb[TCA_FLOWER_KEY_IP_PROTO] ||
+		    key->ip_proto != IPPROTO_TCP)
+			return -EINVAL;
+		fl_set_key_val(tb, &key->tp.src, TCA_FLOWER_KEY_TCP_SRC,
+			       &mask->tp.src, TCA_FLOWER_UNSPEC,
+			       sizeof(key->tp.src));
+		fl_set_key_val(tb, &key->tp.dst, TCA_FLOWER_KEY_TCP_DST,
+			       &mask->tp.dst, TCA_FLOWER_UNSPEC,
+			       sizeof(key->tp.dst));
+	} else if (tb[TCA_FLOWER_KEY_UDP_SRC] || tb[TCA_FLOWER_KEY_UDP_DST]) {
+		if (!tb[TCA_FLOWER_KEY_IP_PROTO] ||
+		    key->ip_proto != IPPROTO_UDP)
+			return -EINVAL;
+		fl_set_key_val(tb, &key->tp.src, TCA_FLOWER_KEY_UDP_SRC,
+			       &mask->tp.src, TCA_FLOWER_UNSPEC,
+			       sizeof(key->tp.src));
+		fl_set_key_val(tb, &key->tp.dst, TCA_FLOWER_KEY_UDP_DST,
+			       &mask->tp.dst, TCA_FLOWER_UNSPEC,
+			       sizeof(key->tp.dst));
+	}
+
+	return 0;
+}
+
+static int fl_set_parms(struct tcf_proto *tp, struct cls_fl_filter *f,
+			struct fl_flow_key *mask, struct nlattr **tb,
+			struct nlattr *est)
+{
+	long *lkey = (long *) &f->key, *lmask = (long *) mask;
+	int i, err;
+
+	if (tb[TCA_FLOWER_INDEV]) {
+		struct net_device *dev;
+
+		nla_strlcpy(f->indev, tb[TCA_FLOWER_INDEV], IFNAMSIZ);
+		dev = __dev_get_by_name(dev_net(qdisc_dev(tp->q)), f->indev);
+		if (dev == NULL)
+			return -EINVAL;
+		f->key.indev_ifindex = dev->ifindex;
+		memset(&mask->indev_ifindex, 0xff, sizeof(mask->indev_ifindex));
+	}
+
+	err = fl_set_key(tb, &f->key, mask);
+	if (err < 0)
+		return err;
+
+	/* Keep only the masked key so it can be hashed and compared as is. */
+	for (i = 0; i < sizeof(f->key) / sizeof(long); i++)
+		lkey[i] &= lmask[i];
+
+	err = tcf_exts_validate(tp, tb, est, &f->exts, &fl_ext_map);
+	if (err < 0)
+		return err;
+
+	if (tb[TCA_FLOWER_CLASSID])
+		f->res.classid = nla_get_u32(tb[TCA_FLOWER_CLASSID]);
+
+	return 0;
+}
+
+/* Changing an existing filter replaces it as a whole: the new key, mask,
+ * class and actions are all taken from the request.
+ */
+static int fl_change(struct tcf_proto *tp, unsigned long base, u32 handle,
+		     struct nlattr **tca, unsigned long *arg)
+{
+	struct cls_fl_head *head = tp->root;
+	struct cls_fl_filter *fold = (struct cls_fl_filter *) *arg;
+	struct cls_fl_filter *fnew, *f;
+	struct fl_flow_mask *m, *mask, *new_mask = NULL, *old_mask = NULL;
+	struct nlattr *tb[TCA_FLOWER_MAX + 1];
+	struct fl_flow_key mask_key;
+	int err;
+
+	if (tca[TCA_OPTIONS] == NULL)
+		return -EINVAL;
+
+	err = nla_parse_nested(tb, TCA_FLOWER_MAX, tca[TCA_OPTIONS],
+			       fl_policy);
+	if (err < 0)
+		return err;
+
+	if (fold != NULL && handle && fold->handle != handle)
+		return -EINVAL;
+
+	fnew = kzalloc(sizeof(*fnew), GFP_KERNEL);
+	if (fnew == NULL)
+		return -ENOBUFS;
+
+	if (fold != NULL)
+		fnew->handle = fold->handle;
+	else if (handle)
+		fnew->handle = handle;
+	else {
+		unsigned int i = 0x80000000;
+		do {
+			if (++head->hgenerator == 0x7FFFFFFF)
+				head->hgenerator = 1;
+		} while (--i > 0 && fl_get(tp, head->hgenerator));
+
+		if (i <= 0) {
+			pr_err("Insufficient number of handles\n");
+			err = -EINVAL;
+			goto errout;
+		}
+
+		fnew->handle = head->hgenerator;
+	}
+
+	memset(&mask_key, 0, sizeof(mask_key));
+	err = fl_set_parms(tp, fnew, &mask_key, tb, tca[TCA_RATE]);
+	if (err < 0)
+		goto errout_exts;
+
+	mask = NULL;
+	list_for_each_entry(m, &head->masks, list) {
+		if (!memcmp(&m->key, &mask_key, sizeof(mask_key))) {
+			mask = m;
+			break;
+		}
+	}
+	if (mask == NULL) {
+		err = -ENOBUFS;
+		new_mask = fl_mask_create(&mask_key);
+		if (new_mask == NULL)
+			goto errout_exts;
+		mask = new_mask;
+	}
+
+	f = fl_lookup(mask, &fnew->key);
+	if (f != NULL && f != fold) {
+		err = -EEXIST;
+		goto errout_mask;
+	}
+
+	fnew->mask = mask;
+	if (fnew->res.classid)
+		tcf_bind_filter(tp, &fnew->res, base);
+
+	tcf_tree_lock(tp);
+	if (new_mask != NULL)
+		list_add_tail(&new_mask->list, &head->masks);
+	hlist_add_head(&fnew->hnode,
+		       fl_mask_bucket(mask, &fnew->key,
+				      mask->buckets, mask->hash_bits));
+	mask->count++;
+	if (fold != NULL) {
+		list_add_tail(&fnew->list, &fold->list);
+		old_mask = fl_unlink_filter(fold);
+	} else
+		list_add_tail(&fnew->list, &head->filters);
+	tcf_tree_unlock(tp);
+
+	if (fold != NULL) {
+		if (old_mask)
+			fl_mask_free(old_mask);
+		fl_destroy_filter(tp, fold);
+	}
+	fl_mask_grow(tp, mask);
+
+	*arg = (unsigned long) fnew;
+	return 0;
+
+errout_mask:
+	if (new_mask != NULL)
+		fl_mask_free(new_mask);
+errout_exts:
+	tcf_exts_destroy(tp, &fnew->exts);
+errout:
+	kfree(fnew);
+	return err;
+}
+
+static void fl_walk(struct tcf_proto *tp, struct tcf_walker *arg)
+{
+	struct cls_fl_head *head = tp->root;
+	struct cls_fl_filter *f;
+
+	list_for_each_entry(f, &head->filters, list) {
+		if (arg->count < arg->skip)
+			goto skip;
+
+		if (arg->fn(tp, (unsigned long) f, arg) < 0) {
+			arg->stop = 1;
+			break;
+		}
+skip:
+		arg->count++;
+	}
+}
+
+static int fl_dump_key_val(struct sk_buff *skb,
+			   void *val, int val_type,
+			   void *mask, int mask_type, int len)
+{
+	const u8 *bytes = mask;
+	int i;
+
+	for (i = 0; i < len; i++)
+		if (bytes[i])
+			break;
+	if (i == len)
+		return 0;
+
+	NLA_PUT(skb, val_type, len, val);
+	if (mask_type != TCA_FLOWER_UNSPEC)
+		NLA_PUT(skb, mask_type, len, mask);
+	return 0;
+
+nla_put_failure:
+	return -EMSGSIZE;
+}
+
+static int fl_dump(struct tcf_proto *tp, unsigned long fh,
+		   struct sk_buff *skb, struct tcmsg *t)
+{
+	struct cls_fl_filter *f = (struct cls_fl_filter *) fh;
+	struct fl_flow_key *key, *mask;
+	struct nlattr *nest;
+
+	if (f == NULL)
+		return skb->len;
+
+	t->tcm_handle = f->handle;
+
+	nest = nla_nest_start(skb, TCA_OPTIONS);
+	if (nest == NULL)
+		goto nla_put_failure;
+
+	if (f->res.classid)
+		NLA_PUT_U32(skb, TCA_FLOWER_CLASSID, f->res.classid);
+
+	if (f->indev[0])
+		NLA_PUT_STRING(skb, TCA_FLOWER_INDEV, f->indev);
+
+	key = &f->key;
+	mask = &f->mask->key;
+
+	if (fl_dump_key_val(skb, key->eth.dst, TCA_FLOWER_KEY_ETH_DST,
+			    mask->eth.dst, TCA_FLOWER_KEY_ETH_DST_MASK,
+			    sizeof(key->eth.dst)) ||
+	    fl_dump_key_val(skb, key->eth.src, TCA_FLOWER_KEY_ETH_SRC,
+			    mask->eth.src, TCA_FLOWER_KEY_ETH_SRC_MASK,
+			    sizeof(key->eth.src)) ||
+	    fl_dump_key_val(skb, &key->n_proto, TCA_FLOWER_KEY_ETH_TYPE,
+			    &mask->n_proto, TCA_FLOWER_UNSPEC,
+			    sizeof(key->n_proto)) ||
+	    fl_dump_key_val(skb, &key->ip_proto, TCA_FLOWER_KEY_IP_PROTO,
+			    &mask->ip_proto, TCA_FLOWER_UNSPEC,
+			    sizeof(key->ip_proto)))
+		goto nla_put_failure;
+
+	if (key->n_proto == htons(ETH_P_IP) &&
+	    (fl_dump_key_val(skb, &key->ipv4.src, TCA_FLOWER_KEY_IPV4_SRC,
+			     &mask->ipv4.src, TCA_FLOWER_KEY_IPV4_SRC_MASK,
+			     sizeof(key->ipv4.src)) ||
+	     fl_dump_key_val(skb, &key->ipv4.dst, TCA_FLOWER_KEY_IPV4_DST,
+			     &mask->ipv4.dst, TCA_FLOWER_KEY_IPV4_DST_MASK,
+			     sizeof(key->ipv4.dst))))
+		goto nla_put_failure;
+	else if (key->n_proto == htons(ETH_P_IPV6) &&
+		 (fl_dump_key_val(skb, &key->ipv6.src, TCA_FLOWER_KEY_IPV6_SRC,
+				  &mask->ipv6.src, TCA_FLOWER_KEY_IPV6_SRC_MASK,
+				  sizeof(key->ipv6.src)) ||
+		  fl_dump_key_val(skb, &key->ipv6.dst, TCA_FLOWER_KEY_IPV6_DST,
+				  &mask->ipv6.dst, TCA_FLOWER_KEY_IPV6_DST_MASK,
+				  sizeof(key->ipv6.dst))))
+		goto nla_put_failure;
+
+	if (key->ip_proto == IPPROTO_TCP &&
+	    (fl_dump_key_val(skb, &key->tp.src, TCA_FLOWER_KEY_TCP_SRC,
+			     &mask->tp.src, TCA_FLOWER_UNSPEC,
+			     sizeof(key->tp.src)) ||
+	     fl_dump_key_val(skb, &key->tp.dst, TCA_FLOWER_KEY_TCP_DST,
+			     &mask->tp.dst, TCA_FLOWER_UNSPEC,
+			     sizeof(key->tp.dst))))
+		goto nla_put_failure;
+	else if (key->ip_proto == IPPROTO_UDP &&
+		 (fl_dump_key_val(skb, &key->tp.src, TCA_FLOWER_KEY_UDP_SRC,
+				  &mask->tp.src, TCA_FLOWER_UNSPEC,
+				  sizeof(key->tp.src)) ||
+		  fl_dump_key_val(skb, &key->tp.dst, TCA_FLOWER_KEY_UDP_DST,
+				  &mask->tp.dst, TCA_FLOWER_UNSPEC,
+				  sizeof(key->tp.dst))))
+		goto nla_put_failure;
+
+	if (tcf_exts_dump(skb, &f->exts, &fl_ext_map) < 0)
+		goto nla_put_failure;
+
+	nla_nest_end(skb, nest);
+
+	if (tcf_exts_dump_stats(skb, &f->exts, &fl_ext_map) < 0)
+		goto nla_put_failure;
+
+	return skb->len;
+
+nla_put_failure:
+	nla_nest_cancel(skb, nest);
+	return -1;
+}
+
+static struct tcf_proto_ops cls_fl_ops __read_mostly = {
+	.kind		=	"flower",
+	.classify	=	fl_classify,
+	.init		=	fl_init,
+	.destroy	=	fl_destroy,
+	.get		=	fl_get,
+	.put		=	fl_put,
+	.change		=	fl_change,
+	.delete		=	fl_delete,
+	.walk		=	fl_walk,
+	.dump		=	fl_dump,
+	.owner		=	THIS_MODULE,
+};
+
+static int __init cls_fl_init(void)
+{
+	return register_tcf_proto_ops(&cls_fl_ops);
+}
+
+static void __exit cls_fl_exit(void)
+{
+	unregister_tcf_proto_ops(&cls_fl_ops);
+}
+
+module_init(cls_fl_init);
+module_exit(cls_fl_exit);
+MODULE_DESCRIPTION("Flower classifier");
+MODULE_LICENSE("GPL");
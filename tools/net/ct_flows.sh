@@ -0,0 +1,178 @@
+#!/bin/bash
+#
+# ct_flows.sh: connection tracking under many short-lived UDP flows
+#
+# pktgen sends UDP packets from random source addresses and ports out of
+# one end of a veth pair; the other end owns the destination address, so
+# every packet goes through conntrack and is delivered locally, where
+# the UDP stack counts it as sent to a closed port.  Each flow lasts
+# flowlen packets, and the UDP timeout is cut short so that entries go
+# stale and have to be reaped while the test runs.
+#
+# Reported: packets sent, packets that made it through conntrack to UDP,
+# the resulting rate, the share of CPU time spent in softirq, and the
+# conntrack table size plus new/delete/early_drop counts.  Run it on two
+# kernels with the same arguments to compare them.
+#
+# usage: ct_flows.sh [-c count] [-f flows] [-l flowlen] [-t udp_timeout]
+#		     [-m conntrack_max]
+#
+# Needs root, veth, pktgen and nf_conntrack_ipv4.  Leaves the conntrack
+# sysctls as it found them but does not unload any module.
+#
+
+COUNT=5000000
+FLOWS=65536
+FLOWLEN=4
+UDP_TIMEOUT=2
+CT_MAX=65536
+
+TX=ctb0
+RX=ctb1
+RX_ADDR=10.200.0.1
+
+usage()
+{
+	echo "usage: $0 [-c count] [-f flows] [-l flowlen] [-t udp_timeout]" \
+	     "[-m conntrack_max]" >&2
+	exit 2
+}
+
+while getopts "c:f:l:t:m:" opt; do
+	case $opt in
+	c) COUNT=$OPTARG ;;
+	f) FLOWS=$OPTARG ;;
+	l) FLOWLEN=$OPTARG ;;
+	t) UDP_TIMEOUT=$OPTARG ;;
+	m) CT_MAX=$OPTARG ;;
+	*) usage ;;
+	esac
+done
+
+pgset()
+{
+	local result
+
+	echo "$1" > $PGDEV
+	result=`cat $PGDEV | fgrep "Result: OK:"`
+	if [ "$result" = "" ]; then
+		cat $PGDEV | fgrep Result: >&2
+		exit 1
+	fi
+}
+
+# Sum one column of /proc/net/stat/nf_conntrack over all CPUs
+ct_stat()
+{
+	local col=$1 sum=0 v
+
+	for v in `awk -v c=$col 'NR > 1 { print $c }' \
+		  /proc/net/stat/nf_conntrack`; do
+		sum=$((sum + 0x$v))
+	done
+	echo $sum
+}
+
+ct_col()
+{
+	head -1 /proc/net/stat/nf_conntrack | tr ' ' '\n' | grep -v '^$' |
+		grep -n "^$1\$" | cut -d: -f1
+}
+
+udp_noports()
+{
+	awk '/^Udp:/ { if (!h) { for (i = 1; i <= NF; i++)
+				   if ($i == "NoPorts") c = i; h = 1 }
+		       else print $c }' /proc/net/snmp
+}
+
+# Total and softirq jiffies from the aggregate cpu line of /proc/stat
+cpu_times()
+{
+	awk '/^cpu / { t = 0; for (i = 2; i <= NF; i++) t += $i;
+		      print t, $8 }' /proc/stat
+}
+
+cleanup()
+{
+	echo "rem_device_all" > /proc/net/pktgen/kpktgend_0 2>/dev/null
+	ip link del $TX 2>/dev/null
+	[ -n "$OLD_MAX" ] && sysctl -qw net.netfilter.nf_conntrack_max=$OLD_MAX
+	[ -n "$OLD_TIMEOUT" ] &&
+		sysctl -qw net.netfilter.nf_conntrack_udp_timeout=$OLD_TIMEOUT
+}
+
+modprobe pktgen || exit 1
+modprobe nf_conntrack_ipv4 || exit 1
+modprobe veth || exit 1
+
+OLD_MAX=`sysctl -n net.netfilter.nf_conntrack_max`
+OLD_TIMEOUT=`sysctl -n net.netfilter.nf_conntrack_udp_timeout`
+trap cleanup EXIT
+
+sysctl -qw net.netfilter.nf_conntrack_max=$CT_MAX
+sysctl -qw net.netfilter.nf_conntrack_udp_timeout=$UDP_TIMEOUT
+sysctl -qw net.ipv4.icmp_ratelimit=1000
+
+ip link add $TX type veth peer name $RX || exit 1
+ip addr add $RX_ADDR/24 dev $RX
+ip link set $TX up
+ip link set $RX up
+# No reverse path filtering: the sources are random
+sysctl -qw net.ipv4.conf.$RX.rp_filter=0
+sysctl -qw net.ipv4.conf.all.rp_filter=0
+RX_MAC=`cat /sys/class/net/$RX/address`
+
+PGDEV=/proc/net/pktgen/kpktgend_0
+pgset "rem_device_all"
+pgset "add_device $TX"
+
+PGDEV=/proc/net/pktgen/$TX
+pgset "count $COUNT"
+pgset "clone_skb 0"
+pgset "pkt_size 60"
+pgset "delay 0"
+pgset "dst $RX_ADDR"
+pgset "dst_mac $RX_MAC"
+pgset "src_min 10.201.0.1"
+pgset "src_max 10.201.255.254"
+pgset "udp_src_min 1024"
+pgset "udp_src_max 65535"
+pgset "udp_dst_min 9"
+pgset "udp_dst_max 9"
+pgset "flag IPSRC_RND"
+pgset "flag UDPSRC_RND"
+pgset "flows $FLOWS"
+pgset "flowlen $FLOWLEN"
+
+NEW=`ct_col new`
+DELETE=`ct_col delete`
+EARLY=`ct_col early_drop`
+
+new0=`ct_stat $NEW`
+delete0=`ct_stat $DELETE`
+early0=`ct_stat $EARLY`
+delivered0=`udp_noports`
+read total0 softirq0 <<< "`cpu_times`"
+t0=`date +%s.%N`
+
+echo "start" > /proc/net/pktgen/pgctrl
+
+t1=`date +%s.%N`
+read total1 softirq1 <<< "`cpu_times`"
+delivered=$((`udp_noports` - delivered0))
+sent=`sed -n 's/.*pkts-sofar: \([0-9]*\).*/\1/p' /proc/net/pktgen/$TX`
+
+echo "flows $FLOWS x $FLOWLEN packets, udp timeout ${UDP_TIMEOUT}s," \
+     "conntrack_max $CT_MAX"
+awk -v s=$sent -v d=$delivered -v t0=$t0 -v t1=$t1 \
+    -v c0=$total0 -v c1=$total1 -v s0=$softirq0 -v s1=$softirq1 'BEGIN {
+	printf "sent %d, through conntrack %d (%.1f%%) in %.2fs: %.0f pps\n",
+	       s, d, s ? 100 * d / s : 0, t1 - t0, d / (t1 - t0)
+	printf "softirq %.1f%% of all CPU time\n",
+	       c1 > c0 ? 100 * (s1 - s0) / (c1 - c0) : 0
+}'
+echo "conntrack: `cat /proc/sys/net/netfilter/nf_conntrack_count` entries," \
+     "new $((`ct_stat $NEW` - new0))," \
+     "delete $((`ct_stat $DELETE` - delete0))," \
+     "early_drop $((`ct_stat $EARLY` - early0))"
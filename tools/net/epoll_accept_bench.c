@@ -0,0 +1,215 @@
+/*
+ * epoll_accept_bench: context switches per accepted connection
+ *
+ * Starts a number of worker threads, each with its own epoll set
+ * watching one shared listening socket, the way a multi-threaded
+ * server does.  The main thread then opens connections one at a time.
+ * Each worker accept()s whatever is pending whenever epoll_wait()
+ * returns.  Without EPOLLEXCLUSIVE every connection wakes every worker;
+ * all but one find nothing to do, either inside epoll_wait(), which
+ * goes back to sleep, or in accept().
+ *
+ * Reported per accepted connection: epoll_wait() returns, returns that
+ * found nothing to accept, and the context switches of the workers,
+ * which count every wakeup.
+ *
+ *	epoll_accept_bench [-t threads] [-n connections] [-e]
+ *
+ * -e adds the listening socket with EPOLLEXCLUSIVE.  Run the program
+ * with and without it.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#ifndef EPOLLEXCLUSIVE
+#define EPOLLEXCLUSIVE	(1u << 28)
+#endif
+
+#ifndef RUSAGE_THREAD
+#define RUSAGE_THREAD	1
+#endif
+
+#define MAX_THREADS	256
+
+struct worker {
+	pthread_t	thread;
+	int		epfd;
+	unsigned long	wakeups;	/* epoll_wait() returns */
+	unsigned long	empty;		/* ... with nothing to accept */
+	unsigned long	accepted;
+	long		csw;		/* context switches while running */
+};
+
+static int listen_fd;
+static int stop_fd[2];			/* pipe, readable once done */
+static struct worker workers[MAX_THREADS];
+
+static long thread_csw(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_THREAD, &ru);
+	return ru.ru_nvcsw + ru.ru_nivcsw;
+}
+
+static void *worker_fn(void *arg)
+{
+	struct worker *w = arg;
+	long csw = thread_csw();
+
+	for (;;) {
+		struct epoll_event ev;
+		unsigned long n = 0;
+		int fd;
+
+		if (epoll_wait(w->epfd, &ev, 1, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("epoll_wait");
+			exit(1);
+		}
+		if (ev.data.fd == stop_fd[0])
+			break;
+
+		w->wakeups++;
+		while ((fd = accept4(listen_fd, NULL, NULL,
+				     SOCK_NONBLOCK)) >= 0) {
+			close(fd);
+			n++;
+		}
+		if (errno != EAGAIN && errno != EWOULDBLOCK) {
+			perror("accept4");
+			exit(1);
+		}
+		if (!n)
+			w->empty++;
+		w->accepted += n;
+	}
+
+	w->csw = thread_csw() - csw;
+	return NULL;
+}
+
+static unsigned long total_accepted(int threads)
+{
+	unsigned long sum = 0;
+	int i;
+
+	for (i = 0; i < threads; i++)
+		sum += __atomic_load_n(&workers[i].accepted, __ATOMIC_RELAXED);
+	return sum;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-t threads] [-n connections] [-e]\n",
+		prog);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long conns = 10000, i, wakeups = 0, empty = 0;
+	struct sockaddr_in addr;
+	socklen_t alen = sizeof(addr);
+	int threads = 8, exclusive = 0, opt, t;
+	long csw = 0;
+
+	while ((opt = getopt(argc, argv, "t:n:e")) != -1) {
+		switch (opt) {
+		case 't':
+			threads = atoi(optarg);
+			break;
+		case 'n':
+			conns = strtoul(optarg, NULL, 0);
+			break;
+		case 'e':
+			exclusive = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (threads < 1 || threads > MAX_THREADS || !conns)
+		usage(argv[0]);
+
+	listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (listen_fd < 0 ||
+	    bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+	    getsockname(listen_fd, (struct sockaddr *)&addr, &alen) ||
+	    listen(listen_fd, 1024) || pipe(stop_fd)) {
+		perror("setup");
+		return 1;
+	}
+
+	for (t = 0; t < threads; t++) {
+		struct worker *w = &workers[t];
+		struct epoll_event ev;
+
+		w->epfd = epoll_create(1);
+		ev.events = EPOLLIN | (exclusive ? EPOLLEXCLUSIVE : 0);
+		ev.data.fd = listen_fd;
+		if (w->epfd < 0 ||
+		    epoll_ctl(w->epfd, EPOLL_CTL_ADD, listen_fd, &ev)) {
+			perror(exclusive ? "EPOLLEXCLUSIVE" : "epoll_ctl");
+			return 1;
+		}
+		ev.events = EPOLLIN;
+		ev.data.fd = stop_fd[0];
+		if (epoll_ctl(w->epfd, EPOLL_CTL_ADD, stop_fd[0], &ev)) {
+			perror("epoll_ctl");
+			return 1;
+		}
+		pthread_create(&w->thread, NULL, worker_fn, w);
+	}
+
+	/* One connection at a time, so each is one wakeup opportunity */
+	for (i = 0; i < conns; i++) {
+		int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+		if (fd < 0 ||
+		    connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+			perror("connect");
+			return 1;
+		}
+		close(fd);
+		while (total_accepted(threads) <= i)
+			sched_yield();
+	}
+
+	if (write(stop_fd[1], "x", 1) != 1)
+		return 1;
+	for (t = 0; t < threads; t++) {
+		pthread_join(workers[t].thread, NULL);
+		wakeups += workers[t].wakeups;
+		empty += workers[t].empty;
+		csw += workers[t].csw;
+	}
+
+	printf("%d threads, %lu connections%s\n", threads, conns,
+	       exclusive ? ", EPOLLEXCLUSIVE" : "");
+	printf("per connection: %.2f epoll_wait returns, %.2f of them empty, "
+	       "%.2f context switches\n", (double)wakeups / conns,
+	       (double)empty / conns, (double)csw / conns);
+	return 0;
+}
@@ -0,0 +1,315 @@
+/*
+ * ppp_async_test: check PPP async framing against a byte-at-a-time model
+ *
+ * ppp_async_encode() from drivers/net/ppp_async.c and crc_ccitt() from
+ * lib/crc-ccitt.c are pulled out of the kernel sources at build time
+ * (see the Makefile) and built here against a few stand-ins for kernel
+ * helpers.  The results are compared with straightforward versions that
+ * escape, and compute the FCS bit by bit, one byte at a time:
+ *
+ *  - crc_ccitt() over random buffers of every length up to 64 bytes and
+ *    at every alignment, and over random longer buffers;
+ *  - ppp_async_encode() on random packets with random async control
+ *    character maps, A/C and protocol field compression on or off, LCP
+ *    packets that must be sent with every control character escaped,
+ *    and packets larger than the output buffer, which take several
+ *    calls to encode.
+ *
+ * Every encoded frame is also unescaped again and its FCS checked the
+ * way the receive side does.
+ *
+ *	ppp_async_test [-n packets] [-s seed]
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+
+#define PPP_FLAG	0x7e
+#define PPP_ESCAPE	0x7d
+#define PPP_LCP		0xc021
+#define PPP_INITFCS	0xffff
+#define PPP_GOODFCS	0xf0b8
+#define SC_COMP_PROT	0x00000001
+#define SC_COMP_AC	0x00000002
+
+/* As in include/linux/crc-ccitt.h */
+extern u16 const crc_ccitt_table[256];
+
+static inline u16 crc_ccitt_byte(u16 crc, const u8 c)
+{
+	return (crc >> 8) ^ crc_ccitt_table[(crc ^ c) & 0xff];
+}
+
+#include "crc-ccitt.inc"
+#include "ppp_async_defs.inc"
+
+#define PPP_FCS(fcs, c)	crc_ccitt_byte(fcs, c)
+
+/* Just enough of the kernel for ppp_async_encode() */
+struct sk_buff {
+	unsigned char	*data;
+	int		len;
+};
+
+/* Only the members ppp_async_encode() uses */
+struct asyncppp {
+	unsigned int	flags;
+	u32		xaccm[8];
+	struct sk_buff	*tpkt;
+	int		tpkt_pos;
+	u16		tfcs;
+	unsigned char	*optr;
+	unsigned char	*olim;
+	unsigned long	last_xmit;
+	unsigned char	obuf[OBUFSIZE];
+};
+
+static unsigned long jiffies;
+static int flag_time;
+
+#define time_after_eq(a, b)	((long)((a) - (b)) >= 0)
+#define min_t(type, x, y)	((type)(x) < (type)(y) ? (type)(x) : (type)(y))
+#define get_unaligned_be16(p)	((u16)(((const u8 *)(p))[0] << 8 | \
+				       ((const u8 *)(p))[1]))
+
+static void kfree_skb(struct sk_buff *skb)
+{
+	(void)skb;
+}
+
+static void async_lcp_peek(struct asyncppp *ap, unsigned char *data,
+			   int len, int inbound)
+{
+	(void)ap, (void)data, (void)len, (void)inbound;
+}
+
+#include "ppp_async_encode.inc"
+
+#define MAX_PKT		(3 * OBUFSIZE)
+#define MAX_FRAME	(2 * (MAX_PKT + 4) + 2)
+
+static u16 ref_crc(u16 crc, const u8 *p, size_t len)
+{
+	int b;
+
+	while (len--) {
+		crc ^= *p++;
+		for (b = 0; b < 8; b++)
+			crc = crc & 1 ? (crc >> 1) ^ 0x8408 : crc >> 1;
+	}
+	return crc;
+}
+
+static int ref_escape(const struct asyncppp *ap, u8 c, int islcp)
+{
+	return (islcp && c < 0x20) || (ap->xaccm[c >> 5] >> (c & 0x1f) & 1);
+}
+
+static u8 *ref_put(const struct asyncppp *ap, u8 *out, u8 c, int islcp)
+{
+	if (ref_escape(ap, c, islcp)) {
+		*out++ = PPP_ESCAPE;
+		*out++ = c ^ 0x20;
+	} else
+		*out++ = c;
+	return out;
+}
+
+/* RFC 1662 framing, one byte at a time */
+static int ref_encode(const struct asyncppp *ap, const u8 *data, int count,
+		      u8 *out)
+{
+	u8 *start = out, hdr[2] = { 0xff, 0x03 };
+	int proto = data[0] << 8 | data[1];
+	int islcp = proto == PPP_LCP && 1 <= data[2] && data[2] <= 7;
+	u16 fcs = PPP_INITFCS;
+	int i;
+
+	*out++ = PPP_FLAG;
+	if (!(ap->flags & SC_COMP_AC) || islcp) {
+		for (i = 0; i < 2; i++) {
+			out = ref_put(ap, out, hdr[i], islcp);
+			fcs = ref_crc(fcs, &hdr[i], 1);
+		}
+	}
+	for (i = 0; i < count; i++) {
+		if (i == 0 && data[0] == 0 && (ap->flags & SC_COMP_PROT))
+			continue;
+		out = ref_put(ap, out, data[i], islcp);
+		fcs = ref_crc(fcs, &data[i], 1);
+	}
+	fcs = ~fcs;
+	out = ref_put(ap, out, fcs & 0xff, islcp);
+	out = ref_put(ap, out, fcs >> 8, islcp);
+	*out++ = PPP_FLAG;
+	return out - start;
+}
+
+/* Drive ppp_async_encode() until the whole packet is out */
+static int encode(struct asyncppp *ap, u8 *data, int count, u8 *out)
+{
+	struct sk_buff skb = { .data = data, .len = count };
+	int len = 0, done;
+
+	ap->tpkt = &skb;
+	ap->tpkt_pos = 0;
+	do {
+		done = ppp_async_encode(ap);
+		memcpy(out + len, ap->optr, ap->olim - ap->optr);
+		len += ap->olim - ap->optr;
+	} while (!done);
+	return len;
+}
+
+/* Strip flags and escapes, then check the FCS like the receive side */
+static int frame_fcs_ok(const u8 *frame, int len)
+{
+	static u8 raw[MAX_FRAME];
+	int i, n = 0;
+
+	for (i = 1; i < len - 1; i++)
+		raw[n++] = frame[i] == PPP_ESCAPE ? frame[++i] ^ 0x20 : frame[i];
+	return n >= 4 && crc_ccitt(PPP_INITFCS, raw, n) == PPP_GOODFCS;
+}
+
+static int test_crc(void)
+{
+	static u8 buf[4096 + 8];
+	int fail = 0, len, off, i;
+	u16 seed;
+
+	for (i = 0; i < (int)sizeof(buf); i++)
+		buf[i] = random();
+
+	for (len = 0; len <= 64; len++) {
+		for (off = 0; off < 8; off++) {
+			seed = random();
+			if (crc_ccitt(seed, buf + off, len) !=
+			    ref_crc(seed, buf + off, len)) {
+				printf("crc_ccitt: len %d off %d differs\n",
+				       len, off);
+				fail++;
+			}
+		}
+	}
+	for (i = 0; i < 1000; i++) {
+		len = random() % 4096;
+		off = random() % 8;
+		seed = random();
+		if (crc_ccitt(seed, buf + off, len) !=
+		    ref_crc(seed, buf + off, len)) {
+			printf("crc_ccitt: len %d off %d differs\n", len, off);
+			fail++;
+		}
+	}
+	return fail;
+}
+
+static void random_packet(struct asyncppp *ap, u8 *data, int *count)
+{
+	int i, len;
+
+	/* Mostly typical sizes, sometimes more than the output buffer */
+	len = random() % 8 ? 4 + random() % 1600 : 4 + random() % (MAX_PKT - 4);
+	for (i = 0; i < len; i++)
+		data[i] = random() % 4 ? random() : random() % 0x20;
+	for (i = 0; i < len; i++)
+		if (random() % 64 == 0)
+			data[i] = random() % 2 ? PPP_FLAG : PPP_ESCAPE;
+
+	switch (random() % 4) {
+	case 0:		/* LCP, sent as if nothing was negotiated */
+		data[0] = 0xc0;
+		data[1] = 0x21;
+		data[2] = random() % 9;
+		break;
+	case 1:		/* compressible protocol field */
+		data[0] = 0;
+		break;
+	}
+	*count = len;
+
+	memset(ap->xaccm, 0, sizeof(ap->xaccm));
+	switch (random() % 3) {
+	case 0:
+		ap->xaccm[0] = ~0U;
+		break;
+	case 1:
+		ap->xaccm[0] = random();
+		break;
+	case 2:
+		for (i = 0; i < 8; i++)
+			ap->xaccm[i] = random() & random();
+		break;
+	}
+	ap->xaccm[3] |= 0x60000000U;	/* always escape flag and escape */
+	ap->flags = random() % 4;
+}
+
+static int test_encode(unsigned long packets)
+{
+	static struct asyncppp ap;
+	static u8 data[MAX_PKT], got[MAX_FRAME], want[MAX_FRAME];
+	unsigned long p;
+	int fail = 0, count, glen, wlen;
+
+	for (p = 0; p < packets && fail < 10; p++) {
+		random_packet(&ap, data, &count);
+		glen = encode(&ap, data, count, got);
+		wlen = ref_encode(&ap, data, count, want);
+		if (glen != wlen || memcmp(got, want, glen)) {
+			printf("encode: packet %lu (len %d, flags %#x, "
+			       "xaccm[0] %#x) differs\n",
+			       p, count, ap.flags, ap.xaccm[0]);
+			fail++;
+		} else if (!frame_fcs_ok(got, glen)) {
+			printf("encode: packet %lu has a bad FCS\n", p);
+			fail++;
+		}
+	}
+	return fail;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long packets = 100000;
+	unsigned int seed = 1;
+	int opt, fail;
+
+	while ((opt = getopt(argc, argv, "n:s:")) != -1) {
+		switch (opt) {
+		case 'n':
+			packets = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			seed = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n packets] [-s seed]\n",
+				argv[0]);
+			return 2;
+		}
+	}
+	srandom(seed);
+
+	fail = test_crc();
+	fail += test_encode(packets);
+	if (fail) {
+		printf("FAIL: %d mismatches\n", fail);
+		return 1;
+	}
+	printf("OK: crc_ccitt and %lu packets match\n", packets);
+	return 0;
+}
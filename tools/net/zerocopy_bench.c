@@ -0,0 +1,304 @@
+/*
+ * zerocopy_bench: transmit throughput and CPU with and without MSG_ZEROCOPY
+ *
+ * Sends over TCP (or UDP with -u) for a fixed time and reports the data
+ * rate and the CPU time the sending process used per gigabyte.  With -z
+ * the socket sets SO_ZEROCOPY and every send passes MSG_ZEROCOPY; the
+ * completions are then read from the error queue, and the report says
+ * how many sends completed and how many of those the kernel had to copy
+ * after all (SO_EE_CODE_ZEROCOPY_COPIED).  On loopback every zerocopy
+ * send ends up copied, since local delivery must not keep user pages
+ * pinned; over veth into another namespace it is the same, so the copied
+ * ratio shows where the pages went rather than a failure.
+ *
+ *	zerocopy_bench [-z] [-u] [-s size] [-t seconds] [-a addr] [-p port]
+ *	zerocopy_bench -r [-u] [-p port]
+ *
+ * Without -a a receiver is forked on loopback.  For veth, start a
+ * receiver with -r on the far side (e.g. in another network namespace)
+ * and point the sender at it with -a.  Compare runs with and without -z.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <linux/errqueue.h>
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY	60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY	0x4000000
+#endif
+#ifndef SO_EE_ORIGIN_ZEROCOPY
+#define SO_EE_ORIGIN_ZEROCOPY		5
+#endif
+#ifndef SO_EE_CODE_ZEROCOPY_COPIED
+#define SO_EE_CODE_ZEROCOPY_COPIED	1
+#endif
+
+static unsigned long completions;	/* notifications read */
+static unsigned long completed;		/* sends they covered */
+static unsigned long copied;		/* ... that were copied after all */
+
+static double now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static double cpu_time(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 +
+	       ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+static void receiver(int udp, unsigned short port, int ready_fd)
+{
+	static char buf[1 << 16];
+	struct sockaddr_in addr;
+	int fd, one = 1;
+
+	fd = socket(AF_INET, udp ? SOCK_DGRAM : SOCK_STREAM, 0);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+	    (!udp && listen(fd, 1))) {
+		perror("receiver");
+		exit(1);
+	}
+	if (ready_fd >= 0 && write(ready_fd, "x", 1) != 1)
+		exit(1);
+
+	for (;;) {
+		int c = udp ? fd : accept(fd, NULL, NULL);
+
+		if (c < 0) {
+			perror("accept");
+			exit(1);
+		}
+		while (recv(c, buf, sizeof(buf), 0) > 0 || udp)
+			;
+		close(c);
+	}
+}
+
+/* Read every completion that is already queued */
+static void read_completions(int fd)
+{
+	char control[128];
+
+	for (;;) {
+		struct msghdr msg = {
+			.msg_control = control,
+			.msg_controllen = sizeof(control),
+		};
+		struct sock_extended_err *serr;
+		struct cmsghdr *cm;
+
+		if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return;
+			perror("recvmsg MSG_ERRQUEUE");
+			exit(1);
+		}
+		for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+			if (!(cm->cmsg_level == SOL_IP &&
+			      cm->cmsg_type == IP_RECVERR))
+				continue;
+			serr = (struct sock_extended_err *)CMSG_DATA(cm);
+			if (serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY ||
+			    serr->ee_errno != 0)
+				continue;
+			completions++;
+			completed += serr->ee_data - serr->ee_info + 1;
+			if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+				copied += serr->ee_data - serr->ee_info + 1;
+		}
+	}
+}
+
+static void wait_completions(int fd)
+{
+	struct pollfd pfd = { .fd = fd, .events = 0 };
+
+	if (poll(&pfd, 1, 100) < 0) {
+		perror("poll");
+		exit(1);
+	}
+	read_completions(fd);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-z] [-u] [-s size] [-t seconds] "
+		"[-a addr] [-p port]\n"
+		"       %s -r [-u] [-p port]\n", prog, prog);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long sends = 0, size = 0, bytes = 0;
+	const char *host = NULL;
+	unsigned short port = 18765;
+	int zerocopy = 0, udp = 0, recv_only = 0, secs = 10, one = 1;
+	struct sockaddr_in addr;
+	double t, c, end;
+	pid_t child = 0;
+	int fd, opt, pipefd[2];
+	char *buf, ready;
+
+	while ((opt = getopt(argc, argv, "zus:t:a:p:r")) != -1) {
+		switch (opt) {
+		case 'z':
+			zerocopy = 1;
+			break;
+		case 'u':
+			udp = 1;
+			break;
+		case 's':
+			size = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			secs = atoi(optarg);
+			break;
+		case 'a':
+			host = optarg;
+			break;
+		case 'p':
+			port = atoi(optarg);
+			break;
+		case 'r':
+			recv_only = 1;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (recv_only)
+		receiver(udp, port, -1);
+
+	if (!size)
+		size = udp ? 1472 : 65536;
+	if (secs < 1 || (udp && size > 65507))
+		usage(argv[0]);
+
+	if (!host) {
+		if (pipe(pipefd))
+			return 1;
+		child = fork();
+		if (child < 0) {
+			perror("fork");
+			return 1;
+		}
+		if (child == 0) {
+			close(pipefd[0]);
+			receiver(udp, port, pipefd[1]);
+		}
+		close(pipefd[1]);
+		if (read(pipefd[0], &ready, 1) != 1)
+			return 1;
+		host = "127.0.0.1";
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	if (inet_pton(AF_INET, host, &addr.sin_addr) != 1)
+		usage(argv[0]);
+
+	fd = socket(AF_INET, udp ? SOCK_DGRAM : SOCK_STREAM, 0);
+	if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		perror("connect");
+		return 1;
+	}
+	if (zerocopy &&
+	    setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one))) {
+		perror("SO_ZEROCOPY");
+		return 1;
+	}
+
+	/* Pages are never written while sends may still reference them */
+	buf = malloc(size);
+	if (!buf)
+		return 1;
+	memset(buf, 0x5a, size);
+
+	t = now();
+	c = cpu_time();
+	end = t + secs;
+	while (now() < end) {
+		int i;
+
+		for (i = 0; i < 64; i++) {
+			ssize_t ret = send(fd, buf, size,
+					   zerocopy ? MSG_ZEROCOPY : 0);
+
+			if (ret < 0) {
+				/* Out of optmem for notifications */
+				if (errno == ENOBUFS && zerocopy) {
+					wait_completions(fd);
+					continue;
+				}
+				if (errno == ECONNREFUSED || errno == ENOBUFS)
+					continue;
+				perror("send");
+				return 1;
+			}
+			bytes += ret;
+			sends++;
+		}
+		if (zerocopy)
+			read_completions(fd);
+	}
+	t = now() - t;
+	c = cpu_time() - c;
+
+	/* Collect what is still outstanding, for up to a second */
+	if (zerocopy) {
+		for (end = now() + 1; completed < sends && now() < end; )
+			wait_completions(fd);
+	}
+
+	printf("%s%s, %lu byte sends to %s for %ds\n", udp ? "udp" : "tcp",
+	       zerocopy ? " MSG_ZEROCOPY" : "", size, host, secs);
+	printf("%.1f MB/s (%.2f Gbit/s), %.2f s cpu per GB, %lu sends\n",
+	       bytes / t / 1e6, bytes * 8 / t / 1e9,
+	       bytes ? c / (bytes / 1e9) : 0, sends);
+	if (zerocopy)
+		printf("completions: %lu notifications for %lu of %lu sends, "
+		       "%lu copied (%.1f%%), %lu zerocopy\n",
+		       completions, completed, sends, copied,
+		       completed ? 100.0 * copied / completed : 0,
+		       completed - copied);
+
+	if (child) {
+		kill(child, SIGTERM);
+		waitpid(child, NULL, 0);
+	}
+	return 0;
+}